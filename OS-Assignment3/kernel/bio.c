@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -22,70 +22,151 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "trace.h"
 
 struct {
-  struct spinlock lock;
   struct buf buf[NBUF];
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  // Hash table of all buffers, keyed by (dev, blockno).
+  // Each bucket is a list through next, with its own lock,
+  // so lookups of different blocks don't contend.
+  struct spinlock lock[NBUCKET];
+  struct buf bucket[NBUCKET];
+
+  // Serializes recycling buffers between buckets.
+  struct spinlock evictlock;
 } bcache;
 
+static int
+bhash(uint dev, uint blockno)
+{
+  return (dev * 31 + blockno) % NBUCKET;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  int i;
 
-  initlock(&bcache.lock, "bcache");
+  initlock(&bcache.evictlock, "bcache");
+  for(i = 0; i < NBUCKET; i++){
+    initlock(&bcache.lock[i], "bcache.bucket");
+    bcache.bucket[i].next = 0;
+  }
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  // Spread the buffers over the buckets; they move
+  // to the right one when they are first used.
+  for(i = 0, b = bcache.buf; b < bcache.buf+NBUF; b++, i++){
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->next = bcache.bucket[i % NBUCKET].next;
+    bcache.bucket[i % NBUCKET].next = b;
   }
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Look for block on device dev in bucket h, whose lock is held.
+// If found, take a reference to it.
 static struct buf*
-bget(uint dev, uint blockno)
+blookup(int h, uint dev, uint blockno)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bcache.bucket[h].next; b; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
       return b;
     }
   }
+  return 0;
+}
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return locked buffer. For read-ahead (ahead != 0)
+// return 0 instead if the block is cached, or no buffer is free.
+static struct buf*
+bget(uint dev, uint blockno, int ahead)
+{
+  struct buf *b, *prev, *best, *bestprev;
+  int h = bhash(dev, blockno), i, besti;
+
+  // Is the block already cached?
+  acquire(&bcache.lock[h]);
+  b = blookup(h, dev, blockno);
+  if(b && ahead)
+    b->refcnt--;
+  release(&bcache.lock[h]);
+  if(b && ahead)
+    return 0;
+  if(b){
+    TRACEPOINT(TR_BHIT, dev, blockno);
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  // Not cached. Only one CPU at a time moves buffers between
+  // buckets, so look again: another may just have cached it.
+  acquire(&bcache.evictlock);
+  acquire(&bcache.lock[h]);
+  b = blookup(h, dev, blockno);
+  if(b && ahead)
+    b->refcnt--;
+  release(&bcache.lock[h]);
+  if(b && ahead){
+    release(&bcache.evictlock);
+    return 0;
+  }
+  if(b){
+    release(&bcache.evictlock);
+    TRACEPOINT(TR_BHIT, dev, blockno);
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  // Recycle the least recently used (LRU) unused buffer. The
+  // lock of the bucket holding the best one so far stays held,
+  // so it cannot be taken while the others are searched.
+  best = bestprev = 0;
+  besti = -1;
+  for(i = 0; i < NBUCKET; i++){
+    int found = 0;
+    acquire(&bcache.lock[i]);
+    for(prev = &bcache.bucket[i], b = prev->next; b; prev = b, b = b->next){
+      if(b->refcnt == 0 && (best == 0 || b->lastuse < best->lastuse)){
+        best = b;
+        bestprev = prev;
+        found = 1;
+      }
     }
+    if(found){
+      if(besti >= 0)
+        release(&bcache.lock[besti]);
+      besti = i;
+    } else
+      release(&bcache.lock[i]);
+  }
+  if(best == 0 && ahead){
+    release(&bcache.evictlock);
+    return 0;
   }
-  panic("bget: no buffers");
+  if(best == 0)
+    panic("bget: no buffers");
+
+  // Move it to bucket h.
+  bestprev->next = best->next;
+  release(&bcache.lock[besti]);
+  best->dev = dev;
+  best->blockno = blockno;
+  best->valid = 0;
+  best->refcnt = 1;
+  acquire(&bcache.lock[h]);
+  best->next = bcache.bucket[h].next;
+  bcache.bucket[h].next = best;
+  release(&bcache.lock[h]);
+  release(&bcache.evictlock);
+  TRACEPOINT(TR_BMISS, dev, blockno);
+  acquiresleep(&best->lock);
+  return best;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,7 +175,7 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
@@ -102,6 +183,41 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Start reading the block into the cache, and don't wait for it.
+// Only a hint: nothing happens if it is cached already, or there
+// is no free buffer. The buffer stays locked, so bread() waits
+// for it, until the disk is done and calls breaddone().
+void
+bprefetch(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bget(dev, blockno, 1)) == 0)
+    return;
+  if(b->valid){   // someone else read it first
+    brelse(b);
+    return;
+  }
+  virtio_disk_readahead(b);
+}
+
+// The disk has read b for bprefetch(). Called from the disk
+// interrupt, which holds no process's locks: release b like
+// brelse() does, but without asking who holds it.
+void
+breaddone(struct buf *b)
+{
+  int h = bhash(b->dev, b->blockno);
+
+  b->valid = 1;
+  releasesleep(&b->lock);
+  acquire(&bcache.lock[h]);
+  b->refcnt--;
+  if(b->refcnt == 0)
+    b->lastuse = ticks;
+  release(&bcache.lock[h]);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,43 +227,55 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Write the contents of the n bufs at bs to disk, with the
+// disk working on several at once. All must be locked.
+void
+bwritev(struct buf **bs, int n)
+{
+  for(int i = 0; i < n; i++)
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwritev");
+  virtio_disk_rwv(bs, n, 1);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Stamp it with the time, for LRU recycling.
 void
 brelse(struct buf *b)
 {
+  int h = bhash(b->dev, b->blockno);
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  acquire(&bcache.lock[h]);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->lastuse = ticks;
   }
   
-  release(&bcache.lock);
+  release(&bcache.lock[h]);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  int h = bhash(b->dev, b->blockno);
+
+  acquire(&bcache.lock[h]);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bcache.lock[h]);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  int h = bhash(b->dev, b->blockno);
+
+  acquire(&bcache.lock[h]);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bcache.lock[h]);
 }
 
 
@@ -20,6 +20,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "defs.h"
+#include "pstat.h"
 #include "proc.h"
 
 #define BACKSPACE 0x100
@@ -35,9 +36,9 @@ consputc(int c)
 {
   if(c == BACKSPACE){
     // if the user typed backspace, overwrite with a space.
-    uartputc_sync('\b'); uartputc_sync(' '); uartputc_sync('\b');
+    uartputc_async('\b'); uartputc_async(' '); uartputc_async('\b');
   } else {
-    uartputc_sync(c);
+    uartputc_async(c);
   }
 }
 
@@ -53,18 +54,20 @@ struct {
 } cons;
 
 //
-// user write()s to the console go here.
+// user write()s to the console go here,
+// a bufferful at a time.
 //
 int
 consolewrite(int user_src, uint64 src, int n)
 {
-  int i;
+  char buf[512];
+  int i, m;
 
-  for(i = 0; i < n; i++){
-    char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
+  for(i = 0; i < n; i += m){
+    m = n - i < sizeof(buf) ? n - i : sizeof(buf);
+    if(either_copyin(buf, user_src, src+i, m) == -1)
       break;
-    uartputc(c);
+    uartwrite(buf, m);
   }
 
   return i;
@@ -138,8 +141,15 @@ consoleintr(int c)
   acquire(&cons.lock);
 
   switch(c){
-  case C('P'):  // Print process list.
+  case C('P'):  // Print process list and allocator statistics.
     procdump();
+    kallocdump();
+    kcachedump();
+    zswapdump();
+    textdump();
+#if LOCKSTAT
+    lockstatdump();
+#endif
     break;
   case C('U'):  // Kill line.
     while(cons.e != cons.w &&
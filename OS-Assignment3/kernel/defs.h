@@ -2,8 +2,14 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kcache;
+struct paging_meta_data;
+struct pagingstate;
+struct evict;
+struct policy;
 struct pipe;
 struct proc;
+struct shm;
 struct spinlock;
 struct sleeplock;
 struct stat;
@@ -13,7 +19,10 @@ struct superblock;
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
+void            bprefetch(uint, uint);
+void            breaddone(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
@@ -38,6 +47,7 @@ int             kfilewrite(struct file*, uint64, int n);
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
+void            dirunlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
@@ -57,8 +67,11 @@ void            itrunc(struct inode*);
 int		        createSwapFile(struct proc* p);
 int	          	readFromSwapFile(struct proc * p, char* buffer, uint placeOnFile, uint size);
 int		        writeToSwapFile(struct proc* p, char* buffer, uint placeOnFile, uint size);
+int             writePagesToSwapFile(struct proc* p, char** pages, uint* placesOnFile, int n);
+int             readPagesFromSwapFile(struct proc* p, char** pages, uint* placesOnFile, int n);
 int		        removeSwapFile(struct proc* p);
 int             copySwapFile(struct proc* np);
+void            swappoolinit(void);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -68,6 +81,14 @@ void            ramdiskrw(struct buf*);
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
+void            kdup(void *);
+int             krefcount(void *);
+int             kfreepages(void);
+void            kallocdump(void);
+void*           kalloc_zeroed(void);
+int             kzerofill(void);
+void*           kalloc_pages(int);
+void            kfree_pages(void *, int);
 void            kinit(void);
 
 // log.c
@@ -75,8 +96,22 @@ void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            begin_opn(int);
+void            end_opn(int);
+void            log_sync(void);
+int             log_maxop(void);
+
+// mmap.c
+struct vma*     vmafind(struct proc*, uint64);
+void            mmapread(struct vma*, uint64, char*);
+void            mmapwrite(struct vma*, uint64, char*);
+uint64          mmap(uint64, uint64, int, int, struct file*, uint);
+int             munmap(uint64, uint64);
+int             mmapfork(struct proc*, struct proc*);
+void            mmapexit(struct proc*);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -91,6 +126,7 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             clone(uint64, uint64, uint64);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
@@ -99,22 +135,84 @@ int             kill(int);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
+struct proc*    myspace(void);
 void            procinit(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            kthread(char*, void (*)(void));
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
+void            runnable(struct proc*);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+void            vmlock(struct proc*);
+void            vmunlock(struct proc*);
+void            vmsettle(struct proc*);
+void            tlbstop(struct proc*);
+void            tlbstart(struct proc*);
+void            tlbwait(struct proc*);
+int             reclaim(int);
+int             setpolicy(int, int);
+int             getpagestats(int, uint64);
+int             setnice(int, int);
+void            kswapdwake(void);
+void            kswapd(void);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// slab.c
+void            kcacheinit(struct kcache*, char*, uint);
+void*           kcachealloc(struct kcache*);
+void            kcachefree(struct kcache*, void*);
+void            kcachedump(void);
+
+// zswap.c
+void            zswapinit(void);
+uint            zswapstore(char*);
+void            zswapload(uint, char*);
+void            zswapdup(uint);
+void            zswapfree(uint);
+void            zswapdump(void);
+
+// the swap "offset" of page kept by zswap, and back.
+#define ZOFF(z)         (((uint)(z) << 12) | 1)
+#define ZENT(off)       ((off) >> 12)
+#define ZSWAPPED(off)   ((off) != -1 && ((off) & 1))
+
+// shm.c
+void            shminit(void);
+struct shm*     shmalloc(int);
+struct shm*     shmdup(struct shm*);
+void            shmfree(struct shm*);
+char*           shmpage(struct shm*, int);
+
+// textcache.c
+void            textinit(void);
+char*           textget(struct inode*, uint, uint);
+void            textinval(struct inode*);
+int             textreclaim(int);
+void            textdump(void);
+
+// kbench.c
+void            kbenchinit(void);
+int             kbench(int, int, uint64, uint64, uint64);
+
+// swap.c
+void            swapinit(struct superblock*);
+int             swapdevice(void);
+uint            swapalloc(void);
+uint            swapallocrun(int);
+void            swapfree(uint);
+void            swapdup(uint);
+void            swaprw(char*, uint, int);
+void            swaprwv(char**, uint*, int, int);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
@@ -122,6 +220,11 @@ void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+#if LOCKSTAT
+struct lockstat* lockstatof(char*, int);
+void            lockstathold(struct lockstat*, uint64);
+void            lockstatdump(void);
+#endif
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
@@ -133,6 +236,8 @@ void            initsleeplock(struct sleeplock*, char*);
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
 void*           memset(void*, int, uint);
+void            pagezero(void*);
+void            pagecopy(void*, const void*);
 char*           safestrcpy(char*, const char*, int);
 int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
@@ -144,6 +249,7 @@ int             argstr(int, char*, int);
 int             argaddr(int, uint64 *);
 int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
+uint64          syscallv(int, uint64*);
 void            syscall();
 
 // sysfile
@@ -160,7 +266,8 @@ void            usertrapret(void);
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
-void            uartputc(int);
+void            uartwrite(char*, int);
+void            uartputc_async(int);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
@@ -173,21 +280,52 @@ pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
+int             uvmlazy(struct proc*, uint64, int);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopyrange(pagetable_t, pagetable_t, uint64, uint64, int);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+int             uvmcow(pagetable_t, uint64);
+uint64          uvmlend(pagetable_t, uint64);
+int             uvmtake(pagetable_t, uint64, uint64);
 uint64          walkaddr(pagetable_t, uint64);
+uint64          uvmtranslate(pagetable_t, uint64, int);
+void            tcflush(struct proc*);
+int             uvmpin(uint64, int, int);
+void            uvmunpin(uint64, int);
+int             uvmlock(uint64, uint64, int);
+int             uvmadvise(uint64, uint64, int);
 pte_t*          walk(pagetable_t, uint64, int);
 void            swap_in(struct proc*, uint64, pte_t*);
-void            page_to_file(struct proc*, uint);
-int             getIndexToRemove(void);
+int             page_to_file(struct proc*, int);
+void            uvmtrim(struct proc*);
+int             evictstart(struct proc*, int, struct evict*);
+void            evictend(struct proc*, struct evict*);
+int             getIndexToRemove(struct proc*);
+int             peekvictim(struct proc*);
+struct policy*  pagepolicy(int);
+int             policyno(struct policy*);
 int             nfua(struct proc*);
 int             lapa(struct proc*);
 int             scfifo(struct proc*);
+int             arc(struct proc*);
 uint            initAging(int);
 void            updateAging();
-uint            getOffset();
+void            threadAging(struct proc*);
+void            pffupdate(struct proc*);
+void            initSwapSlots(struct proc*);
+uint            allocSwapSlot(struct proc*);
+uint            allocSwapRun(struct proc*, int);
+void            freeSwapSlot(struct proc*, uint);
+void            releaseSwapSlots(struct proc*);
+struct paging_meta_data* pagemeta(struct proc*, int, int);
+int             nextSwappedPage(struct proc*, int);
+int             copyPaging(struct proc*, struct proc*);
+void            freePaging(struct proc*);
+void            stashPaging(struct proc*, struct pagingstate*);
+void            restorePaging(struct proc*, struct pagingstate*);
+void            dropPaging(struct proc*, struct pagingstate*);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
@@ -201,7 +339,24 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rwv(struct buf **, int, int);
+void            virtio_disk_readahead(struct buf *);
+void            virtio_disk_rwblocks(uint, void *, int, int);
+void            virtio_disk_rwblocksv(uint *, char **, int, int, int);
 void            virtio_disk_intr(void);
 
+// trace.c
+extern int      tracing;
+void            traceinit(void);
+void            tracerecord(int, uint64, uint64);
+
+// records a trace event (TR_* in trace.h), if tracing is on.
+#define TRACEPOINT(ev, a, b) do { if(tracing) tracerecord((ev), (a), (b)); } while(0)
+
+// prof.c
+extern int      profiling;
+void            profinit(void);
+void            profsample(uint64, int);
+
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -3,11 +3,14 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "pstat.h"
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
 
 static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
+static int mapseg(struct proc *p, pagetable_t pagetable, struct proghdr *ph);
+static int mapshared(pagetable_t pagetable, struct proghdr *ph, struct inode *ip);
 
 int
 exec(char *path, char **argv)
@@ -16,30 +19,32 @@ exec(char *path, char **argv)
   int i, off;
   uint64 argc, sz = 0, sp, ustack[MAXARG+1], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *execip = 0;
   struct proghdr ph;
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
+  struct execseg seg[NEXECSEG];
+  struct pagingstate oldpaging;
+  int nseg = 0, lazy = 0, shared = 1;
 
+  // the other threads run on the memory exec() replaces
+  if(p->mm != p || p->nthreads > 1)
+    return -1;
+
+  vmsettle(p);
+  vmlock(p);
   begin_op();
 
   if((ip = namei(path)) == 0){
     end_op();
+    vmunlock(p);
     return -1;
   }
   ilock(ip);
 
-  // Resetting all data
-  for(int i = 0; i < MAX_TOTAL_PAGES; i++){
-    p->data[i].offset = -1;  
-    p->data[i].inUse = 0;
-    p->data[i].agingCounter = 0;
-    p->pages[i] = -1;
-  }
-  p->head = 0;
-  p->numOfPages = 0;
-  p->tail = -1;
-  p->pagesInMemory = 0;
+  // the new image's paging state is built in p, the old one is
+  // kept until the commit, like the old pagetable.
+  stashPaging(p, &oldpaging);
 
   // Check ELF header
   if(readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -50,6 +55,23 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
+  // a paged process gets its segments read in from the file as
+  // they are touched, see execpage_in(), if there are not too many.
+  #if SELECTION != NONE
+    if(p->pid > 1){
+      // execpage_in() shares the text, not p's paging.
+      lazy = 1;
+      shared = 0;
+      for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
+        if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
+          goto bad;
+        if(ph.type == ELF_PROG_LOAD && nseg++ == NEXECSEG)
+          lazy = 0;
+      }
+      nseg = 0;
+    }
+  #endif
+
   // Load program into memory.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
@@ -60,15 +82,44 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
+    if(lazy && ph.vaddr < sz)
+      goto bad;   // out of order or overlapping
+    if(ph.vaddr % PGSIZE != 0)
+      goto bad;
+    if(lazy){
+      // the pages past filesz are zero-filled by uvmlazy().
+      if(mapseg(p, pagetable, &ph) < 0)
+        goto bad;
+      seg[nseg].vaddr = ph.vaddr;
+      seg[nseg].filesz = ph.filesz;
+      seg[nseg].off = ph.off;
+      nseg++;
+      sz = ph.vaddr + ph.memsz;
+      continue;
+    }
     uint64 sz1;
+    if(shared && (ph.flags & ELF_PROG_FLAG_WRITE) == 0 && ph.vaddr >= PGROUNDUP(sz)){
+      // read-only: the pages every process running it maps.
+      if(ph.vaddr > sz && (sz1 = uvmalloc(pagetable, sz, ph.vaddr)) == 0)
+        goto bad;
+      sz = PGROUNDUP(ph.vaddr + ph.filesz);
+      if(mapshared(pagetable, &ph, ip) < 0)
+        goto bad;
+      if(ph.vaddr + ph.memsz > sz){
+        if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
+          goto bad;
+        sz = sz1;
+      }
+      continue;
+    }
     if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
       goto bad;
     sz = sz1;
-    if(ph.vaddr % PGSIZE != 0)
-      goto bad;
     if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
+  if(lazy)
+    execip = idup(ip);
   iunlockput(ip);
   end_op();
   ip = 0;
@@ -121,25 +172,96 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  mmapexit(p);
   oldpagetable = p->pagetable;
+  tcflush(p);
   p->pagetable = pagetable;
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
   proc_freepagetable(oldpagetable, oldsz);
+  dropPaging(p, &oldpaging);
+  if(p->execip){
+    begin_op();
+    iput(p->execip);
+    end_op();
+  }
+  p->execip = execip;
+  memmove(p->seg, seg, sizeof(seg));
+  p->nseg = nseg;
+  uvmtrim(p);
+  vmunlock(p);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
   if(pagetable)
     proc_freepagetable(pagetable, sz);
+  restorePaging(p, &oldpaging);
   if(ip){
     iunlockput(ip);
     end_op();
+  } else if(execip){
+    begin_op();
+    iput(execip);
+    end_op();
   }
+  vmunlock(p);
   return -1;
 }
 
+// Map the pages of a program segment that come from the file as
+// swapped out to nowhere, so the first touch reads them in from
+// the executable. The rest of the segment is left unmapped.
+// Returns 0 on success, -1 on failure.
+static int
+mapseg(struct proc *p, pagetable_t pagetable, struct proghdr *ph)
+{
+  struct paging_meta_data *m;
+  uint64 a;
+  pte_t *pte;
+  int perm = PTE_U | PTE_R | PTE_PG;
+
+  if(ph->flags & ELF_PROG_FLAG_WRITE)
+    perm |= PTE_W;
+  if(ph->flags & ELF_PROG_FLAG_EXEC)
+    perm |= PTE_X;
+  for(a = ph->vaddr; a < ph->vaddr + ph->filesz; a += PGSIZE){
+    if((pte = walk(pagetable, a, 1)) == 0 || (m = pagemeta(p, a/PGSIZE, 1)) == 0)
+      return -1;
+    *pte = perm;
+    m->offset = -1;
+    m->inUse = 0;
+    m->file = 1;
+  }
+  return 0;
+}
+
+// Map the pages of a read-only segment that come from the file
+// from the shared text cache, see textcache.c. ip must be locked.
+// Returns 0 on success, -1 on failure.
+static int
+mapshared(pagetable_t pagetable, struct proghdr *ph, struct inode *ip)
+{
+  uint64 a;
+  uint n;
+  char *mem;
+  int perm = PTE_U | PTE_R;
+
+  if(ph->flags & ELF_PROG_FLAG_EXEC)
+    perm |= PTE_X;
+  for(a = 0; a < ph->filesz; a += PGSIZE){
+    n = ph->filesz - a < PGSIZE ? ph->filesz - a : PGSIZE;
+    if((mem = textget(ip, ph->off + a, n)) == 0)
+      return -1;
+    if(mappages(pagetable, ph->vaddr + a, PGSIZE, (uint64)mem, perm) != 0){
+      kfree(mem);
+      return -1;
+    }
+  }
+  return 0;
+}
+
 // Load a program segment into pagetable at virtual address va.
 // va must be page-aligned
 // and the pages from va to va+sz must already be mapped.
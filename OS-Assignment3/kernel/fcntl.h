@@ -3,3 +3,17 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+
+// mmap()
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+#define MAP_SHARED  0x1
+#define MAP_PRIVATE 0x2
+#define MAP_ANON    0x4
+
+// madvise()
+#define MADV_NORMAL     0   // read ahead when faults look sequential
+#define MADV_RANDOM     1   // never read ahead
+#define MADV_SEQUENTIAL 2   // always read ahead, as far as allowed
+#define MADV_WILLNEED   3   // bring the pages in now
+#define MADV_DONTNEED   4   // drop them: private ones read as zeros again
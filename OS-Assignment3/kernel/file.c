@@ -11,6 +11,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "stat.h"
+#include "pstat.h"
 #include "proc.h"
 
 struct devsw devsw[NDEV];
@@ -102,26 +103,49 @@ filestat(struct file *f, uint64 addr)
 }
 
 // Read from file f.
-// addr is a user virtual address.
+// addr is a user virtual address. The user buffer is pinned
+// (see uvmpin()) while it is being filled, a chunk at a time.
 int
 fileread(struct file *f, uint64 addr, int n)
 {
-  int r = 0;
+  int r = 0, i, m;
 
   if(f->readable == 0)
     return -1;
+  if(n == 0)
+    return 0;   // nothing to pin
 
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    if((m = uvmpin(addr, n, 1)) == 0)
+      return -1;
+    r = piperead(f->pipe, addr, m);
+    uvmunpin(addr, m);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    if((m = uvmpin(addr, n, 1)) == 0)
+      return -1;
+    r = devsw[f->major].read(1, addr, m);
+    uvmunpin(addr, m);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    for(i = 0; i < n; i += r){
+      if((m = uvmpin(addr + i, n - i, 1)) == 0){
+        r = -1;
+        break;
+      }
+      ilock(f->ip);
+      if((r = readi(f->ip, 1, addr + i, f->off, m)) > 0)
+        f->off += r;
+      iunlock(f->ip);
+      uvmunpin(addr + i, m);
+      if(r < m){
+        if(r > 0)
+          i += r;
+        break;
+      }
+    }
+    if(i > 0)
+      r = i;
   } else {
     panic("fileread");
   }
@@ -130,41 +154,72 @@ fileread(struct file *f, uint64 addr, int n)
 }
 
 // Write to file f.
-// addr is a user virtual address.
+// addr is a user virtual address. As in fileread(), the user
+// buffer is pinned while it is being used, a chunk at a time.
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  int r, ret = 0, m;
 
   if(f->writable == 0)
     return -1;
+  if(n == 0)
+    return 0;
 
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    while(ret < n){
+      if((m = uvmpin(addr + ret, n - ret, 0)) == 0)
+        return ret > 0 ? ret : -1;
+      r = pipewrite(f->pipe, addr + ret, m);
+      uvmunpin(addr + ret, m);
+      if(r < 0)
+        return -1;
+      ret += r;
+      if(r < m)
+        break;
+    }
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
+    while(ret < n){
+      if((m = uvmpin(addr + ret, n - ret, 0)) == 0)
+        return ret > 0 ? ret : -1;
+      r = devsw[f->major].write(1, addr + ret, m);
+      uvmunpin(addr + ret, m);
+      if(r < 0)
+        return -1;
+      ret += r;
+      if(r < m)
+        break;
+    }
   } else if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // i-node, allocation blocks, 2 blocks of slop for
+    // non-aligned writes, and the block-map blocks bmap()
+    // may allocate, each with its bitmap block: at most
+    // three, as a chunk is far shorter than NINDIRECT
+    // blocks (the indirect block, the doubly-indirect one
+    // and a child of it, or that and two children).
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int nblocks = FILEWRITEBLOCKS < log_maxop() ? FILEWRITEBLOCKS : log_maxop();
+    int max = ((nblocks-1-2-3*2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
+      if((n1 = uvmpin(addr + i, n1, 0)) == 0)
+        break;
 
-      begin_op();
+      begin_opn(nblocks);
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
-      end_op();
+      end_opn(nblocks);
+      uvmunpin(addr + i, n1);
 
       if(r != n1){
         // error from writei
@@ -227,23 +282,28 @@ kfilewrite(struct file *f, uint64 addr, int n)
   } else if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // i-node, allocation blocks, 2 blocks of slop for
+    // non-aligned writes, and the block-map blocks bmap()
+    // may allocate, each with its bitmap block: at most
+    // three, as a chunk is far shorter than NINDIRECT
+    // blocks (the indirect block, the doubly-indirect one
+    // and a child of it, or that and two children).
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int nblocks = FILEWRITEBLOCKS < log_maxop() ? FILEWRITEBLOCKS : log_maxop();
+    int max = ((nblocks-1-2-3*2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
-      begin_op();
+      begin_opn(nblocks);
       ilock(f->ip);
       if ((r = writei(f->ip, 0, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
-      end_op();
+      end_opn(nblocks);
 
       if(r != n1){
         // error from writei
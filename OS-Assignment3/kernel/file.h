@@ -13,20 +13,34 @@ struct file {
 #define minor(dev)  ((dev) & 0xFFFF)
 #define	mkdev(m,n)  ((uint)((m)<<16| (n)))
 
+#define NEXTENT 4   // runs of blocks each inode remembers, see bmap()
+
 // in-memory copy of an inode
 struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next;     // hash chain (bucket lock)
+  struct inode *freenext; // free list, while ref is 0 (itable.freelock)
+  struct inode *freeprev;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint nextblock;     // where to look for its next new block, or 0
+  uint rnext;         // block after readi()'s last one, see readahead()
+  uint rahead;        // blocks below have been read ahead
+  struct {            // runs of blocks past the direct ones: bn..bn+len-1
+    uint bn;          // are at addr..addr+len-1 on disk
+    uint addr;
+    uint len;         // 0 if unused
+  } ext[NEXTENT];
+  int extnext;        // the one to replace next
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
 };
 
 // map major device number to device functions.
@@ -38,3 +52,5 @@ struct devsw {
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define TRACE   2
+#define PROF    3
@@ -15,6 +15,7 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "pstat.h"
 #include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
@@ -45,6 +46,8 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  swapinit(&sb);
+  swappoolinit();
 }
 
 // Zero a block.
@@ -61,28 +64,48 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Where the last allocation left off: a file with no hint of
+// its own starts searching here (next fit), so new blocks are
+// handed out in order rather than from the front of the disk.
+static uint bcursor;
+
+// Allocate a zeroed disk block, the first free one at or
+// after hint (wrapping around), or after bcursor if the
+// hint is 0. Whole bytes of the bitmap that are in use are
+// skipped at once.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint hint)
 {
-  int b, bi, m;
+  uint b, n, start;
+  int bi, m;
   struct buf *bp;
 
+  start = (hint > 0 && hint < sb.size) ? hint : bcursor % sb.size;
   bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
+  for(n = 0; n < sb.size; n++){
+    b = (start + n) % sb.size;
+    if(bp == 0 || bp->blockno != BBLOCK(b, sb)){
+      if(bp)
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+      bp = bread(dev, BBLOCK(b, sb));
+    }
+    bi = b % BPB;
+    if(bi % 8 == 0 && b + 8 <= sb.size && bp->data[bi/8] == 0xff){
+      n += 7;  // all 8 in use
+      continue;
+    }
+    m = 1 << (bi % 8);
+    if((bp->data[bi/8] & m) == 0){  // Is block free?
+      bp->data[bi/8] |= m;  // Mark block in use.
+      log_write(bp);
+      brelse(bp);
+      bzero(dev, b);
+      bcursor = b + 1;
+      return b;
     }
-    brelse(bp);
   }
+  if(bp)
+    brelse(bp);
   panic("balloc: out of blocks");
 }
 
@@ -163,32 +186,78 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
+// The itable is hashed by (dev, inum), and each hash bucket has
+// a spin-lock. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// holds, one must hold the lock of ip's bucket while using any
+// of those fields. Entries whose ref has fallen to zero stay in
+// their bucket, still valid, on a free list in LRU order, so an
+// i-node that is opened again needn't be read from disk again.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
 struct {
-  struct spinlock lock;
   struct inode inode[NINODE];
+
+  struct spinlock lock[NIBUCKET];
+  struct inode *bucket[NIBUCKET];  // lists through next
+
+  // Unreferenced entries, least recently used first.
+  struct spinlock freelock;
+  struct inode free;               // list head, through freenext/freeprev
+
+  // Serializes recycling entries between buckets.
+  struct spinlock evictlock;
 } itable;
 
+static int
+ihash(uint dev, uint inum)
+{
+  return (dev * 31 + inum) % NIBUCKET;
+}
+
+// Append ip to the free list. Caller holds itable.freelock.
+static void
+ifreeput(struct inode *ip)
+{
+  ip->freenext = &itable.free;
+  ip->freeprev = itable.free.freeprev;
+  itable.free.freeprev->freenext = ip;
+  itable.free.freeprev = ip;
+}
+
+// Take ip off the free list. Caller holds itable.freelock.
+static void
+ifreedel(struct inode *ip)
+{
+  ip->freeprev->freenext = ip->freenext;
+  ip->freenext->freeprev = ip->freeprev;
+}
+
+static void dinit(void);
+static void dpurge(struct inode*);
+
 void
 iinit()
 {
   int i = 0;
   
-  initlock(&itable.lock, "itable");
+  initlock(&itable.evictlock, "itable");
+  initlock(&itable.freelock, "itable.free");
+  for(i = 0; i < NIBUCKET; i++)
+    initlock(&itable.lock[i], "itable.bucket");
+  itable.free.freenext = itable.free.freeprev = &itable.free;
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
+    ifreeput(&itable.inode[i]);
   }
+  dinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
+static void extclear(struct inode*);
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
@@ -237,38 +306,93 @@ iupdate(struct inode *ip)
   brelse(bp);
 }
 
+// Look for inode inum on dev in bucket h, whose lock is held.
+// If found, take a reference to it.
+static struct inode*
+ilookup(int h, uint dev, uint inum)
+{
+  struct inode *ip;
+
+  for(ip = itable.bucket[h]; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0){
+        acquire(&itable.freelock);
+        ifreedel(ip);
+        release(&itable.freelock);
+      }
+      return ip;
+    }
+  }
+  return 0;
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
-
-  acquire(&itable.lock);
+  struct inode *ip, **pp;
+  int h = ihash(dev, inum), h2;
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&itable.lock);
-      return ip;
-    }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+  acquire(&itable.lock[h]);
+  ip = ilookup(h, dev, inum);
+  release(&itable.lock[h]);
+  if(ip)
+    return ip;
+
+  // Not there. Only one CPU at a time moves entries between
+  // buckets, so look again: another may just have added it.
+  acquire(&itable.evictlock);
+  acquire(&itable.lock[h]);
+  ip = ilookup(h, dev, inum);
+  release(&itable.lock[h]);
+  if(ip){
+    release(&itable.evictlock);
+    return ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Recycle the least recently used free entry. A hit may take
+  // it off the free list meanwhile, holding its bucket's lock,
+  // so take that lock and check again.
+  for(;;){
+    acquire(&itable.freelock);
+    ip = itable.free.freenext;
+    release(&itable.freelock);
+    if(ip == &itable.free)
+      panic("iget: no inodes");
+    h2 = ihash(ip->dev, ip->inum);
+    acquire(&itable.lock[h2]);
+    if(ip->ref == 0)
+      break;
+    release(&itable.lock[h2]);
+  }
+  acquire(&itable.freelock);
+  ifreedel(ip);
+  release(&itable.freelock);
+  for(pp = &itable.bucket[h2]; *pp; pp = &(*pp)->next){
+    if(*pp == ip){
+      *pp = ip->next;
+      break;
+    }
+  }
+  release(&itable.lock[h2]);
 
-  ip = empty;
+  // Move it to bucket h.
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
-  release(&itable.lock);
+  ip->nextblock = 0;
+  ip->rnext = 0;
+  ip->rahead = 0;
+  extclear(ip);
+  acquire(&itable.lock[h]);
+  ip->next = itable.bucket[h];
+  itable.bucket[h] = ip;
+  release(&itable.lock[h]);
+  release(&itable.evictlock);
 
   return ip;
 }
@@ -278,9 +402,11 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
+  int h = ihash(ip->dev, ip->inum);
+
+  acquire(&itable.lock[h]);
   ip->ref++;
-  release(&itable.lock);
+  release(&itable.lock[h]);
   return ip;
 }
 
@@ -333,7 +459,9 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquire(&itable.lock);
+  int h = ihash(ip->dev, ip->inum);
+
+  acquire(&itable.lock[h]);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -342,8 +470,10 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&itable.lock);
+    release(&itable.lock[h]);
 
+    if(ip->type == T_DIR)
+      dpurge(ip);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
@@ -351,11 +481,15 @@ iput(struct inode *ip)
 
     releasesleep(&ip->lock);
 
-    acquire(&itable.lock);
+    acquire(&itable.lock[h]);
   }
 
-  ip->ref--;
-  release(&itable.lock);
+  if(--ip->ref == 0){
+    acquire(&itable.freelock);
+    ifreeput(ip);
+    release(&itable.freelock);
+  }
+  release(&itable.lock[h]);
 }
 
 // Common idiom: unlock, then put.
@@ -371,40 +505,141 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The NDINDIRECT after
+// those are listed in the NINDIRECT blocks that the doubly
+// indirect block ip->addrs[NDIRECT+1] lists.
+
+// Allocate a block for ip, right after the last one it got,
+// so that a file written sequentially stays contiguous.
+static uint
+iballoc(struct inode *ip)
+{
+  uint addr = balloc(ip->dev, ip->nextblock);
+
+  ip->nextblock = addr + 1;
+  return addr;
+}
+
+// Forget ip's runs of blocks.
+static void
+extclear(struct inode *ip)
+{
+  for(int i = 0; i < NEXTENT; i++)
+    ip->ext[i].len = 0;
+  ip->extnext = 0;
+}
+
+// The disk address of block bn of ip, if it is in a run
+// ip remembers, else 0.
+static uint
+extlookup(struct inode *ip, uint bn)
+{
+  for(int i = 0; i < NEXTENT; i++)
+    if(bn - ip->ext[i].bn < ip->ext[i].len)
+      return ip->ext[i].addr + (bn - ip->ext[i].bn);
+  return 0;
+}
+
+// Remember the run of blocks around a[k], the ones that follow each
+// other on disk (as iballoc() tries to make them), where a is the
+// indirect block that lists ip's blocks from block base on.
+static void
+extfill(struct inode *ip, uint base, uint *a, uint k)
+{
+  uint s = k, e = k + 1;
+  int i;
+
+  while(s > 0 && a[s-1] != 0 && a[s-1] + 1 == a[s])
+    s--;
+  while(e < NINDIRECT && a[e] != 0 && a[e] == a[e-1] + 1)
+    e++;
+  i = ip->extnext;
+  ip->extnext = (i + 1) % NEXTENT;
+  ip->ext[i].bn = base + s;
+  ip->ext[i].addr = a[s];
+  ip->ext[i].len = e - s;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one. Blocks past the
+// direct ones are looked up in the runs ip remembers first, and
+// otherwise added to them, so a sequential reader or writer reads
+// an indirect block once per run rather than once per block.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr, *a, lbn = bn;
   struct buf *bp;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = iballoc(ip);
     return addr;
   }
+  if((addr = extlookup(ip, bn)) != 0)
+    return addr;
   bn -= NDIRECT;
 
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT] = addr = iballoc(ip);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+      a[bn] = addr = iballoc(ip);
+      log_write(bp);
+    }
+    extfill(ip, NDIRECT, a, bn);
+    brelse(bp);
+    return addr;
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load the doubly-indirect block, then the indirect
+    // block it points to, allocating either if necessary.
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = iballoc(ip);
+    bp = bread(ip->dev, addr);
+    a = (uint*)bp->data;
+    if((addr = a[bn / NINDIRECT]) == 0){
+      a[bn / NINDIRECT] = addr = iballoc(ip);
       log_write(bp);
     }
     brelse(bp);
+    bp = bread(ip->dev, addr);
+    a = (uint*)bp->data;
+    if((addr = a[bn % NINDIRECT]) == 0){
+      a[bn % NINDIRECT] = addr = iballoc(ip);
+      log_write(bp);
+    }
+    extfill(ip, lbn - bn % NINDIRECT, a, bn % NINDIRECT);
+    brelse(bp);
     return addr;
   }
 
   panic("bmap: out of range");
 }
 
+// Free an indirect block and the blocks it lists.
+static void
+ifreeind(struct inode *ip, uint addr)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j])
+      bfree(ip->dev, a[j]);
+  }
+  brelse(bp);
+  bfree(ip->dev, addr);
+}
+
 // Truncate inode (discard contents).
 // Caller must hold ip->lock.
 void
@@ -414,6 +649,7 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  textinval(ip);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -422,18 +658,25 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+    ifreeind(ip, ip->addrs[NDIRECT]);
+    ip->addrs[NDIRECT] = 0;
+  }
+
+  if(ip->addrs[NDIRECT+1]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
     a = (uint*)bp->data;
     for(j = 0; j < NINDIRECT; j++){
       if(a[j])
-        bfree(ip->dev, a[j]);
+        ifreeind(ip, a[j]);
     }
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    bfree(ip->dev, ip->addrs[NDIRECT+1]);
+    ip->addrs[NDIRECT+1] = 0;
   }
 
   ip->size = 0;
+  ip->nextblock = 0;
+  extclear(ip);
   iupdate(ip);
 }
 
@@ -449,6 +692,41 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Starts reading the blocks of ip that readi() is about to want,
+// so they are on their way together: those of [off, off+n) after
+// the first, and, for a sequential reader (one that starts at the
+// start of the file, or where its last read stopped), NREADAHEAD
+// more after them. Blocks already read ahead are not looked up
+// again. Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint off, uint n)
+{
+  uint b = off / BSIZE, last, from, end;
+  uint size = (ip->size + BSIZE - 1) / BSIZE;
+  int seq;
+
+  if(n == 0)
+    return;
+  last = (off + n - 1) / BSIZE;
+  if(off == 0)
+    ip->rahead = 0;
+  seq = off == 0 || b == ip->rnext || b + 1 == ip->rnext;
+  ip->rnext = last + 1;
+  from = b + 1;
+  end = last + 1;
+  if(seq){
+    end += NREADAHEAD;
+    if(ip->rahead > from)
+      from = ip->rahead;
+  }
+  if(end > size)
+    end = size;
+  for(uint i = from; i < end; i++)
+    bprefetch(ip->dev, bmap(ip, i));
+  if(seq && end > ip->rahead)
+    ip->rahead = end;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -463,6 +741,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
+  readahead(ip, off, n);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -494,6 +773,8 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(n > 0)
+    textinval(ip);
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -525,6 +806,141 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory entry cache.
+//
+// Maps (dev, directory inum, name) to the entry's inum and
+// offset, so that a lookup in a big directory (the root holds
+// every /.swapN) needn't read all of it. An entry with inum 0
+// records that the name is not there. Callers hold the
+// directory's lock, which orders cache updates with changes to
+// the directory; dcache.lock protects the table itself.
+struct dentry {
+  uint dev;
+  uint dinum;           // directory, 0 if the entry is free
+  char name[DIRSIZ];
+  uint inum;            // 0: known not to be in the directory
+  uint off;             // offset of its dirent
+  int used;             // referenced since the clock hand passed
+  struct dentry *next;  // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry entry[NDENTRY];
+  struct dentry *bucket[NDBUCKET];
+  int hand;             // clock hand for replacement
+} dcache;
+
+static void
+dinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static uint
+dhash(uint dev, uint dinum, char *name)
+{
+  uint h = dev * 31 + dinum;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 33 + (uchar)name[i];
+  return h % NDBUCKET;
+}
+
+// Caller holds dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dinum, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.bucket[dhash(dev, dinum, name)]; d; d = d->next)
+    if(d->dinum == dinum && d->dev == dev && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Caller holds dcache.lock.
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.bucket[dhash(d->dev, d->dinum, d->name)]; *pp; pp = &(*pp)->next){
+    if(*pp == d){
+      *pp = d->next;
+      break;
+    }
+  }
+  d->dinum = 0;
+}
+
+// Look name up in dp's cached entries. Returns 1 and sets
+// *inum (0 if absent) and *off on a hit, 0 on a miss.
+static int
+dget(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+  int hit = 0;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) != 0){
+    d->used = 1;
+    *inum = d->inum;
+    *off = d->off;
+    hit = 1;
+  }
+  release(&dcache.lock);
+  return hit;
+}
+
+// Record that name in dp is inum at off (inum 0: no such name),
+// recycling the first entry the clock hand finds unused.
+static void
+dput(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+  int h;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    for(;;){
+      d = &dcache.entry[dcache.hand];
+      dcache.hand = (dcache.hand + 1) % NDENTRY;
+      if(d->dinum == 0)
+        break;
+      if(!d->used){
+        dunhash(d);
+        break;
+      }
+      d->used = 0;
+    }
+    d->dev = dp->dev;
+    d->dinum = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    h = dhash(d->dev, d->dinum, d->name);
+    d->next = dcache.bucket[h];
+    dcache.bucket[h] = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  d->used = 1;
+  release(&dcache.lock);
+}
+
+// Forget everything cached about directory dp, which is
+// being freed: its inum may come back as another directory.
+static void
+dpurge(struct inode *dp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.entry; d < &dcache.entry[NDENTRY]; d++)
+    if(d->dinum == dp->inum && d->dev == dp->dev)
+      dunhash(d);
+  release(&dcache.lock);
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -536,6 +952,14 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(dget(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -546,10 +970,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dput(dp, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  dput(dp, name, 0, 0);
   return 0;
 }
 
@@ -579,10 +1005,23 @@ dirlink(struct inode *dp, char *name, uint inum)
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dput(dp, name, inum, off);
 
   return 0;
 }
 
+// Clear the directory entry for name, found by dirlookup() at off.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct dirent de;
+
+  memset(&de, 0, sizeof(de));
+  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    panic("unlink: writei");
+  dput(dp, name, 0, 0);
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -697,87 +1136,103 @@ char* itoa(int i, char b[]){
     }while(i);
     return b;
 }
-//remove swap file of proc p;
+// Swap files, when there is no raw swap area. A process gets one
+// only when it first writes a page out (see writePagesToSwapFile()),
+// and gives it back at exit to a pool, for the next process that
+// needs one, instead of unlinking it: most processes never swap,
+// and those that do, do not pay to create and truncate a file each.
+// A recycled file keeps its blocks, so a new owner's writes over
+// them allocate nothing; what is in them is stale, but p's slot
+// allocator hands out only slots it writes before reading. The
+// files are /.swap0, /.swap1, ..., at most one per process. Only
+// NSWAPPOOL of them are kept open, not to use up the file table;
+// the others are closed, and opened again by name when wanted.
+struct {
+  struct spinlock lock;
+  struct file *free[NSWAPPOOL];   // open, ready for a new owner
+  int freeno[NSWAPPOOL];          // their numbers
+  int nfree;
+  int idle[NPROC];                // numbers of the closed ones
+  int nidle;
+  int nfiles;                     // created so far
+} swappool;
+
+void
+swappoolinit(void)
+{
+  initlock(&swappool.lock, "swappool");
+}
+
+// gives p's swap file, if it has one, back to the pool.
 int
 removeSwapFile(struct proc* p)
 {
-  //path of proccess
-  char path[DIGITS];
-  memmove(path,"/.swap", 6);
-  itoa(p->pid, path+ 6);
-
-  struct inode *ip, *dp;
-  struct dirent de;
-  char name[DIRSIZ];
-  uint off;
-
-  if(0 == p->swapFile)
-  {
-    return -1;
+  // pages in the raw swap area just give their slots back
+  if(swapdevice()){
+    releaseSwapSlots(p);
+    return 0;
   }
-  fileclose(p->swapFile);
 
-  begin_op();
-  if((dp = nameiparent(path, name)) == 0)
+  if(0 == p->swapFile)
   {
-    end_op();
     return -1;
   }
-
-  ilock(dp);
-
-    // Cannot unlink "." or "..".
-  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0)
-     goto bad;
-
-  if((ip = dirlookup(dp, name, &off)) == 0)
-    goto bad;
-  ilock(ip);
-
-  if(ip->nlink < 1)
-    panic("unlink: nlink < 1");
-  if(ip->type == T_DIR && !isdirempty(ip)){
-    iunlockput(ip);
-    goto bad;
-  }
-
-  memset(&de, 0, sizeof(de));
-  if(writei(dp,0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
-  if(ip->type == T_DIR){
-    dp->nlink--;
-    iupdate(dp);
+  acquire(&swappool.lock);
+  if(swappool.nfree < NSWAPPOOL){
+    swappool.freeno[swappool.nfree] = p->swapno;
+    swappool.free[swappool.nfree++] = p->swapFile;
+    release(&swappool.lock);
+    p->swapFile = 0;
+    return 0;
   }
-  iunlockput(dp);
-
-  ip->nlink--;
-  iupdate(ip);
-  iunlockput(ip);
-
-  end_op();
-
+  if(swappool.nidle >= NPROC)
+    panic("removeSwapFile");
+  swappool.idle[swappool.nidle++] = p->swapno;
+  release(&swappool.lock);
+  fileclose(p->swapFile);
+  p->swapFile = 0;
   return 0;
-
-  bad:
-    iunlockput(dp);
-    end_op();
-    return -1;
-
 }
 
 
-//return 0 on success
+// gives p a swap file from the pool, or a closed one opened again,
+// or a new one, unless it has one. return 0 on success. the
+// caller is the only one swapping p out: reclaim() doesn't start
+// while p is, and p waits in vmsettle() for one it started.
+// Otherwise both could take a file for p.
 int
 createSwapFile(struct proc* p)
 {
-
   char path[DIGITS];
+  int n;
+
+  // no file needed when swapping to the raw swap area
+  if(swapdevice() || p->swapFile)
+    return 0;
+
+  acquire(&swappool.lock);
+  if(swappool.nfree > 0){
+    p->swapFile = swappool.free[--swappool.nfree];
+    p->swapno = swappool.freeno[swappool.nfree];
+    release(&swappool.lock);
+    return 0;
+  }
+  if(swappool.nidle > 0)
+    n = swappool.idle[--swappool.nidle];
+  else
+    n = swappool.nfiles++;
+  p->swapno = n;
+  release(&swappool.lock);
+
   memmove(path,"/.swap", 6);
-  itoa(p->pid, path+ 6);
+  itoa(n, path+ 6);
 
   begin_op();
   
+  // left over from an earlier boot, maybe, and then reused as well
   struct inode * in = create(path, T_FILE, 0, 0);
+  if(in == 0)
+    panic("createSwapFile");
   iunlock(in);
   p->swapFile = filealloc();
   if (p->swapFile == 0)
@@ -797,35 +1252,125 @@ createSwapFile(struct proc* p)
 int
 writeToSwapFile(struct proc * p, char* buffer, uint placeOnFile, uint size)
 {
+  if(swapdevice()){
+    swaprw(buffer, placeOnFile, 1);
+    return size;
+  }
+  if(createSwapFile(p) < 0)
+    return -1;
   p->swapFile->off = placeOnFile;
   return kfilewrite(p->swapFile, (uint64)buffer, size);
 }
 
+// writes n whole pages to the given offsets of p's swap file
+// inside a single log transaction, so a batched swap-out pays
+// for one commit instead of one per page.
+// the offsets must not lie beyond the current end of the file
+// when taken in order. returns 0 on success, -1 on error.
+int
+writePagesToSwapFile(struct proc* p, char** pages, uint* placesOnFile, int n)
+{
+  if(swapdevice()){
+    swaprwv(pages, placesOnFile, n, 1);
+    return 0;
+  }
+  if(createSwapFile(p) < 0)
+    return -1;
+
+  struct inode *ip = p->swapFile->ip;
+  // data blocks, plus inode, indirect blocks and bitmap slop.
+  int nblocks = n * (PGSIZE / BSIZE) + 6;
+  int r = 0;
+
+  begin_opn(nblocks);
+  ilock(ip);
+  for(int i = 0; i < n && r == 0; i++)
+    if(writei(ip, 0, (uint64)pages[i], placesOnFile[i], PGSIZE) != PGSIZE)
+      r = -1;
+  iunlock(ip);
+  end_opn(nblocks);
+  return r;
+}
+
 //return as sys_read (-1 when error)
 int
 readFromSwapFile(struct proc * p, char* buffer, uint placeOnFile, uint size)
 {
+  if(swapdevice()){
+    swaprw(buffer, placeOnFile, 0);
+    return size;
+  }
   p->swapFile->off = placeOnFile;
   return kfileread(p->swapFile, (uint64)buffer,  size);
 }
 
+// reads n whole pages from the given offsets of p's swap file,
+// holding the inode lock once for the whole batch.
+// returns 0 on success, -1 on error.
+int
+readPagesFromSwapFile(struct proc* p, char** pages, uint* placesOnFile, int n)
+{
+  if(swapdevice()){
+    swaprwv(pages, placesOnFile, n, 0);
+    return 0;
+  }
+
+  struct inode *ip = p->swapFile->ip;
+  int r = 0;
+
+  ilock(ip);
+  for(int i = 0; i < n && r == 0; i++)
+    if(readi(ip, 0, (uint64)pages[i], placesOnFile[i], PGSIZE) != PGSIZE)
+      r = -1;
+  iunlock(ip);
+  return r;
+}
+
+// gives np every page the running process has swapped out: a
+// reference to the same slot on the swap area, or a copy in np's
+// own swap file, which it gets here if there is any. np's paging
+// metadata must already be a copy of the parent's. Returns 0, or
+// -1 if a page could not be copied; the references are taken
+// either way, for freePaging() to drop with np's.
 int
 copySwapFile(struct proc *np)
 {
-  struct proc *p = myproc();
-  int index;
+  struct proc *p = myspace();
+  int index, r = 0;
+  uint off;
   char* buff;
-  for(int i = 0; i < p->sz; i += PGSIZE)
-  {
-    index = i / PGSIZE;
-    if(p->data[index].offset != -1)
-    {
-      if((buff = kalloc()) == 0)
-        return -1;
-      if(readFromSwapFile(p, buff, p->data[index].offset, PGSIZE) > 0)
-        writeToSwapFile(np, buff, p->data[index].offset, PGSIZE);
-      kfree(buff);
+
+  if(swapdevice()){
+    // the swap area is shared, so the child can just
+    // hold on to the parent's slots until one of them
+    // swaps the page back in.
+    for(index = nextSwappedPage(np, 0); index >= 0; index = nextSwappedPage(np, index + 1)){
+      off = pagemeta(np, index, 0)->offset;
+      if(ZSWAPPED(off))
+        zswapdup(off);
+      else
+        swapdup(off);
     }
+    return 0;
   }
-  return 0;
-}
\ No newline at end of file
+  // pages kept in zswap, not in the file, which p may not have
+  // if all its evictions went there
+  for(index = nextSwappedPage(p, 0); index >= 0; index = nextSwappedPage(p, index + 1)){
+    off = pagemeta(p, index, 0)->offset;
+    if(ZSWAPPED(off))
+      zswapdup(off);
+  }
+  if(p->swapFile == 0)
+    return 0;
+  if((buff = kalloc()) == 0)
+    return -1;
+  for(index = nextSwappedPage(p, 0); index >= 0 && r == 0; index = nextSwappedPage(p, index + 1))
+  {
+    off = pagemeta(p, index, 0)->offset;
+    if(!ZSWAPPED(off) && (readFromSwapFile(p, buff, off, PGSIZE) != PGSIZE ||
+                          writeToSwapFile(np, buff, off, PGSIZE) != PGSIZE))
+      r = -1;
+  }
+  kfree(buff);
+  return r;
+}
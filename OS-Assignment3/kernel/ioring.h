@@ -0,0 +1,30 @@
+// a batch of file system calls, see ioring_enter().
+// the process fills sq[] entries from sqtail on and moves sqtail
+// past them; the kernel runs them from sqhead, which it moves,
+// and posts a completion for each at cqtail. the process takes
+// completions from cqhead, which it moves. indices only grow,
+// and are taken modulo IORING_SIZE.
+
+#define IORING_SIZE 32        // entries in each queue; a power of two
+
+#define IOSQE_LASTFD 0x1      // arg[0] is the fd of the batch's last open or dup
+
+struct sqe {
+  int op;                     // SYS_read, SYS_open, SYS_close &c
+  int flags;                  // IOSQE_*
+  uint64 arg[3];              // its arguments
+  uint64 user;                // copied to the completion
+};
+
+struct cqe {
+  uint64 user;
+  int res;                    // what the call returned
+  int pad;
+};
+
+struct ioring {
+  uint sqhead, sqtail;
+  uint cqhead, cqtail;
+  struct sqe sq[IORING_SIZE];
+  struct cqe cq[IORING_SIZE];
+};
@@ -1,6 +1,9 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// or runs of 2^order physically contiguous ones.
+// Pages are reference counted so that they can be
+// shared copy-on-write between processes.
 
 #include "types.h"
 #include "param.h"
@@ -16,27 +19,221 @@ extern char end[]; // first address after kernel.
 
 struct run {
   struct run *next;
+  struct run *prev;   // only on the buddy lists
 };
 
-struct {
+// free pages are kept on per-CPU lists, so that kalloc() and
+// kfree() normally take only their own CPU's (uncontended) lock.
+// pages move between a CPU's list and the global pool KBATCH at
+// a time; a CPU that finds both empty steals from the others.
+//
+// the global pool is a buddy allocator: free blocks of 2^k pages,
+// k = 0..KMAXORDER, aligned to their size, on a list per order. a
+// block is split to serve a smaller request, and a freed block is
+// merged with its buddy (the other half of the block twice its
+// size) while that is free too.
+#define KBATCH 32
+#define KCPUMAX (2*KBATCH)   // a CPU spills a batch beyond this
+
+// each CPU also keeps up to KZERO pages that are already zeroed
+// for kalloc_zeroed(), filled by kzerofill() when it is idle.
+#define KZERO 16
+
+struct kcpu {
   struct spinlock lock;
   struct run *freelist;
+  int nfree;
+  struct run *zerolist;
+  int nzero;
+
+  // statistics, see kallocdump()
+  uint64 nalloc;
+  uint64 nfreed;
+  uint64 nrefill;
+  uint64 nspill;
+  uint64 nsteal;
+  uint64 nzerohit;    // kalloc_zeroed() calls served from zerolist
+};
+
+struct kcpu kcpus[NCPU];
+
+struct {
+  struct spinlock lock;
+  struct run *freelist[KMAXORDER+1];
+  int nblocks[KMAXORDER+1];
+  int nfree;          // pages in all of them
 } kmem;
 
+#define NPAGES ((PHYSTOP - KERNBASE) / PGSIZE)
+
+// the order of the free block each page heads on the buddy lists,
+// or -1 if it is not such a page (allocated, in a block, or held
+// by a CPU's list).
+signed char korder[NPAGES];
+
+// number of references to each physical page, so that
+// copy-on-write fork can share a page between page tables.
+// a page goes back on the free list when its count drops to 0.
+// updated with atomic instructions rather than under a lock.
+int krefs[NPAGES];
+
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define REF2PA(i) ((struct run*)(KERNBASE + (uint64)(i) * PGSIZE))
+
+static void bfree(struct run*, int);
+
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kcpus[i].lock, "kcpu");
+  memset(korder, -1, sizeof(korder));
   freerange(end, (void*)PHYSTOP);
 }
 
+// straight onto the buddy lists, where they merge into big blocks.
 void
 freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
+  acquire(&kmem.lock);
   for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+    bfree((struct run*)p, 0);
+  release(&kmem.lock);
+}
+
+// the buddy lists. kmem.lock must be held.
+
+static void
+bpush(struct run *r, int order)
+{
+  r->prev = 0;
+  r->next = kmem.freelist[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.freelist[order] = r;
+  kmem.nblocks[order]++;
+  korder[PA2REF(r)] = order;
+}
+
+static void
+bunlink(struct run *r, int order)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.freelist[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nblocks[order]--;
+  korder[PA2REF(r)] = -1;
+}
+
+// a block of 2^order pages, split off the smallest big enough, or 0.
+static struct run*
+balloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= KMAXORDER && kmem.freelist[k] == 0; k++)
+    ;
+  if(k > KMAXORDER)
+    return 0;
+  r = kmem.freelist[k];
+  bunlink(r, k);
+  // the upper halves go back
+  while(k > order){
+    k--;
+    bpush((struct run*)((char*)r + ((uint64)PGSIZE << k)), k);
+  }
+  kmem.nfree -= 1 << order;
+  return r;
+}
+
+// give back the block of 2^order pages at r, merged with its
+// buddies as far as they are free.
+static void
+bfree(struct run *r, int order)
+{
+  uint64 i = PA2REF(r), b;
+
+  kmem.nfree += 1 << order;
+  for(; order < KMAXORDER; order++){
+    b = i ^ (1L << order);
+    if(b >= NPAGES || korder[b] != order)
+      break;
+    bunlink(REF2PA(b), order);
+    i &= ~(1L << order);
+  }
+  bpush(REF2PA(i), order);
+}
+
+// up to n single pages, as a list.
+static struct run*
+btake(int n, int *got)
+{
+  struct run *first = 0, *r;
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < n && (r = balloc(0)) != 0; i++){
+    r->next = first;
+    first = r;
+  }
+  release(&kmem.lock);
+  *got = i;
+  return first;
+}
+
+// give back a list of single pages.
+static void
+bput(struct run *batch)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while((r = batch) != 0){
+    batch = r->next;
+    bfree(r, 0);
+  }
+  release(&kmem.lock);
+}
+
+// take up to n pages off *list, which has *nfree pages,
+// and return them as a list of their own.
+static struct run*
+takebatch(struct run **list, int *nfree, int n, int *got)
+{
+  struct run *first = *list, *r = 0;
+  int i;
+
+  for(i = 0; i < n && *list; i++){
+    r = *list;
+    *list = r->next;
+  }
+  if(i > 0)
+    r->next = 0;
+  *nfree -= i;
+  *got = i;
+  return i > 0 ? first : 0;
+}
+
+// put the list of n pages starting at batch on *list
+static void
+putbatch(struct run **list, int *nfree, struct run *batch, int n)
+{
+  struct run *r;
+
+  if(batch == 0)
+    return;
+  for(r = batch; r->next; r = r->next)
+    ;
+  r->next = *list;
+  *list = batch;
+  *nfree += n;
 }
 
 // Free the page of physical memory pointed at by v,
@@ -46,20 +243,44 @@ freerange(void *pa_start, void *pa_end)
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *batch;
+  struct kcpu *k;
+  int n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  // only the last reference really frees the page.
+  int refs = __sync_fetch_and_sub(&krefs[PA2REF(pa)], 1);
+  if(refs < 1)
+    panic("kfree: ref");
+  if(refs > 1)
+    return;
+
+#ifdef JUNKFILL
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  k = &kcpus[cpuid()];
+  acquire(&k->lock);
+  r->next = k->freelist;
+  k->freelist = r;
+  k->nfree++;
+  k->nfreed++;
+  batch = 0;
+  if(k->nfree > KCPUMAX){
+    batch = takebatch(&k->freelist, &k->nfree, KBATCH, &n);
+    k->nspill++;
+  }
+  release(&k->lock);
+  pop_off();
+
+  if(batch)
+    bput(batch);
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -67,16 +288,241 @@ kfree(void *pa)
 // Returns 0 if the memory cannot be allocated.
 void *
 kalloc(void)
+{
+  struct run *r, *batch;
+  struct kcpu *k;
+  int id, n;
+
+  push_off();
+  id = cpuid();
+  k = &kcpus[id];
+  acquire(&k->lock);
+  if(k->freelist == 0){
+    // refill from the global pool
+    batch = btake(KBATCH, &n);
+    putbatch(&k->freelist, &k->nfree, batch, n);
+    k->nrefill++;
+  }
+  if(k->freelist == 0){
+    // steal half of another CPU's pages. our lock is
+    // dropped meanwhile, so two CPUs can't deadlock
+    // stealing from each other.
+    release(&k->lock);
+    batch = 0;
+    for(int i = 1; i < NCPU && batch == 0; i++){
+      struct kcpu *o = &kcpus[(id + i) % NCPU];
+      acquire(&o->lock);
+      batch = takebatch(&o->freelist, &o->nfree, (o->nfree + 1) / 2, &n);
+      if(batch == 0)
+        batch = takebatch(&o->zerolist, &o->nzero, o->nzero, &n);
+      release(&o->lock);
+    }
+    acquire(&k->lock);
+    putbatch(&k->freelist, &k->nfree, batch, n);
+    if(batch)
+      k->nsteal++;
+  }
+  if(k->freelist == 0 && k->zerolist){
+    // last resort: our own zeroed pages
+    batch = takebatch(&k->zerolist, &k->nzero, 1, &n);
+    putbatch(&k->freelist, &k->nfree, batch, n);
+  }
+  r = k->freelist;
+  if(r){
+    k->freelist = r->next;
+    k->nfree--;
+    k->nalloc++;
+  }
+  release(&k->lock);
+  pop_off();
+
+  if(r){
+#ifdef JUNKFILL
+    memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+    krefs[PA2REF(r)] = 1;
+  }
+  return (void*)r;
+}
+
+// Hand the pages on every CPU's free list back to the buddy
+// lists, so that they can merge.
+static void
+kdrain(void)
+{
+  struct run *batch;
+  int n;
+
+  for(struct kcpu *k = kcpus; k < &kcpus[NCPU]; k++){
+    acquire(&k->lock);
+    batch = takebatch(&k->freelist, &k->nfree, k->nfree, &n);
+    release(&k->lock);
+    bput(batch);
+  }
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// 2^order pages. Order 0 is kalloc(). Returns 0 if there is no
+// such run free. The block has one reference, and is given back
+// whole with kfree_pages().
+void *
+kalloc_pages(int order)
 {
   struct run *r;
 
+  if(order == 0)
+    return kalloc();
+  if(order < 0 || order > KMAXORDER)
+    panic("kalloc_pages");
   acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  r = balloc(order);
   release(&kmem.lock);
+  if(r == 0){
+    // the pieces may be sitting on the CPUs' lists
+    kdrain();
+    acquire(&kmem.lock);
+    r = balloc(order);
+    release(&kmem.lock);
+  }
+  if(r){
+#ifdef JUNKFILL
+    memset((char*)r, 5, (uint64)PGSIZE << order);
+#endif
+    krefs[PA2REF(r)] = 1;
+  }
+  return (void*)r;
+}
 
-  if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
+// Free a block from kalloc_pages(order).
+void
+kfree_pages(void *pa, int order)
+{
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+  if(order < 0 || order > KMAXORDER || PA2REF(pa) % (1 << order) != 0 ||
+     (char*)pa < end || (uint64)pa + ((uint64)PGSIZE << order) > PHYSTOP)
+    panic("kfree_pages");
+  if(__sync_fetch_and_sub(&krefs[PA2REF(pa)], 1) != 1)
+    panic("kfree_pages: ref");
+#ifdef JUNKFILL
+  memset(pa, 1, (uint64)PGSIZE << order);
+#endif
+  acquire(&kmem.lock);
+  bfree((struct run*)pa, order);
+  release(&kmem.lock);
+}
+
+// Allocate one 4096-byte page of zeroed physical memory,
+// from this CPU's pool of pre-zeroed pages if it has one.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+  struct kcpu *k;
+
+  push_off();
+  k = &kcpus[cpuid()];
+  acquire(&k->lock);
+  r = k->zerolist;
+  if(r){
+    k->zerolist = r->next;
+    k->nzero--;
+    k->nalloc++;
+    k->nzerohit++;
+  }
+  release(&k->lock);
+  pop_off();
+
+  if(r){
+    r->next = 0;    // the only word the list dirtied
+    return (void*)r;
+  }
+  if((r = kalloc()) != 0)
+    pagezero(r);
   return (void*)r;
 }
+
+// Top up this CPU's pool of zeroed pages by one page.
+// Called by the scheduler when it has nothing to run.
+// Returns 0 once the pool is full or memory is short.
+int
+kzerofill(void)
+{
+  struct run *r;
+  struct kcpu *k;
+  int full;
+
+  push_off();
+  k = &kcpus[cpuid()];
+  acquire(&k->lock);
+  full = k->nzero >= KZERO || k->nfree == 0;
+  release(&k->lock);
+  pop_off();
+  if(full || (r = kalloc()) == 0)
+    return 0;
+  pagezero(r);
+
+  // keeps its reference, so it doesn't have to be counted again.
+  push_off();
+  k = &kcpus[cpuid()];
+  acquire(&k->lock);
+  k->nalloc--;
+  r->next = k->zerolist;
+  k->zerolist = r;
+  k->nzero++;
+  release(&k->lock);
+  pop_off();
+  return 1;
+}
+
+// Add a reference to the page at pa, which must
+// have been returned by kalloc(). Each reference
+// is dropped with its own kfree().
+void
+kdup(void *pa)
+{
+  if(__sync_fetch_and_add(&krefs[PA2REF(pa)], 1) < 1)
+    panic("kdup");
+}
+
+// How many references does the page at pa have?
+int
+krefcount(void *pa)
+{
+  return __atomic_load_n(&krefs[PA2REF(pa)], __ATOMIC_SEQ_CST);
+}
+
+// Roughly how many pages are free. The counts are read without
+// their locks, which is good enough for a low-water mark.
+int
+kfreepages(void)
+{
+  int n = kmem.nfree;
+
+  for(struct kcpu *k = kcpus; k < &kcpus[NCPU]; k++)
+    n += k->nfree + k->nzero;
+  return n;
+}
+
+// Print the allocator's per-CPU statistics to the console.
+// Runs when a user types ^P on console, with procdump().
+void
+kallocdump(void)
+{
+  struct kcpu *k;
+
+  printf("kalloc: %d pages in pool, blocks by order:", kmem.nfree);
+  for(int i = 0; i <= KMAXORDER; i++)
+    printf(" %d", kmem.nblocks[i]);
+  printf("\n");
+  for(k = kcpus; k < &kcpus[NCPU]; k++){
+    if(k->nalloc == 0 && k->nfreed == 0)
+      continue;
+    printf("cpu %d: free %d zeroed %d alloc %d freed %d refill %d spill %d steal %d zerohit %d\n",
+           (int)(k - kcpus), k->nfree, k->nzero, (int)k->nalloc, (int)k->nfreed,
+           (int)k->nrefill, (int)k->nspill, (int)k->nsteal, (int)k->nzerohit);
+  }
+}
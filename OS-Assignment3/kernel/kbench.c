@@ -0,0 +1,238 @@
+// Microbenchmarks of the kernel's hot paths, for kbench(1).
+//
+// Each kbench() call times one primitive over and over with the
+// time CSR and reports the time in all and the median, 99th
+// percentile and worst time of one call. Fast primitives are timed
+// in batches, since the clock ticks only every 100ns in qemu; the
+// paging ones are timed one call at a time. All of them work on the
+// caller's own memory, the pages of buf, which it has touched
+// first, so they take the same paths as its faults and system calls.
+//
+// KB_EVICT and KB_SWAPIN both do the same round trip. page_to_file()
+// sends out whichever page the policy picks, swap_in() brings that
+// page back, and each kind times only its own half. Only paged
+// processes have these, and they must have no threads.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "pstat.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+#include "kbench.h"
+
+#define NSPERCYCLE (1000000000L / CLINT_HZ)
+
+static struct {
+  char *name;
+  int batch;               // ops per sample
+} kinds[NKBENCH] = {
+  [KB_WALK]    { "walk",         16 },
+  [KB_KALLOC]  { "kalloc",       16 },
+  [KB_BGET]    { "bget",         16 },
+  [KB_COPYOUT] { "copyout",       4 },
+  [KB_COPYIN]  { "copyin",        4 },
+  [KB_EVICT]   { "page_to_file",  1 },
+  [KB_SWAPIN]  { "swap_in",       1 },
+  [KB_VICTIM]  { "victim",        1 },
+};
+
+static struct {
+  struct sleeplock lock;   // one run at a time, for samples
+  uint samples[KBENCH_MAX];  // ns per op
+} kb;
+
+static volatile uint64 kbsink;   // what is timed must not be optimized away
+
+void
+kbenchinit(void)
+{
+  initsleeplock(&kb.lock, "kbench");
+}
+
+static void
+sort(uint *a, int n)
+{
+  int gap, i, j;
+  uint x;
+
+  for(gap = n / 2; gap > 0; gap /= 2)
+    for(i = gap; i < n; i++){
+      x = a[i];
+      for(j = i; j >= gap && a[j-gap] > x; j -= gap)
+        a[j] = a[j-gap];
+      a[j] = x;
+    }
+}
+
+#if SELECTION != NONE
+// the round trip of KB_EVICT and KB_SWAPIN: returns the cycles of
+// the half kind times, or -1 if p has no page to send out. resident,
+// a page's worth of bits, is scratch for telling which one went.
+static uint64
+swaptrip(struct proc *p, int kind, uchar *resident)
+{
+  int npages = PGROUNDUP(p->sz) / PGSIZE, i;
+  struct paging_meta_data *m;
+  uint64 t0, t1, t2, t3;
+  pte_t *pte = 0;
+
+  if(npages > PGSIZE * 8)
+    npages = PGSIZE * 8;
+  if(p->pagesInMemory == 0 || peekvictim(p) < 0)
+    return -1;
+  memset(resident, 0, PGSIZE);
+  for(i = 0; i < npages; i++)
+    if((m = pagemeta(p, i, 0)) != 0 && m->inUse)
+      resident[i / 8] |= 1 << (i % 8);
+
+  t0 = r_time();
+  page_to_file(p, 1);
+  t1 = r_time();
+
+  for(i = 0; i < npages; i++){
+    if((resident[i / 8] & (1 << (i % 8))) == 0)
+      continue;
+    if((m = pagemeta(p, i, 0)) == 0 || m->inUse)
+      continue;
+    if((pte = walk(p->pagetable, (uint64)i * PGSIZE, 0)) == 0 || (*pte & PTE_PG) == 0)
+      continue;
+    break;
+  }
+  if(i == npages || pte == 0)    // it was not below p->sz: stays out
+    return kind == KB_EVICT ? t1 - t0 : -1;
+  t2 = r_time();
+  swap_in(p, (uint64)i * PGSIZE, pte);
+  t3 = r_time();
+  return kind == KB_EVICT ? t1 - t0 : t3 - t2;
+}
+#endif
+
+// one sample of kind, the i'th, on p's npages pages from start.
+// returns the cycles it took, or -1 if it failed. page is scratch.
+static uint64
+sample(struct proc *p, int kind, int i, uint64 start, int npages, char *page)
+{
+  int batch = kinds[kind].batch, j;
+  uint64 t, va;
+  struct buf *b;
+  void *a;
+
+  t = r_time();
+  switch(kind){
+  case KB_WALK:
+    for(j = 0; j < batch; j++)
+      kbsink += (uint64)walk(p->pagetable, start + (uint64)((i * batch + j) % npages) * PGSIZE, 0);
+    break;
+  case KB_KALLOC:
+    for(j = 0; j < batch; j++){
+      if((a = kalloc()) == 0)
+        return -1;
+      kfree(a);
+    }
+    break;
+  case KB_BGET:
+    for(j = 0; j < batch; j++){
+      b = bread(ROOTDEV, 1);   // the superblock, always cached
+      kbsink += b->data[0];
+      brelse(b);
+    }
+    break;
+  case KB_COPYOUT:
+  case KB_COPYIN:
+    for(j = 0; j < batch; j++){
+      va = start + (uint64)((i * batch + j) % npages) * PGSIZE;
+      if(kind == KB_COPYOUT ? copyout(p->pagetable, va, page, PGSIZE) < 0 :
+                              copyin(p->pagetable, page, va, PGSIZE) < 0)
+        return -1;
+    }
+    break;
+  #if SELECTION != NONE
+  case KB_EVICT:
+  case KB_SWAPIN:
+    return swaptrip(p, kind, (uchar*)page);
+  case KB_VICTIM:
+    if(peekvictim(p) < 0)
+      return -1;
+    break;
+  #endif
+  default:
+    return -1;
+  }
+  return r_time() - t;
+}
+
+// times n samples of primitive kind on the pages of the caller's
+// [buf, buf+len), which it should have touched, and copies a
+// struct kbench out to result. returns 0, or -1 if kind doesn't
+// run here or there is no page in buf.
+int
+kbench(int kind, int n, uint64 buf, uint64 len, uint64 result)
+{
+  struct proc *p = myproc();
+  struct kbench r;
+  uint64 start, end, t, sum = 0;
+  int npages, batch, i, got = 0;
+  char *page;
+
+  if(kind < 0 || kind >= NKBENCH || n < 1 || buf + len < buf)
+    return -1;
+  if(n > KBENCH_MAX)
+    n = KBENCH_MAX;
+  start = PGROUNDUP(buf);
+  end = PGROUNDDOWN(buf + len);
+  if(end <= start || end > p->sz)
+    return -1;
+  npages = (end - start) / PGSIZE;
+  if(p->mm != p || p->nthreads > 1)
+    return -1;
+  #if SELECTION == NONE
+    if(kind == KB_EVICT || kind == KB_SWAPIN || kind == KB_VICTIM)
+      return -1;
+  #else
+    if((kind == KB_EVICT || kind == KB_SWAPIN) && p->pid <= 2)
+      return -1;   // no swap file
+  #endif
+  if((page = kalloc_zeroed()) == 0)
+    return -1;
+
+  batch = kinds[kind].batch;
+  acquiresleep(&kb.lock);
+  vmlock(p);
+  for(i = 0; i < n; i++){
+    if((t = sample(p, kind, i, start, npages, page)) == -1)
+      break;
+    sum += t;
+    kb.samples[got++] = t * NSPERCYCLE / batch;
+  }
+  vmunlock(p);
+  kfree(page);
+
+  memset(&r, 0, sizeof(r));
+  safestrcpy(r.name, kinds[kind].name, sizeof(r.name));
+  #if SELECTION == NONE
+    safestrcpy(r.policy, "none", sizeof(r.policy));
+  #else
+    safestrcpy(r.policy, p->policy->name, sizeof(r.policy));
+  #endif
+  r.selection = SELECTION;
+  r.samples = got;
+  r.batch = batch;
+  r.ops = (uint64)got * batch;
+  r.ns = sum * NSPERCYCLE;
+  if(got > 0){
+    sort(kb.samples, got);
+    r.p50 = kb.samples[got / 2];
+    r.p99 = kb.samples[got - 1 - got / 100];
+    r.max = kb.samples[got - 1];
+  }
+  releasesleep(&kb.lock);
+  if(got == 0)
+    return -1;
+  return copyout(p->pagetable, result, (char*)&r, sizeof(r));
+}
@@ -0,0 +1,26 @@
+// kbench(): times one of the kernel's hot paths, see kbench.c.
+#define KB_WALK       0   // walk() to a page of buf
+#define KB_KALLOC     1   // kalloc() and kfree() of a page
+#define KB_BGET       2   // bread() and brelse() of a cached block
+#define KB_COPYOUT    3   // copyout() of a page to buf
+#define KB_COPYIN     4   // copyin() of a page from buf
+#define KB_EVICT      5   // page_to_file() of one page
+#define KB_SWAPIN     6   // swap_in() of it again
+#define KB_VICTIM     7   // the caller's policy choosing a victim
+#define NKBENCH       8
+
+#define KBENCH_MAX 4096   // samples one call takes at most
+
+// times are in nanoseconds, from the time CSR.
+struct kbench {
+  char name[16];     // of the primitive
+  char policy[8];    // the caller's page-replacement policy
+  int selection;     // SELECTION the kernel was built with
+  int samples;       // taken, each of batch ops
+  int batch;
+  uint64 ops;
+  uint64 ns;         // all ops
+  uint64 p50;        // per op, over the samples
+  uint64 p99;
+  uint64 max;
+};
@@ -28,10 +28,37 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are synchronous, but the blocks of a commit are
+// written LOGBATCH at a time, so the disk has several in flight.
+//
+// Write-back: a commit does not write its blocks home. They stay
+// pinned in the buffer cache, dirty, and the transaction stays in
+// the log, with the next ones appended after it; the header lists
+// them all, a block changed by several as often as it was logged.
+// checkpoint() writes the dirty blocks home, each once however many
+// transactions changed it, in block order so that neighbouring
+// blocks go to the disk as one request, and then empties the log.
+// It runs as part of a commit, when no op is outstanding (so the
+// cache holds only what is committed): when the log is half full,
+// when an op needs the room, or when the logflush thread finds the
+// log idle for FLUSHWINDOW ticks. Recovery replays the whole log,
+// each block from its last slot.
+//
+// mkfs decides how big the log is (up to LOGSIZE blocks plus the
+// header); log.cap is the number of data blocks it can hold.
+//
+// Group commit: when the last outstanding operation ends, the
+// commit is put off for up to GROUPWINDOW ticks, so that a run of
+// small operations shares one write_log()/write_head() cycle.
+// It happens early if the log is GROUPFULL percent full or someone
+// is waiting in log_sync(); the logflush kernel thread commits
+// when the window runs out. Crash consistency is unchanged, only
+// durability is delayed: fsync() waits for it.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
+#define LOGBATCH 16  // blocks written together by write_log(), checkpoint() and install_trans()
+
 struct logheader {
   int n;
   int block[LOGSIZE];
@@ -41,15 +68,30 @@ struct log {
   struct spinlock lock;
   int start;
   int size;
+  int cap;         // data blocks the log can hold.
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    // log blocks reserved by the outstanding calls.
   int committing;  // in commit(), please wait.
   int dev;
-  struct logheader lh;
+  int pending;     // uncommitted ops, none outstanding, since ticks `since`.
+  uint since;
+  int syncreq;     // log_sync() is waiting for the next commit.
+  uint ncommit;    // commits so far.
+  uint lastcommit; // ticks at the last one.
+  int ckptreq;     // checkpoint at the next commit.
+  int used;        // log blocks of committed, not checkpointed transactions.
+  int ndirty;      // their home blocks, each once, pinned in the cache.
+  int dirty[LOGSIZE];
+  struct logheader dh;  // what is in the log on disk: its used blocks
+  struct logheader lh;  // the transaction being gathered
 };
 struct log log;
 
 static void recover_from_log(void);
+static void checkpoint(void);
 static void commit();
+static void logflusher(void);
+static void group_commit(void);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -60,25 +102,44 @@ initlog(int dev, struct superblock *sb)
   initlock(&log.lock, "log");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  log.cap = log.size - 1 < LOGSIZE ? log.size - 1 : LOGSIZE;
+  if(log.cap < MAXOPBLOCKS*3)
+    panic("initlog: log too small");
   log.dev = dev;
   recover_from_log();
+  kthread("logflush", logflusher);
 }
 
-// Copy committed blocks from log to their home location
+// Copy the blocks in the log on disk to their home locations,
+// after a crash, LOGBATCH blocks in flight at a time. A block that
+// is in the log more than once is copied from its last slot.
 static void
-install_trans(int recovering)
+install_trans(void)
 {
-  int tail;
+  struct buf *dbuf[LOGBATCH];
+  int i, j, n = 0;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
+  for (i = 0; i < log.dh.n; i++) {
+    for (j = i + 1; j < log.dh.n; j++)
+      if (log.dh.block[j] == log.dh.block[i])
+        break;
+    if (j < log.dh.n)
+      continue;   // a later transaction has it
+    dbuf[n] = bread(log.dev, log.dh.block[i]); // read dst
+    struct buf *lbuf = bread(log.dev, log.start+i+1); // read log block
+    memmove(dbuf[n]->data, lbuf->data, BSIZE);  // copy block to dst
     brelse(lbuf);
-    brelse(dbuf);
+    if (++n == LOGBATCH) {
+      bwritev(dbuf, n);  // write dst to disk
+      for (j = 0; j < n; j++)
+        brelse(dbuf[j]);
+      n = 0;
+    }
+  }
+  if (n > 0) {
+    bwritev(dbuf, n);
+    for (j = 0; j < n; j++)
+      brelse(dbuf[j]);
   }
 }
 
@@ -89,9 +150,9 @@ read_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.dh.n = lh->n;
+  for (i = 0; i < log.dh.n; i++) {
+    log.dh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
@@ -105,9 +166,9 @@ write_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = log.dh.n;
+  for (i = 0; i < log.dh.n; i++) {
+    hb->block[i] = log.dh.block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -117,8 +178,8 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
+  install_trans(); // if committed, copy from log to disk
+  log.dh.n = 0;
   write_head(); // clear the log
 }
 
@@ -126,15 +187,34 @@ recover_from_log(void)
 void
 begin_op(void)
 {
+  begin_opn(MAXOPBLOCKS);
+}
+
+// like begin_op(), but for an operation that may write up to
+// nblocks blocks, e.g. a batched swap-out. must be paired with
+// end_opn() with the same nblocks.
+void
+begin_opn(int nblocks)
+{
+  if(nblocks > log.cap)
+    panic("begin_opn: too big");
+
   acquire(&log.lock);
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
-      sleep(&log, &log.lock);
+    } else if(log.used + log.lh.n + log.reserved + nblocks > log.cap){
+      // this op might exhaust log space; wait for commit,
+      // or commit the delayed ops now and empty the log
+      // if nothing is running.
+      if(log.outstanding == 0){
+        log.ckptreq = 1;
+        group_commit();
+      } else
+        sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += nblocks;
       release(&log.lock);
       break;
     }
@@ -142,52 +222,182 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits, or schedules a commit, if this was the
+// last outstanding operation.
 void
 end_op(void)
 {
-  int do_commit = 0;
+  end_opn(MAXOPBLOCKS);
+}
 
+void
+end_opn(int nblocks)
+{
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= nblocks;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+  if(log.outstanding == 0 && log.lh.n > 0){
+    if(GROUPWINDOW == 0 || log.syncreq ||
+       (log.pending && ticks - log.since >= GROUPWINDOW) ||
+       (log.used + log.lh.n) * 100 >= log.cap * GROUPFULL){
+      group_commit();
+    } else if(!log.pending){
+      log.pending = 1;
+      log.since = ticks;
+      wakeup(&log.pending);
+    }
+  }
+  // begin_op() may be waiting for log space,
+  // and decrementing log.outstanding has decreased
+  // the amount of reserved space.
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Commit the ops gathered so far. Called with log.lock held
+// and no outstanding ops; returns with it held.
+static void
+group_commit(void)
+{
+  log.committing = 1;
+  log.pending = 0;
+  // call commit w/o holding locks, since not allowed
+  // to sleep with locks.
+  release(&log.lock);
+  commit();
+  acquire(&log.lock);
+  log.committing = 0;
+  log.syncreq = 0;
+  log.ckptreq = 0;
+  log.ncommit++;
+  log.lastcommit = ticks;
+  wakeup(&log);
+  if(log.used > 0)
+    wakeup(&log.pending);   // for logflusher() to checkpoint it
+}
+
+// Wait until every op that has ended is on disk.
+void
+log_sync(void)
+{
+  uint n;
+
+  acquire(&log.lock);
+  while(log.committing)
+    sleep(&log, &log.lock);
+  if(log.lh.n > 0){
+    if(log.outstanding == 0){
+      group_commit();
+    } else {
+      // the last outstanding end_op() will commit.
+      n = log.ncommit;
+      log.syncreq = 1;
+      while(log.ncommit == n)
+        sleep(&log, &log.lock);
+    }
   }
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// Kernel thread that commits delayed ops once their
+// window has passed, and checkpoints the log once it
+// has been idle for FLUSHWINDOW ticks.
+static void
+logflusher(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    if(!log.pending && log.used == 0){
+      sleep(&log.pending, &log.lock);
+    } else if(log.pending ? ticks - log.since < GROUPWINDOW :
+              ticks - log.lastcommit < FLUSHWINDOW){
+      release(&log.lock);
+      acquire(&tickslock);
+      sleep(&ticks, &tickslock);
+      release(&tickslock);
+      acquire(&log.lock);
+    } else if(log.outstanding == 0 && !log.committing){
+      if(!log.pending)
+        log.ckptreq = 1;
+      group_commit();
+    } else {
+      // an op is running; its end_op() will commit, or
+      // wake us up to try again.
+      sleep(&log, &log.lock);
+    }
   }
 }
 
-// Copy modified blocks from cache to log.
+// Most blocks a single op should reserve, leaving room for
+// another op of the same size to run alongside it.
+int
+log_maxop(void)
+{
+  return log.cap / 2;
+}
+
+// Copy modified blocks from cache to log, after the transactions
+// already there, and add them to the dirty blocks, each once: a
+// block that is already there loses the pin log_write() gave it.
 static void
 write_log(void)
 {
-  int tail;
+  struct buf *to[LOGBATCH];
+  int tail, i, j, n;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail < LOGBATCH ? log.lh.n - tail : LOGBATCH;
+    for (i = 0; i < n; i++) {
+      int b = log.lh.block[tail+i];
+      to[i] = bread(log.dev, log.start+log.used+tail+i+1); // log block
+      struct buf *from = bread(log.dev, b); // cache block
+      memmove(to[i]->data, from->data, BSIZE);
+      for (j = 0; j < log.ndirty && log.dirty[j] != b; j++)
+        ;
+      if (j < log.ndirty)
+        bunpin(from);
+      else
+        log.dirty[log.ndirty++] = b;
+      brelse(from);
+      log.dh.block[log.used+tail+i] = b;
+    }
+    bwritev(to, n);  // write the log; the blocks are consecutive
+    for (i = 0; i < n; i++)
+      brelse(to[i]);
+  }
+}
+
+// Write the dirty blocks home, in block order, LOGBATCH in flight
+// at a time, and empty the log. Only right after a commit: the
+// cache then holds nothing that is not in the log.
+static void
+checkpoint(void)
+{
+  struct buf *dbuf[LOGBATCH];
+  int tail, i, j, b, n;
+
+  for (i = 1; i < log.ndirty; i++) {
+    b = log.dirty[i];
+    for (j = i; j > 0 && log.dirty[j-1] > b; j--)
+      log.dirty[j] = log.dirty[j-1];
+    log.dirty[j] = b;
+  }
+  for (tail = 0; tail < log.ndirty; tail += n) {
+    n = log.ndirty - tail < LOGBATCH ? log.ndirty - tail : LOGBATCH;
+    for (i = 0; i < n; i++)
+      dbuf[i] = bread(log.dev, log.dirty[tail+i]);
+    bwritev(dbuf, n);  // write dst to disk
+    for (i = 0; i < n; i++) {
+      bunpin(dbuf[i]);
+      brelse(dbuf[i]);
+    }
   }
+  log.ndirty = 0;
+  log.used = 0;
+  log.dh.n = 0;
+  write_head();    // Erase the transactions from the log
 }
 
 static void
@@ -195,11 +405,13 @@ commit()
 {
   if (log.lh.n > 0) {
     write_log();     // Write modified blocks from cache to log
+    log.dh.n = log.used + log.lh.n;
     write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
+    log.used = log.dh.n;
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
   }
+  if (log.used > 0 && (log.ckptreq || log.used > log.cap / 2))
+    checkpoint();
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -217,8 +429,6 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
-    panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
@@ -226,9 +436,12 @@ log_write(struct buf *b)
     if (log.lh.block[i] == b->blockno)   // log absorbtion
       break;
   }
-  log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
+    // the log also holds the log.used blocks committed before
+    if (log.used + log.lh.n >= log.cap)
+      panic("too big a transaction");
     bpin(b);
+    log.lh.block[i] = b->blockno;
     log.lh.n++;
   }
   release(&log.lock);
@@ -27,8 +27,18 @@ main()
     binit();         // buffer cache
     iinit();         // inode cache
     fileinit();      // file table
+    pipeinit();      // pipe cache
+    zswapinit();     // compressed swap cache
+    shminit();       // shared memory segments
+    textinit();      // shared program text
+    kbenchinit();    // microbenchmarks
+    traceinit();     // trace buffer, /dev/trace
+    profinit();      // sampling profiler, /dev/prof
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
+    #if SELECTION != NONE
+      kthread("kswapd", kswapd); // page-out ahead of need
+    #endif
     __sync_synchronize();
     started = 1;
   } else {
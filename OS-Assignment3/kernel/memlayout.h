@@ -29,6 +29,7 @@
 #define CLINT 0x2000000L
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
+#define CLINT_HZ 10000000L // its cycles per second (the time CSR's too)
 
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
@@ -62,6 +63,10 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap() regions, growing down from MMAPTOP
+//   the trapframes of the other threads, see clone()
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define THREADFRAME(t) (TRAPFRAME - (t)*PGSIZE)   // of thread slot t
+#define MMAPTOP THREADFRAME(NTHREAD - 1)
@@ -0,0 +1,281 @@
+//
+// mmap() and munmap(): regions of a process's address space
+// above the heap, filled in from a file or with zeros as they
+// are touched (see mmappage_in() in vm.c). they grow down from
+// MMAPTOP. pages of a shared file mapping belong to the file:
+// when dirty they are written back to it, on eviction too, and
+// never go to the swap file. those of a shared anonymous one
+// belong to a segment (see shm.c) that fork() passes on.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+#include "pstat.h"
+#include "proc.h"
+
+// the mapping of p that va is in, or 0.
+struct vma*
+vmafind(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if(v->len && va >= v->start && va < v->start + v->len)
+      return v;
+  return 0;
+}
+
+static struct vma*
+vmaalloc(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if(v->len == 0)
+      return v;
+  return 0;
+}
+
+// the highest place for len more bytes of mappings between the
+// heap and MMAPTOP, or 0 if there is none.
+static uint64
+vmaroom(struct proc *p, uint64 len)
+{
+  uint64 top = MMAPTOP;
+  struct vma *v;
+
+again:
+  if(top < len || top - len < PGROUNDUP(p->sz))
+    return 0;
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if(v->len && v->start < top && v->start + v->len > top - len){
+      top = v->start;
+      goto again;
+    }
+  return top - len;
+}
+
+// the heap may grow up to the lowest mapping.
+static void
+vmabase(struct proc *p)
+{
+  struct vma *v;
+
+  p->mmapbase = MMAPTOP;
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if(v->len && v->start < p->mmapbase)
+      p->mmapbase = v->start;
+}
+
+// reads the page at va of file mapping v into mem, which is
+// zeroed: the bytes past the end of the file stay zero.
+void
+mmapread(struct vma *v, uint64 va, char *mem)
+{
+  struct inode *ip = v->f->ip;
+
+  ilock(ip);
+  readi(ip, 0, (uint64)mem, v->off + (va - v->start), PGSIZE);
+  iunlock(ip);
+}
+
+// writes the page at va of shared file mapping v back from
+// mem. the file does not grow: only the bytes up to its end
+// are written.
+void
+mmapwrite(struct vma *v, uint64 va, char *mem)
+{
+  struct inode *ip = v->f->ip;
+  uint off = v->off + (va - v->start), n = PGSIZE;
+
+  begin_op();
+  ilock(ip);
+  if(off < ip->size){
+    if(off + n > ip->size)
+      n = ip->size - off;
+    if(writei(ip, 0, (uint64)mem, off, n) != n)
+      panic("mmapwrite");
+  }
+  iunlock(ip);
+  end_op();
+}
+
+// unmaps [addr, addr+len) of v, writing dirty pages of a shared
+// file mapping back first.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint64 addr, uint64 len)
+{
+  uint64 a;
+  pte_t *pte;
+
+  if(v->f && (v->flags & MAP_SHARED))
+    for(a = addr; a < addr + len; a += PGSIZE)
+      if((pte = walk(p->pagetable, a, 0)) != 0 && (*pte & PTE_V) && (*pte & PTE_D))
+        mmapwrite(v, a, (char*)PTE2PA(*pte));
+  uvmunmap(p->pagetable, addr, len / PGSIZE, 1);
+  tcflush(p);
+  sfence_vma();
+}
+
+// maps len bytes of f from off, or of zeros if MAP_ANON, into
+// the running process. addr is only a hint, and is ignored.
+// returns the address of the mapping, or -1.
+uint64
+mmap(uint64 addr, uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  struct proc *p = myspace();
+  struct vma *v;
+  uint64 start;
+
+  if(len == 0 || off % PGSIZE != 0)
+    return -1;
+  if(((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+    return -1;
+  if(flags & MAP_ANON){
+    f = 0;
+    off = 0;
+    if((flags & MAP_SHARED) && PGROUNDUP(len) / PGSIZE > SHMPAGES)
+      return -1;
+  } else {
+    if(f == 0 || f->type != FD_INODE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+  len = PGROUNDUP(len);
+  vmlock(p);    // against p's other threads
+  if((v = vmaalloc(p)) == 0 || (start = vmaroom(p, len)) == 0){
+    vmunlock(p);
+    return -1;
+  }
+  v->shm = 0;
+  if(f == 0 && (flags & MAP_SHARED) && (v->shm = shmalloc(len / PGSIZE)) == 0){
+    vmunlock(p);
+    return -1;
+  }
+
+  v->start = start;
+  v->len = len;
+  v->prot = prot;
+  v->flags = flags;
+  v->f = f ? filedup(f) : 0;
+  v->off = off;
+  vmabase(p);
+  vmunlock(p);
+  return start;
+}
+
+// unmaps [addr, addr+len), which must lie in one mapping.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myspace();
+  struct vma *v, *w = 0;
+
+  if(addr % PGSIZE != 0 || len == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  vmsettle(p);
+  vmlock(p);
+  if((v = vmafind(p, addr)) == 0 || addr + len > v->start + v->len){
+    vmunlock(p);
+    return -1;
+  }
+  // a hole in the middle leaves the rest as a mapping of its own
+  if(addr != v->start && addr + len != v->start + v->len && (w = vmaalloc(p)) == 0){
+    vmunlock(p);
+    return -1;
+  }
+
+  vmaunmap(p, v, addr, len);
+  if(w){
+    *w = *v;
+    w->start = addr + len;
+    w->len = v->start + v->len - w->start;
+    w->off = v->off + (w->start - v->start);
+    if(w->f)
+      filedup(w->f);
+    if(w->shm)
+      shmdup(w->shm);
+    v->len = addr - v->start;
+  } else if(addr == v->start){
+    v->start += len;
+    v->off += len;
+    v->len -= len;
+  } else {
+    v->len -= len;
+  }
+  if(v->len == 0 && v->f){
+    fileclose(v->f);
+    v->f = 0;
+  }
+  if(v->len == 0 && v->shm){
+    shmfree(v->shm);
+    v->shm = 0;
+  }
+  vmabase(p);
+  vmunlock(p);
+  return 0;
+}
+
+// gives np, a new child of p, p's mappings. the pages of shared
+// mappings are shared with p, the others are copy-on-write.
+// returns 0, or -1 with nothing mapped.
+int
+mmapfork(struct proc *np, struct proc *p)
+{
+  struct vma *v, *w;
+
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    if(uvmcopyrange(p->pagetable, np->pagetable, v->start, v->start + v->len,
+                    (v->flags & MAP_SHARED) != 0) < 0){
+      for(w = p->vmas; w < v; w++)
+        if(w->len)
+          uvmunmap(np->pagetable, w->start, w->len / PGSIZE, 1);
+      return -1;
+    }
+  }
+  for(v = p->vmas, w = np->vmas; v < &p->vmas[NVMA]; v++, w++){
+    *w = *v;
+    if(w->len && w->f)
+      filedup(w->f);
+    if(w->len && w->shm)
+      shmdup(w->shm);
+  }
+  np->mmapbase = p->mmapbase;
+  return 0;
+}
+
+// unmaps all of p's mappings, for exit() and exec().
+void
+mmapexit(struct proc *p)
+{
+  struct vma *v;
+
+  vmsettle(p);
+  vmlock(p);
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    vmaunmap(p, v, v->start, v->len);
+    if(v->f)
+      fileclose(v->f);
+    if(v->shm)
+      shmfree(v->shm);
+    v->f = 0;
+    v->shm = 0;
+    v->len = 0;
+  }
+  p->mmapbase = MMAPTOP;
+  vmunlock(p);
+}
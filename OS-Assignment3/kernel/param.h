@@ -1,19 +1,69 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
+#define NTHREAD       8  // threads sharing one address space, see clone()
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE      200  // maximum number of active i-nodes
+#define NIBUCKET     37  // hash buckets in the i-node table
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      240 // max data blocks in on-disk log (mkfs -l picks the size)
+#define FILEWRITEBLOCKS (MAXOPBLOCKS*6) // log blocks one chunk of a file write may use
+#define GROUPWINDOW  2  // ticks a log commit may wait for more ops (0: at once)
+#define GROUPFULL    50 // ... unless the log is this percent full
+#define FLUSHWINDOW  30 // idle ticks after which the log's blocks are written home
+#define NBUF         (LOGSIZE+MAXOPBLOCKS*6) // size of disk block cache
+#define NBUCKET      31   // hash buckets in the disk block cache
+#define NREADAHEAD    8   // blocks readi() reads ahead of a sequential reader
+#define NCHAN        61   // hash buckets of sleeping processes, by channel
+#define NPIDHASH     61   // hash buckets of processes, by pid
+#define WAKELAG  1000000  // time-CSR cycles (a tick) a waking process may lag
+#define PIPESIZE     4096 // bytes a pipe buffers; a power of two
+#define UARTTXBUF    4096 // bytes of console output buffered for the UART
+#define NDENTRY      256  // cached directory entries
+#define NDBUCKET     61   // hash buckets in the directory entry cache
+#define FSSIZE       200000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
-#define MAX_PSYC_PAGES 16
-#define MAX_TOTAL_PAGES 32
+#define MAX_PSYC_PAGES 16  // default limit on a paging process's resident pages
+#define PFF_INTERVAL 10  // ticks over which a process's fault rate is taken
+#define PFF_HIGH      8  // more faults than this per interval: PFF_STEP more pages
+#define PFF_LOW       2  // fewer than this: PFF_STEP fewer
+#define PFF_STEP      4
+#define PFF_MINPAGES  8  // range of the adapted resident limit
+#define PFF_MAXPAGES 128
+#define MINFRAMES    64  // free pages below which a process swaps out itself
+#define LOWFRAMES   256  // ... which wake kswapd
+#define HIGHFRAMES  512  // ... at which kswapd goes back to sleep
+// a cap, not what a file can hold (MAXFILE*BSIZE/PGSIZE, far more):
+// it sizes each proc's free-slot stack, and a swap file must fit in FSSIZE
+#define SWAPFILE_PAGES 1024 // max pages in one process's swap file
+#define SWAP_BATCH    4  // pages swapped out together when memory is full
+#define SWAP_READAHEAD 4 // max pages read in ahead of a sequential fault
+#define NTCACHE       8  // per-process cached user page translations
+#define NLOCKSTAT    64  // lock names LOCKSTAT=1 keeps statistics for
+#define NEXECSEG      4  // loadable segments exec() can demand-page
+#define NVMA         16  // mmap() regions per process
+#define NMADVISE      8  // address ranges given read-ahead advice per process
+#define NSHM         32  // shared memory segments
+#define KMAXORDER     9  // largest kalloc_pages() block: 2^9 pages, 2MB
+#define NZSWAP     4096  // pages the compressed swap cache can hold
+#define ZSWAPPAGES  512  // memory it may use for them, in pages
+#define SHMPAGES    512  // max pages in one, as many frames as a page holds
+#define NSWAPPOOL     8  // swap files kept open for reuse, well below NFILE
+#define NTEXTPAGES  512  // pages of program text cached for sharing
+#define NTEXTHASH    61  // hash buckets for them, by inode
+#define AGING_INTERVAL 1 // ticks between NFUA/LAPA aging passes
+#define NSWAPSLOTS 8192 // max pages in the raw swap area
+#define NTRACE      256 // records in each CPU's trace ring
+#define NPROF      1024 // samples in each CPU's profiler ring
 #define NFUA 1
 #define LAPA 2
 #define SCFIFO 3
 #define NONE 4
+#define GLOBAL 5     // second chance across all processes, see reclaim()
+#define ARC 6        // adaptive replacement with ghosts of evicted pages, see arc()
+#define TAS 1        // SPINLOCK: swap until the lock is free
+#define TTAS 2       // read until it looks free, then swap, backing off
+#define TICKET 3     // take a ticket and wait for its turn; fair
@@ -3,22 +3,56 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "slab.h"
+#include "pstat.h"
 #include "proc.h"
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+// The ring is PIPESIZE bytes spread over whole pages, so it
+// can be more than one page.
+//
+// A writer with a page-aligned run of at least a page, finding
+// the ring empty, lends the pipe the page's frame instead of
+// copying it (uvmlend() makes it copy-on-write). A reader with a
+// page-aligned buffer of at least a page maps that frame in
+// place of its own (uvmtake()); any other reader copies out of
+// it. Until the lent page has been read, writers wait as if the
+// ring were full, which keeps the bytes in order.
+#define PIPEPAGES ((PIPESIZE + PGSIZE - 1) / PGSIZE)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data[PIPEPAGES];
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
+  uint64 page;    // whole page handed over by a writer, or 0
+  uint pageoff;   // bytes of it read so far
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+// the pipes themselves are small, and come from a slab cache.
+struct kcache pipecache;
+
+void
+pipeinit(void)
+{
+  kcacheinit(&pipecache, "pipe", sizeof(struct pipe));
+}
+
+static void
+pipefree(struct pipe *pi)
+{
+  for(int i = 0; i < PIPEPAGES; i++)
+    if(pi->data[i])
+      kfree(pi->data[i]);
+  if(pi->page)
+    kfree((void*)pi->page);
+  kcachefree(&pipecache, pi);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,8 +62,14 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = (struct pipe*)kcachealloc(&pipecache)) == 0)
     goto bad;
+  pi->page = 0;
+  for(int i = 0; i < PIPEPAGES; i++)
+    pi->data[i] = 0;
+  for(int i = 0; i < PIPEPAGES; i++)
+    if((pi->data[i] = kalloc()) == 0)
+      goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
@@ -47,7 +87,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    pipefree(pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,15 +108,35 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pipefree(pi);
   } else
     release(&pi->lock);
 }
 
+// The ring byte for stream position pos, and in *contig how many
+// bytes from there on are contiguous: up to the end of its page,
+// or of the ring.
+static char*
+ringaddr(struct pipe *pi, uint pos, uint *contig)
+{
+  uint off = pos % PIPESIZE;
+
+  *contig = PGSIZE - off % PGSIZE;
+  if(*contig > PIPESIZE - off)
+    *contig = PIPESIZE - off;
+  return pi->data[off / PGSIZE] + off % PGSIZE;
+}
+
+// Data moves in runs as long as the ring allows (two around the
+// wrap), each a single copyin()/copyout(), which translates
+// each user page once.
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
   int i = 0;
+  uint m;
+  char *d;
+  uint64 pa;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -85,15 +145,25 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+    if(pi->page || pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
+    } else if(pi->nread == pi->nwrite && (addr + i) % PGSIZE == 0 && n - i >= PGSIZE &&
+              (pa = uvmlend(pr->pagetable, addr + i)) != 0){
+      pi->page = pa;
+      pi->pageoff = 0;
+      i += PGSIZE;
+      wakeup(&pi->nread);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      d = ringaddr(pi, pi->nwrite, &m);
+      if(m > pi->nread + PIPESIZE - pi->nwrite)
+        m = pi->nread + PIPESIZE - pi->nwrite;
+      if(m > n - i)
+        m = n - i;
+      if(copyin(pr->pagetable, d, addr + i, m) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      pi->nwrite += m;
+      i += m;
     }
   }
   wakeup(&pi->nread);
@@ -106,23 +176,47 @@ int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
   int i;
+  uint m;
+  char *s;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while(pi->nread == pi->nwrite && pi->page == 0 && pi->writeopen){  //DOC: pipe-empty
     if(pr->killed){
       release(&pi->lock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
+  for(i = 0; i < n; i += m){  //DOC: piperead-copy
+    if(pi->page){
+      m = PGSIZE;
+      if(pi->pageoff == 0 && (addr + i) % PGSIZE == 0 && n - i >= PGSIZE &&
+         uvmtake(pr->pagetable, addr + i, pi->page) == 0){
+        pi->page = 0;
+        continue;
+      }
+      m = PGSIZE - pi->pageoff;
+      if(m > n - i)
+        m = n - i;
+      if(copyout(pr->pagetable, addr + i, (char*)pi->page + pi->pageoff, m) == -1)
+        break;
+      if((pi->pageoff += m) == PGSIZE){
+        kfree((void*)pi->page);
+        pi->page = 0;
+      }
+      continue;
+    }
     if(pi->nread == pi->nwrite)
       break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+    s = ringaddr(pi, pi->nread, &m);
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(m > n - i)
+      m = n - i;
+    if(copyout(pr->pagetable, addr + i, s, m) == -1)
       break;
+    pi->nread += m;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
@@ -13,9 +13,11 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "defs.h"
+#include "pstat.h"
 #include "proc.h"
 
 volatile int panicked = 0;
+volatile int panicking = 0;  // printing the panic: console output goes straight out
 
 // lock to avoid interleaving concurrent printf's.
 static struct {
@@ -118,6 +120,7 @@ void
 panic(char *s)
 {
   pr.locking = 0;
+  panicking = 1;
   printf("panic: ");
   printf(s);
   printf("\n");
@@ -3,8 +3,10 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "pstat.h"
 #include "proc.h"
 #include "defs.h"
+#include "trace.h"
 
 struct cpu cpus[NCPU];
 
@@ -13,6 +15,7 @@ struct proc proc[NPROC];
 struct proc *initproc;
 
 int nextpid = 1;
+int nextkpid = -1;  // kernel threads count down, leaving user pids alone
 struct spinlock pid_lock;
 
 extern void forkret(void);
@@ -26,6 +29,148 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
+// lets a process wait for reclaim() to clear its p->intransit,
+// and guards reclaim()'s hand and kswapd's wakeups.
+struct spinlock vm_lock;
+static int kswapdwanted;
+
+// the policy processes start with, see setpolicy().
+static struct policy *syspolicy;
+
+// a queue of RUNNABLE processes for each CPU, ordered by vruntime:
+// the time each has run, scaled down for a low nice value and up
+// for a high one, so the process that has had least of its share
+// runs next. a process goes on the queue of the CPU that makes it
+// runnable, which is awake to do so. a CPU runs the processes on
+// its own queue, and when that is empty takes one from the longest
+// of the others'. a queue's lock is taken after p->lock, never
+// before.
+struct runq {
+  struct spinlock lock;
+  struct proc *head;
+  int n;
+} runqs[NCPU];
+
+// processes in sleep(), hashed by channel, so that wakeup() only
+// looks at those that may be sleeping on its channel. a process
+// is on its bucket's list from before sleep() releases the
+// caller's lock until it is running again; p->chan does not
+// change meanwhile. a bucket's lock is taken after p->lock, or
+// alone.
+struct {
+  struct spinlock lock;
+  struct proc *head;
+} chans[NCHAN];
+
+// weight of each nice value, from -20 to 19; each step is
+// about 10% more or less of the CPU. 0 weighs NICE0WEIGHT.
+static const int niceweight[40] = {
+  88761, 71755, 56483, 46273, 36291,
+  29154, 23254, 18705, 14949, 11916,
+  9548,  7620,  6100,  4904,  3906,
+  3121,  2501,  1991,  1586,  1277,
+  1024,  820,   655,   526,   423,
+  335,   272,   215,   172,   137,
+  110,   87,    70,    56,    45,
+  36,    29,    23,    18,    15,
+};
+#define NICE0WEIGHT 1024
+
+// the vruntime of the processes lately picked to run; a process
+// waking up is not let lag it by more than WAKELAG, so a long
+// sleep doesn't buy it the CPU for as long. only a hint: it is
+// read and written without a lock.
+static uint64 minvruntime;
+
+// processes by pid, for findproc(). a seqlock: a writer takes
+// the lock and makes seq odd while it changes a list, and a reader
+// takes no lock, but looks again if seq was odd or changed. that a
+// reader may follow pointers the lists no longer hold is harmless:
+// they point into proc[], which is never freed. a process is on
+// its list from allocproc() to freeproc(); the lock is taken after
+// p->lock, or alone.
+struct {
+  struct spinlock lock;
+  uint seq;
+  struct proc *head[NPIDHASH];
+} pidtab;
+
+static int
+chanhash(void *chan)
+{
+  return ((uint64)chan >> 3) % NCHAN;
+}
+
+static int
+pidhash(int pid)
+{
+  return (uint)pid % NPIDHASH;
+}
+
+static void
+pidinsert(struct proc *p)
+{
+  struct proc **pp = &pidtab.head[pidhash(p->pid)];
+
+  acquire(&pidtab.lock);
+  pidtab.seq++;
+  __sync_synchronize();
+  p->pidnext = *pp;
+  *pp = p;
+  __sync_synchronize();
+  pidtab.seq++;
+  release(&pidtab.lock);
+}
+
+static void
+pidremove(struct proc *p)
+{
+  struct proc **pp;
+
+  acquire(&pidtab.lock);
+  pidtab.seq++;
+  __sync_synchronize();
+  for(pp = &pidtab.head[pidhash(p->pid)]; *pp; pp = &(*pp)->pidnext)
+    if(*pp == p){
+      *pp = p->pidnext;
+      break;
+    }
+  __sync_synchronize();
+  pidtab.seq++;
+  release(&pidtab.lock);
+}
+
+// The process with the given pid, with its lock held, or 0 if
+// there is none. Takes no lock but the one of the process it
+// finds, see pidtab.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+  uint seq;
+  int n;
+
+  do {
+    while((seq = __atomic_load_n(&pidtab.seq, __ATOMIC_ACQUIRE)) & 1)
+      ;
+    // bounded: a list changing under us may lead anywhere
+    p = pidtab.head[pidhash(pid)];
+    for(n = 0; p && p->pid != pid && n < NPROC; n++)
+      p = p->pidnext;
+    __sync_synchronize();
+  } while(__atomic_load_n(&pidtab.seq, __ATOMIC_ACQUIRE) != seq);
+
+  if(p == 0 || pid == 0)
+    return 0;
+  acquire(&p->lock);
+  // pids are not reused: if it is not pid now, pid is gone
+  if(p->pid != pid || p->state == UNUSED){
+    release(&p->lock);
+    return 0;
+  }
+  return p;
+}
+
 // Allocate a page for each process's kernel stack.
 // Map it high in memory, followed by an invalid
 // guard page.
@@ -50,6 +195,17 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  initlock(&vm_lock, "vm");
+  initlock(&pidtab.lock, "pidtab");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runqs[i].lock, "runq");
+  for(int i = 0; i < NCHAN; i++)
+    initlock(&chans[i].lock, "chan");
+  #if SELECTION == NFUA || SELECTION == LAPA || SELECTION == ARC
+    syspolicy = pagepolicy(SELECTION);
+  #else
+    syspolicy = pagepolicy(SCFIFO);
+  #endif
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->kstack = KSTACK((int) (p - proc));
@@ -85,6 +241,14 @@ myproc(void) {
   return p;
 }
 
+// The process whose memory and paging state the running one
+// uses: itself, unless it is a thread, see clone().
+struct proc*
+myspace(void) {
+  struct proc *p = myproc();
+  return p ? p->mm : 0;
+}
+
 int
 allocpid() {
   int pid;
@@ -97,12 +261,24 @@ allocpid() {
   return pid;
 }
 
+int
+allockpid() {
+  int pid;
+
+  acquire(&pid_lock);
+  pid = nextkpid;
+  nextkpid = nextkpid - 1;
+  release(&pid_lock);
+
+  return pid;
+}
+
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
-allocproc(void)
+allocproc(int kernel)
 {
   struct proc *p;
 
@@ -117,8 +293,9 @@ allocproc(void)
   return 0;
 
 found:
-  p->pid = allocpid();
+  p->pid = kernel ? allockpid() : allocpid();
   p->state = USED;
+  pidinsert(p);
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -141,16 +318,18 @@ found:
   p->context.ra = (uint64)forkret;
   p->context.sp = p->kstack + PGSIZE;
 
-  for(int i = 0; i < MAX_TOTAL_PAGES; i++){
-    p->data[i].offset = -1;  
-    p->data[i].inUse = 0;
-    p->data[i].agingCounter = 0;
-    p->pages[i] = -1;
-  }
-  p->head = 0;
-  p->numOfPages = 0;
-  p->tail = -1;
-  p->pagesInMemory = 0;
+  freePaging(p);
+  memset(&p->stats, 0, sizeof(p->stats));
+  p->maxPsycPages = MAX_PSYC_PAGES;
+  memset(p->vmas, 0, sizeof(p->vmas));
+  p->mmapbase = MMAPTOP;
+  p->policy = syspolicy;
+  p->nextpolicy = 0;
+  p->mm = p;
+  p->nthreads = 1;
+  p->tslots = 1;
+  p->tslot = 0;
+  p->inuser = 0;
   return p;
 }
 
@@ -167,22 +346,24 @@ freeproc(struct proc *p)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
+  if(p->pid != 0)
+    pidremove(p);
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
-  for(int i = 0; i < MAX_TOTAL_PAGES; i++){
-    p->data[i].offset = -1;  
-    p->data[i].inUse = 0;
-    p->data[i].agingCounter = 0;
-    p->pages[i] = -1;
-  }
-  p->head = 0;
-  p->numOfPages = 0;
-  p->tail = -1;
-  p->pagesInMemory = 0;
+  p->kfn = 0;
+  p->vmdepth = 0;
+  p->vmowner = 0;
+  p->tlbstopped = 0;
+  p->intransit = 0;
+  p->swapwait = 0;
+  p->nice = 0;
+  p->vruntime = 0;
+  tcflush(p);
+  freePaging(p);
   p->state = UNUSED;
 }
 
@@ -247,7 +428,7 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
   // allocate one user page and copy init's instructions
@@ -262,8 +443,38 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  runnable(p);
+
+  release(&p->lock);
+}
+
+// First scheduling of a kernel thread: run its function,
+// which must never return.
+static void
+kthreadstart(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+  p->kfn();
+  panic("kthread returned");
+}
 
+// Start a kernel thread running fn(). It has a process slot
+// (with a negative pid) so it can sleep, but it never enters
+// user space.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc(1)) == 0)
+    panic("kthread");
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadstart;
+  safestrcpy(p->name, name, sizeof(p->name));
+  runnable(p);
   release(&p->lock);
 }
 
@@ -272,18 +483,22 @@ userinit(void)
 int
 growproc(int n)
 {
-  uint sz;
-  struct proc *p = myproc();
+  uint64 sz;
+  struct proc *p = myspace();
 
+  vmsettle(p);
+  vmlock(p);
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+    if(sz + n > p->mmapbase || (sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+      vmunlock(p);
       return -1;
     }
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
   p->sz = sz;
+  vmunlock(p);
   return 0;
 }
 
@@ -295,19 +510,45 @@ fork(void)
   int i, pid;
   struct proc *np;
   struct proc *p = myproc();
+  struct proc *mm = p->mm;    // a thread forks its process's memory
+
+  vmsettle(mm);
+  vmlock(mm);
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
+    vmunlock(mm);
     return -1;
   }
+  // the copies make mm's pages copy-on-write, so its other
+  // threads wait in the kernel meanwhile. np isn't runnable,
+  // and tlbstart() can't wake them with np->lock held.
+  release(&np->lock);
+  tlbstop(mm);
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
-    freeproc(np);
-    release(&np->lock);
-    return -1;
-  }
-  np->sz = p->sz;
+  if(uvmcopy(mm->pagetable, np->pagetable, mm->sz) < 0)
+    goto bad;
+  np->sz = mm->sz;
+  np->policy = mm->policy;
+  np->nextpolicy = mm->nextpolicy;
+  np->nice = p->nice;
+  np->vruntime = p->vruntime;
+
+  // and the paging state that goes with it.
+  if(mm->pid > 1 && copyPaging(np, mm) < 0)
+    goto bad;
+  #if SELECTION != NONE
+    // and its swapped-out pages. np gets a swap file when it
+    // first needs one, here if mm has pages in its own.
+    if(np->pid > 2 && mm->pid > 1 && copySwapFile(np) < 0)
+      goto bad;
+  #endif
+
+  // and its mmap() regions.
+  if(mmapfork(np, mm) < 0)
+    goto bad;
+  tlbstart(mm);
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -325,32 +566,93 @@ fork(void)
 
   pid = np->pid;
 
+  vmunlock(mm);
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  runnable(np);
   release(&np->lock);
-  #if SELECTION != NONE
-    if(np->pid > 2) {
-      createSwapFile(np);
-      if(p->swapFile)
-        copySwapFile(np);        
-    }
-  #endif
-  if (p->pid > 2){
-    for(int i = 0; i < MAX_TOTAL_PAGES; i++) {
-      np->data[i].offset = p->data[i].offset;
-      np->data[i].inUse = p->data[i].inUse;
-      np->data[i].agingCounter = p->data[i].agingCounter;
-      np->pages[i] = p->pages[i];
-    }
-    np->head = p->head;
-    np->tail = p->tail;
-    np->numOfPages = p->numOfPages;
-    np->pagesInMemory = p->pagesInMemory;
+
+  return pid;
+
+bad:
+  tlbstart(mm);
+  vmunlock(mm);
+  if(np->swapFile)
+    removeSwapFile(np);
+  acquire(&np->lock);
+  freeproc(np);
+  release(&np->lock);
+  return -1;
+}
+
+// Start a thread of the running process at fn(arg), on the user
+// stack whose top is stack. It shares the process's memory and
+// paging state (page table, paging metadata, swap file) and has
+// a trapframe and kernel stack of its own, copies of the caller's
+// open files, and a pid. fn has nowhere to return to: it ends
+// with exit(), and the caller reaps it with wait(), like a child.
+// exec() fails while a process has threads. Returns its pid, or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int i, slot, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct proc *mm = p->mm;
+
+  if((np = allocproc(0)) == 0)
+    return -1;
+  // it runs on mm's page table
+  proc_freepagetable(np->pagetable, 0);
+  np->pagetable = 0;
+  release(&np->lock);
+
+  vmlock(mm);
+  for(slot = 1; slot < NTHREAD && (mm->tslots & (1 << slot)); slot++)
+    ;
+  if(slot == NTHREAD ||
+     mappages(mm->pagetable, THREADFRAME(slot), PGSIZE, (uint64)np->trapframe, PTE_R | PTE_W) < 0){
+    vmunlock(mm);
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
   }
+  mm->tslots |= 1 << slot;
+  acquire(&wait_lock);
+  mm->nthreads++;
+  release(&wait_lock);
+  vmunlock(mm);
+
+  np->pagetable = mm->pagetable;
+  np->mm = mm;
+  np->tslot = slot;
+  np->nice = p->nice;
+  np->vruntime = p->vruntime;
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack;
+
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
   acquire(&wait_lock);
   np->parent = p;
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  runnable(np);
   release(&np->lock);
 
   return pid;
@@ -371,6 +673,31 @@ reparent(struct proc *p)
   }
 }
 
+// Kill the other threads of p and wait until they are gone:
+// they run on p's memory, which p's exit() is about to free.
+static void
+killthreads(struct proc *p)
+{
+  struct proc *t;
+
+  acquire(&wait_lock);
+  while(p->nthreads > 1){
+    for(t = proc; t < &proc[NPROC]; t++){
+      if(t == p || t->mm != p)
+        continue;
+      acquire(&t->lock);
+      if(t->mm == p){
+        t->killed = 1;
+        if(t->state == SLEEPING)
+          runnable(t);
+      }
+      release(&t->lock);
+    }
+    sleep(&p->nthreads, &wait_lock);
+  }
+  release(&wait_lock);
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait().
@@ -378,10 +705,18 @@ void
 exit(int status)
 {
   struct proc *p = myproc();
+  struct proc *mm = p->mm;
 
   if(p == initproc)
     panic("init exiting");
 
+  if(mm == p){
+    if(p->nthreads > 1)
+      killthreads(p);
+    // the mappings first: their dirty pages go back to their files.
+    mmapexit(p);
+  }
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -391,16 +726,37 @@ exit(int status)
     }
   }
 
-  if(p->pid > 2)
-    removeSwapFile(p);
+  if(mm == p){
+    // for good: reclaim() must leave what is left alone.
+    vmsettle(p);
+    vmlock(p);
+    if(p->pid > 2)
+      removeSwapFile(p);
+  } else {
+    // a thread only gives back its trapframe's slot.
+    vmlock(mm);
+    uvmunmap(mm->pagetable, THREADFRAME(p->tslot), 1, 0);
+    mm->tslots &= ~(1 << p->tslot);
+    vmunlock(mm);
+    p->pagetable = 0;
+  }
 
   begin_op();
   iput(p->cwd);
+  if(p->execip)
+    iput(p->execip);
   end_op();
   p->cwd = 0;
+  p->execip = 0;
 
   acquire(&wait_lock);
 
+  if(mm != p){
+    mm->nthreads--;
+    wakeup(&mm->nthreads);
+    p->mm = p;
+  }
+
   // Give any children to init.
   reparent(p);
 
@@ -425,9 +781,17 @@ int
 wait(uint64 addr)
 {
   struct proc *np;
-  int havekids, pid;
+  int havekids, pid, pinned = 0;
   struct proc *p = myproc();
 
+  // the status is copied out under the locks below, where
+  // copyout() must not fault the page in: pin it first.
+  if(addr != 0 && (pinned = uvmpin(addr, sizeof(np->xstate), 1)) < sizeof(np->xstate)){
+    if(pinned)
+      uvmunpin(addr, pinned);
+    return -1;
+  }
+
   acquire(&wait_lock);
 
   for(;;){
@@ -445,13 +809,12 @@ wait(uint64 addr)
           if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
                                   sizeof(np->xstate)) < 0) {
             release(&np->lock);
-            release(&wait_lock);
-            return -1;
+            pid = -1;
+            goto out;
           }
           freeproc(np);
           release(&np->lock);
-          release(&wait_lock);
-          return pid;
+          goto out;
         }
         release(&np->lock);
       }
@@ -459,16 +822,100 @@ wait(uint64 addr)
 
     // No point waiting if we don't have any children.
     if(!havekids || p->killed){
-      release(&wait_lock);
-      return -1;
+      pid = -1;
+      goto out;
     }
     
     // Wait for a child to exit.
     sleep(p, &wait_lock);  //DOC: wait-sleep
   }
+
+out:
+  release(&wait_lock);
+  if(pinned)
+    uvmunpin(addr, pinned);
+  return pid;
 }
 
 // Per-CPU process scheduler.
+// Charge the running process p for the time since it was last
+// charged. p->lock must be held.
+static void
+account(struct proc *p)
+{
+  uint64 now = r_time();
+
+  p->vruntime += (now - p->runstart) * NICE0WEIGHT / niceweight[p->nice + 20];
+  p->runstart = now;
+}
+
+// Make p RUNNABLE, on the run queue of this CPU, behind those with
+// no more vruntime. p->lock must be held.
+void
+runnable(struct proc *p)
+{
+  struct runq *q = &runqs[cpuid()];
+  struct proc **pp;
+  uint64 lag;
+
+  if(p->state == RUNNING)
+    account(p);
+  else {
+    // one waking from paging I/O gets no lead at all, so a
+    // thrashing process doesn't push ahead of the others at
+    // every fault.
+    lag = p->swapwait ? 0 : WAKELAG;
+    if(p->vruntime + lag < minvruntime)
+      p->vruntime = minvruntime - lag;
+  }
+  p->state = RUNNABLE;
+  acquire(&q->lock);
+  for(pp = &q->head; *pp && (*pp)->vruntime <= p->vruntime; pp = &(*pp)->rqnext)
+    ;
+  p->rqnext = *pp;
+  *pp = p;
+  q->n++;
+  release(&q->lock);
+}
+
+// Take the first process off queue q, 0 if it is empty.
+static struct proc*
+dequeue(struct runq *q)
+{
+  struct proc *p;
+
+  acquire(&q->lock);
+  if((p = q->head) != 0){
+    q->head = p->rqnext;
+    q->n--;
+  }
+  release(&q->lock);
+  return p;
+}
+
+// The next process for this CPU to run: from its own queue,
+// else stolen from the longest other one. 0 if none is runnable.
+static struct proc*
+nextproc(void)
+{
+  int id = cpuid(), best, i;
+  struct proc *p;
+
+  if((p = dequeue(&runqs[id])) != 0)
+    return p;
+  // the lengths are read without the locks, only as hints
+  best = -1;
+  for(i = 0; i < NCPU; i++)
+    if(i != id && runqs[i].n > 0 && (best < 0 || runqs[i].n > runqs[best].n))
+      best = i;
+  if(best >= 0 && (p = dequeue(&runqs[best])) != 0)
+    return p;
+  for(i = 0; i < NCPU; i++)
+    if(i != id && (p = dequeue(&runqs[i])) != 0)
+      return p;
+  return 0;
+}
+
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
 //  - choose a process to run.
@@ -486,22 +933,42 @@ scheduler(void)
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-        updateAging();
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
+    if((p = nextproc()) == 0){
+      // nothing to run: zero a page ahead for kalloc_zeroed(),
+      // else halt until an interrupt. they are off from the last
+      // look at the queues to the wfi, which one arriving in
+      // between (to make a process runnable) ends at once.
+      if(kzerofill())
+        continue;
+      intr_off();
+      if((p = nextproc()) == 0){
+        wfi();
+        continue;
       }
-      release(&p->lock);
     }
+
+    // A process still running on another CPU, which has just
+    // put itself on a queue in yield() or sleep(), is held on
+    // to by its p->lock until it is off that CPU.
+    acquire(&p->lock);
+    if(p->state == RUNNABLE) {
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      p->state = RUNNING;
+      c->proc = p;
+      p->runstart = r_time();
+      if(p->vruntime > minvruntime)
+        minvruntime = p->vruntime;
+      TRACEPOINT(TR_SWITCHIN, p->pid, 0);
+      swtch(&c->context, &p->context);
+      TRACEPOINT(TR_SWITCHOUT, p->pid, p->state);
+      updateAging();
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      c->proc = 0;
+    }
+    release(&p->lock);
   }
 }
 
@@ -527,6 +994,7 @@ sched(void)
   if(intr_get())
     panic("sched interruptible");
 
+  account(p);
   intena = mycpu()->intena;
   swtch(&p->context, &mycpu()->context);
   mycpu()->intena = intena;
@@ -538,7 +1006,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  runnable(p);
   sched();
   release(&p->lock);
 }
@@ -570,24 +1038,40 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  int h = chanhash(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // Once we hold p->lock, and are on chan's
+  // list, we can be guaranteed that we won't
+  // miss any wakeup (wakeup locks p->lock),
   // so it's okay to release lk.
 
   acquire(&p->lock);  //DOC: sleeplock1
+  p->chan = chan;
+  acquire(&chans[h].lock);
+  p->chprev = 0;
+  p->chnext = chans[h].head;
+  if(chans[h].head)
+    chans[h].head->chprev = p;
+  chans[h].head = p;
+  release(&chans[h].lock);
   release(lk);
 
   // Go to sleep.
-  p->chan = chan;
   p->state = SLEEPING;
 
   sched();
 
   // Tidy up.
+  acquire(&chans[h].lock);
+  if(p->chprev)
+    p->chprev->chnext = p->chnext;
+  else
+    chans[h].head = p->chnext;
+  if(p->chnext)
+    p->chnext->chprev = p->chprev;
+  release(&chans[h].lock);
   p->chan = 0;
 
   // Reacquire original lock.
@@ -600,16 +1084,24 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
-
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
-      acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
+  struct proc *p, *sleepers[NPROC];
+  int h = chanhash(chan), n = 0;
+
+  // p->lock can't be taken under the bucket's, so the
+  // sleepers are picked first, and checked again after.
+  acquire(&chans[h].lock);
+  for(p = chans[h].head; p; p = p->chnext)
+    if(p->chan == chan && p != myproc())
+      sleepers[n++] = p;
+  release(&chans[h].lock);
+
+  for(int i = 0; i < n; i++){
+    p = sleepers[i];
+    acquire(&p->lock);
+    if(p->state == SLEEPING && p->chan == chan) {
+      runnable(p);
     }
+    release(&p->lock);
   }
 }
 
@@ -621,20 +1113,94 @@ kill(int pid)
 {
   struct proc *p;
 
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    runnable(p);
+  }
+  release(&p->lock);
+  return 0;
+}
+
+// Have page-replacement policy n (NFUA, LAPA, SCFIFO or ARC) choose
+// the pages process pid swaps out, or if pid is 0 all processes'
+// pages and those of processes to come. Returns the number of the
+// policy it had before (the system's for 0), -1 if there is no
+// such process or policy. A process switches when it next
+// gives up the CPU, see updateAging().
+int
+setpolicy(int pid, int n)
+{
+  struct policy *pol;
+  struct proc *p, *q;
+  int old = -1;
+
+  #if SELECTION == NONE
+    return -1;
+  #endif
+  if((pol = pagepolicy(n)) == 0)
+    return -1;
+  if(pid != 0){
+    if((p = findproc(pid)) == 0)
+      return -1;
+    // a thread's pages are its process's
+    q = p->mm;
+    old = policyno(q->nextpolicy ? q->nextpolicy : q->policy);
+    q->nextpolicy = (pol != q->policy) ? pol : 0;
+    release(&p->lock);
+    return old;
+  }
+  old = policyno(syspolicy);
+  syspolicy = pol;
   for(p = proc; p < &proc[NPROC]; p++){
     acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
+    if(p->state != UNUSED && p->mm == p)
+      p->nextpolicy = (pol != p->policy) ? pol : 0;
     release(&p->lock);
   }
-  return -1;
+  return old;
+}
+
+// Set the nice value of process pid, the caller if pid is 0:
+// from -20, for the biggest share of the CPU, to 19. Returns
+// 0, or -1 if there is no such process or nice value.
+int
+setnice(int pid, int nice)
+{
+  struct proc *p;
+
+  if(nice < -20 || nice > 19)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  // a queued process keeps its place until it next runs
+  if(p->state == RUNNING)
+    account(p);
+  p->nice = nice;
+  release(&p->lock);
+  return 0;
+}
+
+// Copy the paging counters of process pid, or of the caller if
+// pid is 0, to user address addr; a thread's are its process's.
+// Returns 0, or -1 if there is no such process.
+int
+getpagestats(int pid, uint64 addr)
+{
+  struct proc *p, *me = myproc();
+  struct pagestats st;
+
+  if(pid == 0)
+    pid = me->pid;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  st = p->mm->stats;
+  release(&p->lock);
+  return copyout(me->pagetable, addr, (char*)&st, sizeof(st));
 }
 
 // Copy to either a user address, or kernel address,
@@ -691,7 +1257,227 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
+    printf("%d %s %s nice %d", p->pid, state, p->name, p->nice);
+    if(p->state == SLEEPING && p->swapwait)
+      printf(" (paging)");
+    if(p->stats.faults > 0)
+      printf(" faults %d (%d major) in %d out %d dropped %d",
+             (int)p->stats.faults, (int)p->stats.majfaults, (int)p->stats.swapins,
+             (int)p->stats.swapouts, (int)p->stats.drops);
     printf("\n");
   }
 }
+
+// reclaim(), for kswapd and global replacement (SELECTION == GLOBAL),
+// takes pages from processes other than the one running. It only does
+// so while holding that process's lock, with it not running, nor
+// in the middle of paging work of its own: everything that looks
+// at a process's page table or paging metadata, or holds a
+// physical address taken from them, does so between vmlock() and
+// vmunlock(). The victims are unmapped at once and written out
+// afterwards, so the process waits in vmsettle() before it needs
+// any of them.
+//
+// The threads of a process (see clone()) share its page table and
+// paging state, so vmlock() is a lock among them as well. reclaim()
+// leaves such a process alone: it pages only by its own faults.
+
+// Start paging work on p, the running process or the one whose
+// thread is running. Only p's threads change p->vmdepth, and
+// reclaim() looks at it while p cannot be running; if there are
+// several, the first to get here has it until it is done, and the
+// others sleep. So it must not be taken under a spinlock: the
+// owner may be asleep, and copyout() &c there don't (see
+// copypinned()). May nest.
+void
+vmlock(struct proc *p)
+{
+  struct proc *me = myproc();
+
+  if(p == 0)
+    return;
+  if(p->nthreads > 1 && p->vmowner != me){
+    acquire(&vm_lock);
+    if(mycpu()->noff > 1)
+      panic("vmlock: spinlock held");
+    while(p->vmowner != 0)
+      sleep(&p->vmowner, &vm_lock);
+    p->vmowner = me;
+    release(&vm_lock);
+  }
+  p->vmdepth++;
+}
+
+void
+vmunlock(struct proc *p)
+{
+  if(p == 0)
+    return;
+  if(--p->vmdepth == 0 && p->vmowner != 0){
+    acquire(&vm_lock);
+    p->vmowner = 0;
+    release(&vm_lock);
+    wakeup(&p->vmowner);
+  }
+}
+
+// With no inter-processor interrupts to flush other harts' TLBs,
+// the threads of p are kept out of user space while a PTE they may
+// have cached changes in a way that matters: to another frame, or
+// to fewer permissions. Between tlbstop() and tlbstart(), which
+// nest, a thread on its way to user space waits in tlbwait();
+// tlbstop() waits for those in user space to come in, which a
+// timer interrupt brings about soon enough. Each sees the new PTEs
+// when it goes back, as userret flushes the TLB. The caller holds
+// vmlock(p).
+void
+tlbstop(struct proc *p)
+{
+  struct proc *me = myproc(), *t;
+
+  if(p->tlbstopped++ > 0 || p->nthreads == 1)
+    return;
+  __sync_synchronize();
+  for(t = proc; t < &proc[NPROC]; t++)
+    while(t != me && t->mm == p && t->inuser){
+      // with a spinlock held (e.g. copyout() in piperead()), spin.
+      if(mycpu()->noff == 0)
+        yield();
+    }
+}
+
+void
+tlbstart(struct proc *p)
+{
+  if(--p->tlbstopped > 0 || p->nthreads == 1)
+    return;
+  // a thread that saw it stopped is asleep once vm_lock is free
+  acquire(&vm_lock);
+  release(&vm_lock);
+  wakeup(&p->tlbstopped);
+}
+
+// Called by the running thread p, with interrupts off, just before
+// it returns to user space: waits while its process's threads are
+// stopped, see tlbstop().
+void
+tlbwait(struct proc *p)
+{
+  struct proc *mm = p->mm;
+
+  for(;;){
+    p->inuser = 1;
+    __sync_synchronize();
+    if(mm->tlbstopped == 0)
+      return;
+    p->inuser = 0;
+    acquire(&vm_lock);
+    while(mm->tlbstopped)
+      sleep(&mm->tlbstopped, &vm_lock);
+    release(&vm_lock);
+  }
+}
+
+// Wait until no page of p is on its way out. The waiting is
+// counted on the caller, the thread that sleeps, like the paging
+// I/O it does (see runnable()).
+void
+vmsettle(struct proc *p)
+{
+  #if SELECTION != NONE
+    struct proc *me = myproc();
+
+    acquire(&vm_lock);
+    me->swapwait++;
+    while(p->intransit)
+      sleep(&p->intransit, &vm_lock);
+    me->swapwait--;
+    release(&vm_lock);
+  #endif
+}
+
+// Evict about n pages, going round the paging processes like a
+// clock hand and taking up to SWAP_BATCH from each, chosen by its
+// own policy (second chance for GLOBAL). Called when free
+// frames run low. Returns the number of pages evicted.
+int
+reclaim(int n)
+{
+  static int hand;    // next slot in proc[]
+  struct proc *me = myproc(), *q;
+  struct evict e;
+  int got = 0, k;
+
+  for(int i = 0; i < NPROC && got < n; i++){
+    acquire(&vm_lock);
+    q = &proc[hand];
+    hand = (hand + 1) % NPROC;
+    release(&vm_lock);
+    if(q == me->mm){
+      // our own pages, which we are free to swap out as usual,
+      // once kswapd is done with them (see page_to_file()).
+      vmsettle(q);
+      tlbstop(q);
+      k = q->pid > 1 ? evictstart(q, n - got, &e) : 0;
+      tlbstart(q);
+      if(k > 0){
+        evictend(q, &e);
+        got += k;
+      }
+      continue;
+    }
+    k = 0;
+    acquire(&q->lock);
+    if(q->pid > 1 && q->mm == q && q->nthreads == 1 &&
+       (q->state == SLEEPING || q->state == RUNNABLE) &&
+       q->vmdepth == 0 && !q->intransit && (q->pid > 2 || swapdevice())){
+      if((k = evictstart(q, n - got, &e)) > 0)
+        q->intransit = 1;
+    }
+    release(&q->lock);
+    if(k == 0)
+      continue;
+
+    evictend(q, &e);
+    acquire(&vm_lock);
+    q->intransit = 0;
+    release(&vm_lock);
+    wakeup(&q->intransit);
+    got += k;
+  }
+  return got;
+}
+
+// Ask kswapd to free some memory.
+void
+kswapdwake(void)
+{
+  acquire(&vm_lock);
+  if(!kswapdwanted){
+    kswapdwanted = 1;
+    wakeup(&kswapdwanted);
+  }
+  release(&vm_lock);
+}
+
+// Page-out daemon: once free memory falls below LOWFRAMES, writes
+// pages out ahead of need until HIGHFRAMES are free (or nothing
+// more can go), so that a fault seldom waits for the disk.
+void
+kswapd(void)
+{
+  int nfree;
+
+  for(;;){
+    acquire(&vm_lock);
+    while(!kswapdwanted)
+      sleep(&kswapdwanted, &vm_lock);
+    kswapdwanted = 0;
+    release(&vm_lock);
+
+    // cached text no process maps goes first: it costs no I/O
+    while((nfree = kfreepages()) < HIGHFRAMES)
+      if(textreclaim(HIGHFRAMES - nfree) == 0 && reclaim(HIGHFRAMES - nfree) == 0)
+        break;
+  }
+}
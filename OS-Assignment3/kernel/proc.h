@@ -82,8 +82,99 @@ struct trapframe {
 
 struct paging_meta_data{
   uint offset;                // offset in the swapFile
-  uint inUse;                 // which indecates if it's in memory or not
   uint agingCounter;         // in order to maintain the NFU aging algo
+  int next;                   // resident-page queue links (page numbers, -1 at the ends)
+  int prev : 28;
+  uint inUse : 1;             // which indecates if it's in memory or not
+  uint file : 1;              // contents are still those in p->execip
+  uint pinned : 1;            // kept resident (and off the queue) by uvmpin()
+  uint locked : 1;            // ... until munlock(), see uvmlock()
+};
+
+// a page-replacement policy, see policies[] in vm.c.
+struct policy {
+  char *name;
+  uint (*init)(struct proc*, int);    // agingCounter for a page coming in
+  void (*fault)(struct proc*, int);   // a page not resident is wanted
+  void (*age)(struct proc*);          // pass on returning to the scheduler
+  int (*victim)(struct proc*);        // page to swap out, -1 if none
+  void (*remove)(struct proc*, int, int); // a page left memory, 1 if to swap
+  void (*attach)(struct proc*);       // p switches to the policy
+  void (*detach)(struct proc*);       // ... or away from it
+};
+
+// ARC's lists, see arc() in vm.c: 0 is T1/B1, 1 is T2/B2.
+struct arcstate {
+  int p;                      // target size of T1
+  int nt[2];                  // resident pages on T1, T2
+  int nb[2];                  // ghosts on B1, B2
+  int bhead[2];               // oldest ghost, -1 if none
+  int btail[2];               // newest ghost
+  int thead, ttail;           // T2's resident pages, a queue of their own
+};
+
+// m->agingCounter of a page under ARC: the list it is on.
+#define ARC_T1 1
+#define ARC_T2 2
+#define ARC_B1 3
+#define ARC_B2 4
+
+// victims of one swap-out, between evictstart() and evictend().
+struct evict {
+  uint64 start;               // r_time() at evictstart()
+  int count;
+  char *pages[SWAP_BATCH];    // their frames
+  int ndirty;
+  char *dirty[SWAP_BATCH];    // the frames to write out,
+  uint offsets[SWAP_BATCH];   // their slots
+  struct paging_meta_data *meta[SWAP_BATCH];
+  int nwb;
+  char *wb[SWAP_BATCH];       // dirty pages of shared file mappings,
+  uint64 wbva[SWAP_BATCH];    // to be written back to their files
+  int nz;                     // dirty ones zswap kept instead
+};
+
+// a region mapped by mmap(), see mmap.c.
+struct vma {
+  uint64 start;               // page-aligned, 0 len if the slot is free
+  uint64 len;
+  int prot;                   // PROT_READ, PROT_WRITE
+  int flags;                  // MAP_SHARED or MAP_PRIVATE, MAP_ANON
+  struct file *f;             // 0 if anonymous
+  struct shm *shm;            // segment of a shared anonymous one
+  uint off;                   // file (or segment) offset of start
+};
+
+// read-ahead advice for [start, end), see madvise().
+struct madvice {
+  uint64 start;               // page-aligned, start == end if the slot is free
+  uint64 end;
+  int advice;                 // MADV_RANDOM or MADV_SEQUENTIAL
+};
+
+// a program segment exec() left to be faulted in from the executable.
+struct execseg {
+  uint64 vaddr;               // page-aligned start
+  uint64 filesz;              // bytes from the file, the rest is zero
+  uint off;                   // file offset of vaddr
+};
+
+// the paging state of one user image, which exec() sets aside
+// while it builds the new image's, see stashPaging().
+struct pagingstate {
+  uint64 *meta;
+  uint pagesInMemory;
+  int head;
+  int tail;
+  int numOfPages;
+  int lastFault;
+  int readAhead;
+  uint lastAging;
+  int npinned;
+  int nfaults;
+  uint pffstamp;
+  struct madvice madv[NMADVISE];
+  struct arcstate arc;
 };
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
@@ -98,6 +189,13 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  struct proc *rqnext;         // next on its run queue, see runnable()
+  int nice;                    // -20 (most CPU) to 19, see setnice()
+  uint64 vruntime;             // time run, weighted by nice
+  uint64 runstart;             // r_time() when last accounted
+  struct proc *chnext;         // on the list of chan's hash bucket, see sleep()
+  struct proc *chprev;
+  struct proc *pidnext;        // on its pid's hash bucket, see findproc()
 
   // proc_tree_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -111,12 +209,46 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  void (*kfn)(void);           // body of a kernel thread, else 0
+  struct proc *mm;             // owner of the memory and paging state: itself, or for
+                               // a thread the process it was cloned from, see clone()
+  int tslot;                   // its trapframe's slot there, 0 for the owner's
+  int inuser;                  // running user code, see tlbstop()
 
   struct file *swapFile;
-  struct paging_meta_data data[MAX_TOTAL_PAGES];
+  int swapno;                     // its name, /.swap<swapno>
+  struct policy *policy;          // chooses the pages to swap out
+  struct policy *nextpolicy;      // to switch to, see setpolicy()
+  struct arcstate arc;            // ARC's history of p's pages
+  uint64 *meta;                   // paging metadata, see pagemeta()
   uint pagesInMemory;
-  int pages[MAX_TOTAL_PAGES];
-  int head; 
-  int tail;  
+  int maxPsycPages;               // limit on pagesInMemory
+  int head;                       // queue of resident pages: oldest, -1 if empty
+  int tail;                       // newest page
   int numOfPages;
+  int freeSlots[SWAPFILE_PAGES];  // stack of released swap-file slots
+  int numOfFreeSlots;
+  int nextSlot;                   // first slot never handed out
+  int lastFault;                  // last page brought in by swap_in()
+  int readAhead;                  // current swap-in read-ahead window
+  uint lastAging;                 // ticks at the last aging pass
+  int npinned;                    // pages pinned by uvmpin()
+  int nfaults;                    // swap_in()s since pffstamp
+  uint pffstamp;                  // ticks at the last pffupdate() pass
+  struct inode *execip;           // executable, for pages exec() did not load
+  struct execseg seg[NEXECSEG];   // its segments
+  int nseg;
+  struct vma vmas[NVMA];          // mmap() regions
+  uint64 mmapbase;                // lowest of them, where the heap must stop
+  struct madvice madv[NMADVISE];  // read-ahead advice, disjoint ranges
+  int vmdepth;                    // own paging operations under way, see vmlock()
+  int nthreads;                   // sharing this address space, this one included
+  uint tslots;                    // their trapframe slots, a bit each
+  struct proc *vmowner;           // thread in vmlock(), with more than one
+  int tlbstopped;                 // threads held in the kernel, see tlbstop()
+  int intransit;                  // reclaim() is writing some pages out
+  int swapwait;                   // in paging I/O, or waiting for it
+  struct pagestats stats;         // see getpagestats()
+  uint64 tcva[NTCACHE];           // translation cache: user page...
+  pte_t *tcpte[NTCACHE];          // ... and its leaf PTE, see tcwalk()
 };
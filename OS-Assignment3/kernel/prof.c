@@ -0,0 +1,126 @@
+// Sampling profiler.
+//
+// While profiling is on, every timer interrupt, on every CPU,
+// records where that CPU was: the pc, whether in user space, and
+// the process, in a ring of NPROF samples of its own. Only that
+// CPU writes its ring, in the interrupt handler, so no lock is
+// needed; a sample is written before the ring's head moves past
+// it. Reading /dev/prof drains the rings, whole samples only, and
+// returns 0 when they are empty; samples overwritten before being
+// read are dropped. Writing "1" to /dev/prof starts profiling, "0"
+// stops it. See user/prof.c.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "fs.h"
+#include "file.h"
+#include "pstat.h"
+#include "proc.h"
+#include "defs.h"
+#include "prof.h"
+
+int profiling;
+
+struct profring {
+  uint64 head;                // samples ever taken
+  struct profsample s[NPROF];
+} profrings[NCPU];
+
+struct {
+  struct spinlock lock;       // serializes readers
+  uint64 tail[NCPU];          // next sample to read from each ring
+} prof;
+
+// records that this CPU was at pc, in user space if user.
+// called from the timer interrupt, via usertrap() or kerneltrap().
+void
+profsample(uint64 pc, int user)
+{
+  struct profring *r;
+  struct profsample *s;
+  struct cpu *c;
+
+  push_off();
+  c = mycpu();
+  r = &profrings[cpuid()];
+  s = &r->s[r->head % NPROF];
+  s->pc = pc;
+  s->pid = c->proc ? c->proc->pid : 0;
+  s->cpu = cpuid();
+  s->user = user;
+  __sync_synchronize();
+  r->head++;
+  pop_off();
+}
+
+// copies up to max unread samples into buf.
+// prof.lock must be held.
+static int
+proftake(struct profsample *buf, int max)
+{
+  struct profring *r;
+  uint64 head;
+  int i, n = 0;
+
+  for(i = 0; i < NCPU && n < max; i++){
+    r = &profrings[i];
+    head = r->head;
+    __sync_synchronize();
+    if(head - prof.tail[i] > NPROF)
+      prof.tail[i] = head - NPROF;
+    for(; prof.tail[i] < head && n < max; prof.tail[i]++){
+      buf[n] = r->s[prof.tail[i] % NPROF];
+      __sync_synchronize();
+      // still good unless the ring has come round to it again
+      if(r->head - prof.tail[i] < NPROF)
+        n++;
+    }
+  }
+  return n;
+}
+
+int
+profread(int user_dst, uint64 dst, int n)
+{
+  struct profsample buf[16];
+  int max, got, done = 0;
+
+  while((max = (n - done) / sizeof(buf[0])) > 0){
+    if(max > NELEM(buf))
+      max = NELEM(buf);
+    acquire(&prof.lock);
+    got = proftake(buf, max);
+    release(&prof.lock);
+    if(got == 0)
+      break;
+    if(either_copyout(user_dst, dst + done, buf, got * sizeof(buf[0])) < 0)
+      return done > 0 ? done : -1;
+    done += got * sizeof(buf[0]);
+  }
+  return done;
+}
+
+int
+profwrite(int user_src, uint64 src, int n)
+{
+  char c;
+
+  if(n < 1 || either_copyin(&c, user_src, src, 1) < 0)
+    return -1;
+  if(c == '0' || c == '1')
+    profiling = c - '0';
+  else
+    return -1;
+  return n;
+}
+
+void
+profinit(void)
+{
+  initlock(&prof.lock, "prof");
+  devsw[PROF].read = profread;
+  devsw[PROF].write = profwrite;
+}
@@ -0,0 +1,7 @@
+// a profiler sample, as read from /dev/prof, see prof.c.
+struct profsample {
+  uint64 pc;      // sepc at the timer interrupt
+  int pid;        // process running, 0 if none
+  ushort cpu;
+  ushort user;    // 1 if pc is a user address
+};
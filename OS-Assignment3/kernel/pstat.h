@@ -0,0 +1,13 @@
+// paging counters of a process, see getpagestats().
+// times are in cycles of the time CSR (10 MHz in qemu).
+struct pagestats {
+  uint64 faults;     // page faults, the kernel's in copyin() &c too
+  uint64 majfaults;  // ... that read the page in, see swap_in()
+  uint64 swapins;    // pages read in from swap
+  uint64 swapouts;   // pages written to swap
+  uint64 drops;      // clean pages evicted without a write
+  uint64 rbytes;     // bytes read from swap
+  uint64 wbytes;     // bytes written to swap
+  uint64 intime;     // in swap_in(), evictions it made room with included
+  uint64 outtime;    // evicting pages
+};
@@ -40,6 +40,7 @@ w_mepc(uint64 x)
 
 // Supervisor Status Register, sstatus
 
+#define SSTATUS_VS (3L << 9)   // Vector unit state, 0=Off
 #define SSTATUS_SPP (1L << 8)  // Previous mode, 1=Supervisor, 0=User
 #define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
@@ -248,7 +249,8 @@ r_mcounteren()
   return x;
 }
 
-// machine-mode cycle counter
+// cycles of the CLINT's timer; readable in supervisor mode
+// once timerinit() has set mcounteren.
 static inline uint64
 r_time()
 {
@@ -271,6 +273,14 @@ intr_off()
   w_sstatus(r_sstatus() & ~SSTATUS_SIE);
 }
 
+// wait, without spinning, until an interrupt is pending.
+// one is noticed even while they are disabled.
+static inline void
+wfi()
+{
+  asm volatile("wfi");
+}
+
 // are device interrupts enabled?
 static inline int
 intr_get()
@@ -322,6 +332,7 @@ sfence_vma()
 
 #define PGSIZE 4096 // bytes per page
 #define PGSHIFT 12  // bits of offset within a page
+#define MEGAPGSIZE (512*PGSIZE) // bytes per megapage, a level-1 leaf
 
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
@@ -331,7 +342,9 @@ sfence_vma()
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // 1 -> user can access
-#define PTE_A (1L << 6)
+#define PTE_A (1L << 6) // accessed
+#define PTE_D (1L << 7) // dirty: written since mapped
+#define PTE_COW (1L << 8) // shared copy-on-write after fork
 #define PTE_PG (1L << 9)
 
 // shift a physical address to the right place for a PTE.
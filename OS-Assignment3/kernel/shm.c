@@ -0,0 +1,129 @@
+//
+// Shared memory segments, behind MAP_SHARED | MAP_ANON mappings.
+//
+// A segment holds the frames of its pages, allocated as they are
+// first touched by any process mapping it, and a reference to each.
+// A process maps a frame with a reference of its own (see kdup()),
+// which uvmunmap() drops like any other. fork() shares the frames
+// with the child, writable, instead of copying them; a segment dies
+// with the last mapping of it.
+//
+// The pages are not paged with those of the processes that map
+// them: each process's policy would pick them and swap them out on
+// its own, leaving the others with a copy that no longer is shared.
+// They stay resident and outside every process's limit instead.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "defs.h"
+
+struct shm {
+  int ref;                // mappings of it, 0 if the slot is free
+  int npages;
+  char **pages;           // a page of frames, 0 until touched
+};
+
+struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+} shmtable;
+
+void
+shminit(void)
+{
+  initlock(&shmtable.lock, "shm");
+}
+
+// A new segment of npages zero pages, or 0.
+struct shm*
+shmalloc(int npages)
+{
+  struct shm *s;
+  char **pages;
+
+  if(npages < 1 || npages > SHMPAGES)
+    return 0;
+  if((pages = kalloc_zeroed()) == 0)
+    return 0;
+  acquire(&shmtable.lock);
+  for(s = shmtable.shm; s < &shmtable.shm[NSHM]; s++){
+    if(s->ref == 0){
+      s->ref = 1;
+      s->npages = npages;
+      s->pages = pages;
+      release(&shmtable.lock);
+      return s;
+    }
+  }
+  release(&shmtable.lock);
+  kfree(pages);
+  return 0;
+}
+
+// Another mapping of s.
+struct shm*
+shmdup(struct shm *s)
+{
+  acquire(&shmtable.lock);
+  if(s->ref < 1)
+    panic("shmdup");
+  s->ref++;
+  release(&shmtable.lock);
+  return s;
+}
+
+// Drop a mapping of s; the last one frees the segment and
+// the frames no process maps any more.
+void
+shmfree(struct shm *s)
+{
+  char **pages;
+
+  acquire(&shmtable.lock);
+  if(s->ref < 1)
+    panic("shmfree");
+  if(--s->ref > 0){
+    release(&shmtable.lock);
+    return;
+  }
+  pages = s->pages;
+  s->pages = 0;
+  release(&shmtable.lock);
+
+  for(int i = 0; i < s->npages; i++)
+    if(pages[i])
+      kfree(pages[i]);
+  kfree(pages);
+}
+
+// The frame of page i of s, allocated if no process has touched
+// it yet, with a reference for the caller. 0 if out of memory.
+char*
+shmpage(struct shm *s, int i)
+{
+  char *mem = 0, *pa;
+
+  if(i < 0 || i >= s->npages)
+    panic("shmpage");
+  acquire(&shmtable.lock);
+  if(s->pages[i] == 0){
+    release(&shmtable.lock);
+    if((mem = kalloc_zeroed()) == 0)
+      return 0;
+    acquire(&shmtable.lock);
+    // another process may have been first
+    if(s->pages[i] == 0){
+      s->pages[i] = mem;
+      mem = 0;
+    }
+  }
+  pa = s->pages[i];
+  kdup(pa);
+  release(&shmtable.lock);
+  if(mem)
+    kfree(mem);
+  return pa;
+}
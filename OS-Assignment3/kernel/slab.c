@@ -0,0 +1,182 @@
+// Slab allocator for small kernel objects.
+//
+// A cache hands out objects of one size. It carves them out of
+// slabs, whole pages from kalloc() that start with a struct slab
+// and keep their free objects on a list; an object's slab is the
+// page it lies in. Slabs that still have free objects are on the
+// cache's list; a slab whose objects all come back is given back
+// to kalloc(), unless it is the last one on the list.
+//
+// In front of the slabs each CPU has a magazine of up to MAGSIZE
+// free objects, used with interrupts off instead of a lock. Taking
+// from an empty magazine fills it half way from the slabs, putting
+// into a full one empties it half way, so a CPU that allocates and
+// frees in turn seldom takes the cache's lock.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "slab.h"
+#include "defs.h"
+
+struct slab {
+  struct kcache *cache;
+  struct slab *next;          // on the cache's list, while
+  struct slab *prev;          // it has free objects
+  struct obj *free;
+  int inuse;
+};
+
+struct obj {
+  struct obj *next;
+};
+
+#define SLABHDR ((sizeof(struct slab) + 15) & ~15)
+
+struct kcache *caches;        // made at boot, never freed
+
+void
+kcacheinit(struct kcache *c, char *name, uint size)
+{
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = (size + 15) & ~15;
+  c->perslab = (PGSIZE - SLABHDR) / c->size;
+  if(c->perslab < 2)
+    panic("kcacheinit: use kalloc()");
+  c->slabs = 0;
+  c->nslabs = 0;
+  c->nout = 0;
+  memset(c->mags, 0, sizeof(c->mags));
+  c->next = caches;
+  caches = c;
+}
+
+static void
+slablink(struct kcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->slabs;
+  if(s->next)
+    s->next->prev = s;
+  c->slabs = s;
+}
+
+static void
+slabunlink(struct kcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->slabs = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// an object from c's slabs, a new one if they are full, or 0.
+// c->lock must be held.
+static void*
+slaballoc(struct kcache *c)
+{
+  struct slab *s;
+  struct obj *o;
+
+  if((s = c->slabs) == 0){
+    if((s = kalloc()) == 0)
+      return 0;
+    s->cache = c;
+    s->inuse = 0;
+    s->free = 0;
+    for(int i = c->perslab - 1; i >= 0; i--){
+      o = (struct obj*)((char*)s + SLABHDR + i * c->size);
+      o->next = s->free;
+      s->free = o;
+    }
+    slablink(c, s);
+    c->nslabs++;
+  }
+  o = s->free;
+  s->free = o->next;
+  s->inuse++;
+  if(s->free == 0)
+    slabunlink(c, s);
+  c->nout++;
+  return o;
+}
+
+// back to its slab. c->lock must be held.
+static void
+slabfree(struct kcache *c, void *obj)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint64)obj);
+  struct obj *o = obj;
+
+  if(s->cache != c || s->inuse < 1)
+    panic("kcachefree");
+  if(s->free == 0)
+    slablink(c, s);   // full until now
+  o->next = s->free;
+  s->free = o;
+  s->inuse--;
+  c->nout--;
+  if(s->inuse == 0 && (s->next || s->prev)){
+    slabunlink(c, s);
+    c->nslabs--;
+    kfree(s);
+  }
+}
+
+// An object of c, or 0 if out of memory. Its contents are
+// whatever the last user left.
+void*
+kcachealloc(struct kcache *c)
+{
+  struct magazine *m;
+  void *o;
+
+  push_off();
+  m = &c->mags[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    while(m->n < MAGSIZE / 2 && (o = slaballoc(c)) != 0)
+      m->objs[m->n++] = o;
+    release(&c->lock);
+  }
+  o = m->n > 0 ? m->objs[--m->n] : 0;
+  pop_off();
+  return o;
+}
+
+void
+kcachefree(struct kcache *c, void *o)
+{
+  struct magazine *m;
+
+  push_off();
+  m = &c->mags[cpuid()];
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    while(m->n > MAGSIZE / 2)
+      slabfree(c, m->objs[--m->n]);
+    release(&c->lock);
+  }
+  m->objs[m->n++] = o;
+  pop_off();
+}
+
+// Print each cache's use to the console, with kallocdump().
+void
+kcachedump(void)
+{
+  struct kcache *c;
+  int cached;
+
+  for(c = caches; c; c = c->next){
+    cached = 0;
+    for(int i = 0; i < NCPU; i++)
+      cached += c->mags[i].n;
+    printf("cache %s: %d bytes, %d slabs, %d in use, %d in magazines\n",
+           c->name, c->size, c->nslabs, c->nout - cached, cached);
+  }
+}
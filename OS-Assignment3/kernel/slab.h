@@ -0,0 +1,20 @@
+// A cache of equal-sized small kernel objects, see slab.c.
+
+#define MAGSIZE 16   // objects a CPU keeps at hand in its magazine
+
+struct magazine {
+  int n;
+  void *objs[MAGSIZE];
+};
+
+struct kcache {
+  struct spinlock lock;       // protects the slabs and counts
+  char *name;
+  uint size;                  // bytes per object, rounded up
+  uint perslab;               // objects per slab page
+  struct slab *slabs;         // those with free objects
+  int nslabs;
+  int nout;                   // objects out of the slabs
+  struct kcache *next;        // all caches, for kcachedump()
+  struct magazine mags[NCPU]; // each CPU's, with interrupts off
+};
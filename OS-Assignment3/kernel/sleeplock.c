@@ -6,6 +6,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "pstat.h"
 #include "proc.h"
 #include "sleeplock.h"
 
@@ -16,17 +17,36 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+#if LOCKSTAT
+  lk->stat = lockstatof(name, 1);
+#endif
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+#if LOCKSTAT
+  if(lk->locked && lk->stat){
+    uint64 t0 = r_time();
+    while (lk->locked) {
+      sleep(lk, &lk->lk);
+    }
+    __sync_fetch_and_add(&lk->stat->ncontended, 1);
+    __sync_fetch_and_add(&lk->stat->wait, r_time() - t0);
+  }
+#endif
   while (lk->locked) {
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+#if LOCKSTAT
+  if(lk->stat){
+    __sync_fetch_and_add(&lk->stat->nacquire, 1);
+    lk->since = r_time();
+  }
+#endif
   release(&lk->lk);
 }
 
@@ -34,6 +54,10 @@ void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+#if LOCKSTAT
+  if(lk->stat)
+    lockstathold(lk->stat, r_time() - lk->since);
+#endif
   lk->locked = 0;
   lk->pid = 0;
   wakeup(lk);
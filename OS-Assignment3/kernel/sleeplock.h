@@ -6,5 +6,9 @@ struct sleeplock {
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+#if LOCKSTAT
+  struct lockstat *stat;
+  uint64 since;
+#endif
 };
 
@@ -1,19 +1,79 @@
 // Mutual exclusion spin locks.
+//
+// How a cpu waits for a lock is chosen with SPINLOCK. TAS swaps
+// 1 into the lock word until it gets a 0: every waiter keeps
+// taking the word's cache line away from the others, and whoever
+// is lucky when it is released gets it. TTAS only reads the word
+// until it looks free before swapping, and waits longer and longer
+// between tries. TICKET takes the next ticket with one atomic add
+// and reads until the owner's ticket is its own: waiters share the
+// line read-only, and get the lock in the order they came.
 
 #include "types.h"
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "pstat.h"
 #include "proc.h"
 #include "defs.h"
 
+#define MAXBACKOFF 1024     // loops TTAS waits between tries, at most
+
+#if LOCKSTAT
+static struct lockstat lockstats[NLOCKSTAT];
+static uint lockstatbusy;   // guards lockstats' names, like a spinlock's locked
+#endif
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->next = 0;
+  lk->owner = 0;
+#if LOCKSTAT
+  lk->stat = lockstatof(name, 0);
+#endif
+}
+
+// Waits for lk and takes it. Returns the atomic read-modify-writes
+// of its words it took, negated if it had to wait.
+static int
+spin(struct spinlock *lk)
+{
+  int n = 1, wait = 0;
+
+#if SPINLOCK == TICKET
+  uint t = __sync_fetch_and_add(&lk->next, 1);
+  while(__atomic_load_n(&lk->owner, __ATOMIC_ACQUIRE) != t)
+    wait = 1;
+  lk->locked = 1;
+#elif SPINLOCK == TTAS
+  int delay = 1;
+
+  while(__sync_lock_test_and_set(&lk->locked, 1) != 0){
+    wait = 1;
+    do {
+      for(volatile int i = 0; i < delay; i++)
+        ;
+      if(delay < MAXBACKOFF)
+        delay *= 2;
+    } while(__atomic_load_n(&lk->locked, __ATOMIC_RELAXED) != 0);
+    n++;
+  }
+#else
+  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
+  //   a5 = 1
+  //   s1 = &lk->locked
+  //   amoswap.w.aq a5, a5, (s1)
+  while(__sync_lock_test_and_set(&lk->locked, 1) != 0){
+    wait = 1;
+    n++;
+  }
+#endif
+  return wait ? -n : n;
 }
 
 // Acquire the lock.
@@ -25,12 +85,20 @@ acquire(struct spinlock *lk)
   if(holding(lk))
     panic("acquire");
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-  //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+#if LOCKSTAT
+  uint64 t0 = r_time();
+  int n = spin(lk);
+  if(lk->stat){
+    if(n < 0){
+      n = -n;
+      __sync_fetch_and_add(&lk->stat->ncontended, 1);
+      __sync_fetch_and_add(&lk->stat->wait, r_time() - t0);
+    }
+    __sync_fetch_and_add(&lk->stat->natomic, n);
+  }
+#else
+  spin(lk);
+#endif
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +108,12 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+#if LOCKSTAT
+  if(lk->stat){
+    __sync_fetch_and_add(&lk->stat->nacquire, 1);
+    lk->since = r_time();
+  }
+#endif
 }
 
 // Release the lock.
@@ -49,6 +123,10 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+#if LOCKSTAT
+  if(lk->stat)
+    lockstathold(lk->stat, r_time() - lk->since);
+#endif
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -59,6 +137,11 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
+#if SPINLOCK == TICKET
+  // Only the holder writes owner: a store serves the next ticket.
+  lk->locked = 0;
+  __atomic_store_n(&lk->owner, lk->owner + 1, __ATOMIC_RELEASE);
+#else
   // Release the lock, equivalent to lk->locked = 0.
   // This code doesn't use a C assignment, since the C standard
   // implies that an assignment might be implemented with
@@ -67,6 +150,7 @@ release(struct spinlock *lk)
   //   s1 = &lk->locked
   //   amoswap.w zero, zero, (s1)
   __sync_lock_release(&lk->locked);
+#endif
 
   pop_off();
 }
@@ -108,3 +192,68 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+#if LOCKSTAT
+// The statistics of the spin (or sleep) locks called name, or 0
+// if there is no room for another name. Can't use a spinlock,
+// which would call it from initlock().
+struct lockstat*
+lockstatof(char *name, int sleep)
+{
+  struct lockstat *s;
+
+  push_off();
+  while(__sync_lock_test_and_set(&lockstatbusy, 1) != 0)
+    ;
+  __sync_synchronize();
+  for(s = lockstats; s < &lockstats[NLOCKSTAT]; s++){
+    if(s->name == 0){
+      s->name = name;
+      s->sleep = sleep;
+      break;
+    }
+    if(s->sleep == sleep && strncmp(s->name, name, 32) == 0)
+      break;
+  }
+  __sync_synchronize();
+  __sync_lock_release(&lockstatbusy);
+  pop_off();
+  return s < &lockstats[NLOCKSTAT] ? s : 0;
+}
+
+// A lock of s was held for t cycles.
+void
+lockstathold(struct lockstat *s, uint64 t)
+{
+  uint64 max;
+
+  while(t > (max = s->maxhold))
+    if(__sync_bool_compare_and_swap(&s->maxhold, max, t))
+      break;
+}
+
+// Print the locks' statistics to the console, most contended
+// first. Runs on ^P, with procdump().
+void
+lockstatdump(void)
+{
+  struct lockstat *sorted[NLOCKSTAT], *s;
+  int i, n = 0;
+
+  for(s = lockstats; s < &lockstats[NLOCKSTAT]; s++){
+    if(s->name == 0 || s->nacquire == 0)
+      continue;
+    for(i = n++; i > 0 && sorted[i-1]->ncontended < s->ncontended; i--)
+      sorted[i] = sorted[i-1];
+    sorted[i] = s;
+  }
+  for(i = 0; i < n; i++){
+    s = sorted[i];
+    // scaled: in cycles the counts would pass 2^31 within minutes
+    printf("%s%s: acquired %d contended %d atomics %d wait %d ms maxhold %d us\n",
+           s->name, s->sleep ? " (sleep)" : "", (int)s->nacquire,
+           (int)s->ncontended, (int)s->natomic,
+           (int)(s->wait / (CLINT_HZ / 1000)), (int)(s->maxhold / (CLINT_HZ / 1000000)));
+  }
+}
+#endif
@@ -5,5 +5,26 @@ struct spinlock {
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // SPINLOCK=TICKET hands the lock out in turn:
+  uint next;         // ticket of the next cpu to come
+  uint owner;        // ticket of the cpu it is the turn of
+#if LOCKSTAT
+  struct lockstat *stat; // of all the locks with this name, or 0
+  uint64 since;      // r_time() when it was acquired
+#endif
 };
 
+#if LOCKSTAT
+// Contention statistics, kept per lock name when LOCKSTAT=1,
+// see lockstatdump(). Times are in r_time() cycles.
+struct lockstat {
+  char *name;
+  int sleep;         // of sleep locks, else of spinlocks
+  uint64 nacquire;
+  uint64 ncontended; // acquisitions that spun, or slept
+  uint64 natomic;    // atomic read-modify-writes of lock words
+  uint64 wait;       // total cycles spent spinning, or asleep
+  uint64 maxhold;    // longest a lock was held
+};
+#endif
@@ -1,11 +1,35 @@
 #include "types.h"
+#include "riscv.h"
+#include "defs.h"
+
+// memset() and memmove() go a word at a time, eight in a row while
+// there are that many, once the destination is word aligned (and,
+// for memmove(), the source is aligned the same way); bytes only
+// at the edges. pagezero() and pagecopy() are for whole pages.
 
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
+  uint64 w, *wdst;
+  uint i = 0;
+
+  if(n >= 16){
+    for(; ((uint64)(cdst + i) & 7) != 0; i++)
+      cdst[i] = c;
+    w = (uchar)c;
+    w |= w << 8;
+    w |= w << 16;
+    w |= w << 32;
+    wdst = (uint64*)(cdst + i);
+    for(; i + 64 <= n; i += 64, wdst += 8){
+      wdst[0] = w; wdst[1] = w; wdst[2] = w; wdst[3] = w;
+      wdst[4] = w; wdst[5] = w; wdst[6] = w; wdst[7] = w;
+    }
+    for(; i + 8 <= n; i += 8)
+      *wdst++ = w;
+  }
+  for(; i < n; i++){
     cdst[i] = c;
   }
   return dst;
@@ -38,15 +62,95 @@ memmove(void *dst, const void *src, uint n)
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(n >= 16 && (((uint64)s ^ (uint64)d) & 7) == 0){
+      for(; ((uint64)d & 7) != 0; n--)
+        *--d = *--s;
+      for(; n >= 8; n -= 8){
+        d -= 8;
+        s -= 8;
+        *(uint64*)d = *(const uint64*)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(n >= 16 && (((uint64)s ^ (uint64)d) & 7) == 0){
+      for(; ((uint64)d & 7) != 0; n--)
+        *d++ = *s++;
+      for(; n >= 64; n -= 64, d += 64, s += 64){
+        uint64 *wd = (uint64*)d;
+        const uint64 *ws = (const uint64*)s;
+        wd[0] = ws[0]; wd[1] = ws[1]; wd[2] = ws[2]; wd[3] = ws[3];
+        wd[4] = ws[4]; wd[5] = ws[5]; wd[6] = ws[6]; wd[7] = ws[7];
+      }
+      for(; n >= 8; n -= 8, d += 8, s += 8)
+        *(uint64*)d = *(const uint64*)s;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
 
+#ifdef __riscv_vector
+// copies the page s to d, or zeroes d if s is 0, with the vector
+// unit. it is only on while this runs, with interrupts off, so no
+// process or kernel thread ever has vector state to be saved.
+static void
+vpage(char *d, const char *s)
+{
+  uint64 vl;
+
+  push_off();
+  w_sstatus(r_sstatus() | SSTATUS_VS);
+  for(uint64 n = PGSIZE; n > 0; n -= vl, d += vl){
+    asm volatile("vsetvli %0, %1, e8, m8, ta, ma" : "=r" (vl) : "r" (n));
+    if(s){
+      asm volatile("vle8.v v0, (%0)" : : "r" (s) : "memory");
+      s += vl;
+    } else
+      asm volatile("vmv.v.i v0, 0");
+    asm volatile("vse8.v v0, (%0)" : : "r" (d) : "memory");
+  }
+  w_sstatus(r_sstatus() & ~SSTATUS_VS);
+  pop_off();
+}
+#endif
+
+// Zero the page-aligned page at pa.
+void
+pagezero(void *pa)
+{
+#ifdef __riscv_vector
+  vpage(pa, 0);
+#else
+  uint64 *w = (uint64*)pa;
+
+  for(int i = 0; i < PGSIZE / sizeof(uint64); i += 8){
+    w[i+0] = 0; w[i+1] = 0; w[i+2] = 0; w[i+3] = 0;
+    w[i+4] = 0; w[i+5] = 0; w[i+6] = 0; w[i+7] = 0;
+  }
+#endif
+}
+
+// Copy the page-aligned page at src to dst.
+void
+pagecopy(void *dst, const void *src)
+{
+#ifdef __riscv_vector
+  vpage(dst, src);
+#else
+  uint64 *d = (uint64*)dst;
+  const uint64 *s = (const uint64*)src;
+
+  for(int i = 0; i < PGSIZE / sizeof(uint64); i += 8){
+    d[i+0] = s[i+0]; d[i+1] = s[i+1]; d[i+2] = s[i+2]; d[i+3] = s[i+3];
+    d[i+4] = s[i+4]; d[i+5] = s[i+5]; d[i+6] = s[i+6]; d[i+7] = s[i+7];
+  }
+#endif
+}
+
 // memcpy exists to placate GCC.  Use memmove.
 void*
 memcpy(void *dst, const void *src, uint n)
@@ -0,0 +1,135 @@
+// Raw swap area.
+//
+// mkfs -s n reserves n disk blocks right after the file system and
+// records them in the superblock (swapstart, nswap). When the disk
+// has such an area, pages are swapped straight to its blocks with
+// virtio_disk_rwblocks() instead of through a per-process /.swapN
+// file, so a page-out pays neither for the log (which writes every
+// block twice) nor for the inode and bmap() work. Swap contents
+// need no crash consistency: they die with their processes.
+//
+// The area is divided into page-sized slots, handed out by one
+// system-wide allocator: a stack of released slots plus a
+// high-water mark, like the per-process one in vm.c. Slots are
+// reference counted so that fork() can share a parent's swapped
+// pages with the child instead of copying them.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "defs.h"
+
+#define BPP (PGSIZE / BSIZE)  // disk blocks per page
+
+struct {
+  struct spinlock lock;
+  uint start;             // first block of the swap area
+  int nslots;             // 0 if the disk has no swap area
+  int next;               // first slot never handed out
+  int nfree;
+  int free[NSWAPSLOTS];   // stack of released slots
+  int ref[NSWAPSLOTS];    // processes holding each slot
+} swapdev;
+
+void
+swapinit(struct superblock *sb)
+{
+  initlock(&swapdev.lock, "swapdev");
+  swapdev.start = sb->swapstart;
+  swapdev.nslots = sb->nswap / BPP;
+  if(swapdev.nslots > NSWAPSLOTS)
+    swapdev.nslots = NSWAPSLOTS;
+  swapdev.next = 0;
+  swapdev.nfree = 0;
+}
+
+// Does the disk have a raw swap area to page to?
+int
+swapdevice(void)
+{
+  return swapdev.nslots > 0;
+}
+
+// Returns the offset of a free slot in the swap area,
+// or -1 if it is full.
+uint
+swapalloc(void)
+{
+  uint off = -1;
+
+  acquire(&swapdev.lock);
+  if(swapdev.nfree > 0)
+    off = swapdev.free[--swapdev.nfree] * PGSIZE;
+  else if(swapdev.next < swapdev.nslots)
+    off = swapdev.next++ * PGSIZE;
+  if(off != -1)
+    swapdev.ref[off / PGSIZE] = 1;
+  release(&swapdev.lock);
+  return off;
+}
+
+// Returns the offset of the first of n consecutive free slots,
+// or -1 if there is no such run past the high-water mark.
+uint
+swapallocrun(int n)
+{
+  uint off = -1;
+
+  acquire(&swapdev.lock);
+  if(swapdev.next + n <= swapdev.nslots){
+    off = swapdev.next * PGSIZE;
+    for(int i = 0; i < n; i++)
+      swapdev.ref[swapdev.next + i] = 1;
+    swapdev.next += n;
+  }
+  release(&swapdev.lock);
+  return off;
+}
+
+// Drop a reference to the slot at offset off; the last
+// one puts it back on the free stack.
+void
+swapfree(uint off)
+{
+  acquire(&swapdev.lock);
+  if(off % PGSIZE != 0 || off / PGSIZE >= swapdev.next || swapdev.ref[off / PGSIZE] < 1)
+    panic("swapfree");
+  if(--swapdev.ref[off / PGSIZE] == 0)
+    swapdev.free[swapdev.nfree++] = off / PGSIZE;
+  release(&swapdev.lock);
+}
+
+// Add a reference to the slot at offset off.
+void
+swapdup(uint off)
+{
+  acquire(&swapdev.lock);
+  if(off % PGSIZE != 0 || off / PGSIZE >= swapdev.next || swapdev.ref[off / PGSIZE] < 1)
+    panic("swapdup");
+  swapdev.ref[off / PGSIZE]++;
+  release(&swapdev.lock);
+}
+
+// Read or write the n pages at pages[i] from/to the slots at
+// offsets offs[i], with the disk working on all of them at once.
+void
+swaprwv(char **pages, uint *offs, int n, int write)
+{
+  uint blockno[SWAP_READAHEAD + SWAP_BATCH + 1];
+
+  if(n > NELEM(blockno))
+    panic("swaprwv");
+  for(int i = 0; i < n; i++)
+    blockno[i] = swapdev.start + (offs[i] / PGSIZE) * BPP;
+  virtio_disk_rwblocksv(blockno, pages, n, BPP, write);
+}
+
+// Read or write the page at kernel address page from/to the
+// slot at offset off.
+void
+swaprw(char *page, uint off, int write)
+{
+  virtio_disk_rwblocks(swapdev.start + (off / PGSIZE) * BPP, page, BPP, write);
+}
@@ -3,6 +3,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "pstat.h"
 #include "proc.h"
 #include "syscall.h"
 #include "defs.h"
@@ -11,7 +12,7 @@
 int
 fetchaddr(uint64 addr, uint64 *ip)
 {
-  struct proc *p = myproc();
+  struct proc *p = myspace();
   if(addr >= p->sz || addr+sizeof(uint64) > p->sz)
     return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
@@ -85,6 +86,13 @@ argstr(int n, char *buf, int max)
 
 extern uint64 sys_chdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_setpolicy(void);
+extern uint64 sys_getpagestats(void);
+extern uint64 sys_nanotime(void);
+extern uint64 sys_setnice(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
 extern uint64 sys_dup(void);
 extern uint64 sys_exec(void);
 extern uint64 sys_exit(void);
@@ -104,6 +112,12 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_wait(void);
 extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
+extern uint64 sys_ioring_enter(void);
+extern uint64 sys_madvise(void);
+extern uint64 sys_mlock(void);
+extern uint64 sys_munlock(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_kbench(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -127,8 +141,42 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_fsync]   sys_fsync,
+[SYS_setpolicy] sys_setpolicy,
+[SYS_getpagestats] sys_getpagestats,
+[SYS_nanotime] sys_nanotime,
+[SYS_setnice] sys_setnice,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_ioring_enter] sys_ioring_enter,
+[SYS_madvise] sys_madvise,
+[SYS_mlock]   sys_mlock,
+[SYS_munlock] sys_munlock,
+[SYS_clone]   sys_clone,
+[SYS_kbench]  sys_kbench,
 };
 
+// Run system call num with the arguments args[0..2], as if the
+// process had made it, for ioring_enter(): the sys_* functions
+// take their arguments from the trapframe.
+uint64
+syscallv(int num, uint64 *args)
+{
+  struct trapframe *tf = myproc()->trapframe;
+  uint64 a0 = tf->a0, a1 = tf->a1, a2 = tf->a2, r;
+
+  if(num <= 0 || num >= NELEM(syscalls) || syscalls[num] == 0)
+    return -1;
+  tf->a0 = args[0];
+  tf->a1 = args[1];
+  tf->a2 = args[2];
+  r = syscalls[num]();
+  tf->a0 = a0;
+  tf->a1 = a1;
+  tf->a2 = a2;
+  return r;
+}
+
 void
 syscall(void)
 {
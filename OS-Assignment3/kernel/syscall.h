@@ -20,3 +20,16 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_fsync  22
+#define SYS_setpolicy 23
+#define SYS_getpagestats 24
+#define SYS_nanotime 25
+#define SYS_setnice 26
+#define SYS_mmap   27
+#define SYS_munmap 28
+#define SYS_ioring_enter 29
+#define SYS_madvise 30
+#define SYS_mlock  31
+#define SYS_munlock 32
+#define SYS_clone  33
+#define SYS_kbench 34
@@ -10,11 +10,14 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "pstat.h"
 #include "proc.h"
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "syscall.h"
+#include "ioring.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -104,6 +107,19 @@ sys_close(void)
   return 0;
 }
 
+// Wait until the writes made so far are on disk. The log
+// commits all files at once, so fd only has to be valid.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  log_sync();
+  return 0;
+}
+
 uint64
 sys_fstat(void)
 {
@@ -185,7 +201,6 @@ uint64
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], path[MAXPATH];
   uint off;
 
@@ -215,9 +230,7 @@ sys_unlink(void)
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, name, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -484,3 +497,96 @@ sys_pipe(void)
   }
   return 0;
 }
+
+uint64
+sys_mmap(void)
+{
+  uint64 addr, len;
+  int prot, flags, off;
+  struct file *f = 0;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(5, &off) < 0 || off < 0)
+    return -1;
+  if((flags & MAP_ANON) == 0 && argfd(4, 0, &f) < 0)
+    return -1;
+  return mmap(addr, len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+// the calls an ioring may queue: those that only touch files.
+static int
+ioringop(int op)
+{
+  switch(op){
+  case SYS_read: case SYS_write: case SYS_open: case SYS_close:
+  case SYS_fstat: case SYS_dup: case SYS_link: case SYS_unlink:
+  case SYS_mkdir: case SYS_mknod: case SYS_fsync:
+    return 1;
+  }
+  return 0;
+}
+
+// Runs up to n of the calls queued in the ioring at user address
+// addr, in order, with one trap for all of them: see ioring.h.
+// Stops early if the completion queue fills up. Returns how many
+// it ran, or -1 if the ring can't be read. A ring that can't
+// be read or written past some entry ends the batch there, before
+// running it. Each call run has a completion posted, though one
+// whose slot can't be written again afterwards reads as -1.
+uint64
+sys_ioring_enter(void)
+{
+  struct proc *p = myproc();
+  struct ioring *r;
+  uint64 addr;
+  uint idx[4];   // sqhead, sqtail, cqhead, cqtail, as in struct ioring
+  struct sqe e;
+  struct cqe c;
+  int i, n, lastfd = -1;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  r = (struct ioring*)addr;  // only for addresses in the user's ring
+  if(copyin(p->pagetable, (char*)idx, addr, sizeof(idx)) < 0)
+    return -1;
+  for(i = 0; i < n && idx[0] != idx[1] && idx[3] - idx[2] < IORING_SIZE; i++){
+    if(p->killed)
+      break;
+    if(copyin(p->pagetable, (char*)&e, (uint64)&r->sq[idx[0] % IORING_SIZE], sizeof(e)) < 0)
+      break;
+    // a call that runs must get its completion, so its slot is
+    // written before it runs, failing as if it couldn't.
+    c.user = e.user;
+    c.res = -1;
+    c.pad = 0;
+    if(copyout(p->pagetable, (uint64)&r->cq[idx[3] % IORING_SIZE], (char*)&c, sizeof(c)) < 0)
+      break;
+    idx[0]++;
+    if((e.flags & IOSQE_LASTFD) && lastfd < 0)
+      c.res = -1;
+    else if(ioringop(e.op)){
+      if(e.flags & IOSQE_LASTFD)
+        e.arg[0] = lastfd;
+      c.res = syscallv(e.op, e.arg);
+    } else
+      c.res = -1;
+    if(e.op == SYS_open || e.op == SYS_dup)
+      lastfd = c.res;
+    copyout(p->pagetable, (uint64)&r->cq[idx[3] % IORING_SIZE], (char*)&c, sizeof(c));
+    idx[3]++;
+  }
+  if(copyout(p->pagetable, (uint64)&r->sqhead, (char*)&idx[0], sizeof(idx[0])) < 0 ||
+     copyout(p->pagetable, (uint64)&r->cqtail, (char*)&idx[3], sizeof(idx[3])) < 0)
+    return -1;
+  return i;
+}
@@ -5,6 +5,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "pstat.h"
 #include "proc.h"
 
 uint64
@@ -29,6 +30,17 @@ sys_fork(void)
   return fork();
 }
 
+// a thread of the caller running fn(arg) on stack
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
 uint64
 sys_wait(void)
 {
@@ -41,12 +53,29 @@ sys_wait(void)
 uint64
 sys_sbrk(void)
 {
-  int addr;
+  uint64 addr;
   int n;
+  struct proc *p = myspace();
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
+  addr = p->sz;
+  #if LAZY
+    // only grow the size; the pages are allocated as they
+    // are first touched (see uvmlazy()). the mmap() regions
+    // and the threads' trapframes are above mmapbase.
+    if(n > 0){
+      vmlock(p);
+      addr = p->sz;
+      if(addr + n > p->mmapbase){
+        vmunlock(p);
+        return -1;
+      }
+      p->sz = addr + n;
+      vmunlock(p);
+      return addr;
+    }
+  #endif
   if(growproc(n) < 0)
     return -1;
   return addr;
@@ -83,6 +112,92 @@ sys_kill(void)
   return kill(pid);
 }
 
+// page-replacement policy for a process, or for all if pid is 0
+uint64
+sys_setpolicy(void)
+{
+  int pid, n;
+
+  if(argint(0, &pid) < 0 || argint(1, &n) < 0)
+    return -1;
+  return setpolicy(pid, n);
+}
+
+// advice on how a range of the caller's pages will be used
+uint64
+sys_madvise(void)
+{
+  uint64 addr, len;
+  int advice;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0 || argint(2, &advice) < 0)
+    return -1;
+  return uvmadvise(addr, len, advice);
+}
+
+uint64
+sys_mlock(void)
+{
+  uint64 addr, len;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0)
+    return -1;
+  return uvmlock(addr, len, 1);
+}
+
+uint64
+sys_munlock(void)
+{
+  uint64 addr, len;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0)
+    return -1;
+  return uvmlock(addr, len, 0);
+}
+
+// nice value of a process, the caller's if pid is 0
+uint64
+sys_setnice(void)
+{
+  int pid, n;
+
+  if(argint(0, &pid) < 0 || argint(1, &n) < 0)
+    return -1;
+  return setnice(pid, n);
+}
+
+// paging counters of a process, the caller's if pid is 0
+uint64
+sys_getpagestats(void)
+{
+  int pid;
+  uint64 st; // user pointer to struct pagestats
+
+  if(argint(0, &pid) < 0 || argaddr(1, &st) < 0)
+    return -1;
+  return getpagestats(pid, st);
+}
+
+uint64
+sys_kbench(void)
+{
+  int kind, n;
+  uint64 buf, len, r; // user pointers: the pages to use, struct kbench
+
+  if(argint(0, &kind) < 0 || argint(1, &n) < 0 || argaddr(2, &buf) < 0 ||
+     argaddr(3, &len) < 0 || argaddr(4, &r) < 0)
+    return -1;
+  return kbench(kind, n, buf, len, r);
+}
+
+// nanoseconds since boot, from the time CSR. much finer than
+// uptime(), for timing short operations.
+uint64
+sys_nanotime(void)
+{
+  return r_time() * (1000000000L / CLINT_HZ);
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 uint64
@@ -0,0 +1,203 @@
+// Shared cache of executable text.
+//
+// The pages of a program's read-only segments are the same for
+// every process running it, so exec() and execpage_in() take them
+// from here, by (device, inode, file offset), instead of reading a
+// private copy each time. Each page holds a reference to its frame
+// (see kdup()) and every process mapping it one more, which
+// uvmunmap() or eviction drops like any other: a text page is never
+// written, so eviction just forgets it, and the next fault finds it
+// here again if it is still cached.
+//
+// A page no process maps any more stays cached until its slot is
+// wanted, going round like a clock, or kswapd wants the memory
+// back, see textreclaim(). Writing or truncating a file drops its
+// pages, see textinval(): both hold the inode's lock, which
+// textget() holds from the read to the insertion.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+
+#define THASH(dev, inum) (((dev) * 31 + (inum)) % NTEXTHASH)
+
+struct tpage {
+  uint dev;
+  uint inum;
+  uint off;               // file offset of the page
+  uint n;                 // bytes from the file, the rest is zero
+  char *pa;               // the frame, 0 if the slot is free
+  int next;               // in its hash bucket, -1 at the end
+  int used;               // mapped since the clock hand last passed
+};
+
+struct {
+  struct spinlock lock;
+  struct tpage page[NTEXTPAGES];
+  int head[NTEXTHASH];    // by inode
+  int count[NTEXTHASH];   // pages in each bucket, see textinval()
+  int hand;
+  int npages;
+  // statistics, see textdump()
+  uint64 nhit;
+  uint64 nmiss;
+  uint64 ndropped;
+} text;
+
+void
+textinit(void)
+{
+  initlock(&text.lock, "text");
+  for(int i = 0; i < NTEXTHASH; i++)
+    text.head[i] = -1;
+}
+
+// forgets page i, dropping its reference. text.lock must be held.
+static void
+textfree(int i)
+{
+  struct tpage *t = &text.page[i];
+  int h = THASH(t->dev, t->inum);
+  int *pp;
+
+  for(pp = &text.head[h]; *pp != i; pp = &text.page[*pp].next)
+    if(*pp < 0)
+      panic("textfree");
+  *pp = t->next;
+  text.count[h]--;
+  text.npages--;
+  kfree(t->pa);
+  t->pa = 0;
+}
+
+// a free slot, or that of a page no process maps, which is first
+// given a second chance if it was mapped since the hand last came
+// by. -1 if every page is mapped. text.lock must be held.
+static int
+textslot(void)
+{
+  struct tpage *t;
+  int i;
+
+  for(int k = 0; k < 2 * NTEXTPAGES; k++){
+    i = text.hand;
+    text.hand = (i + 1) % NTEXTPAGES;
+    t = &text.page[i];
+    if(t->pa == 0)
+      return i;
+    if(krefcount(t->pa) > 1)
+      continue;
+    if(t->used){
+      t->used = 0;
+      continue;
+    }
+    textfree(i);
+    return i;
+  }
+  return -1;
+}
+
+// Returns the page of ip at off, n bytes of it followed by zeros,
+// with a reference for the caller, or 0 if it can't be read or
+// there is no memory. ip must be locked. The page must never be
+// written: it is mapped read-only.
+char*
+textget(struct inode *ip, uint off, uint n)
+{
+  int h = THASH(ip->dev, ip->inum), i;
+  struct tpage *t;
+  char *mem;
+
+  acquire(&text.lock);
+  for(i = text.head[h]; i >= 0; i = t->next){
+    t = &text.page[i];
+    if(t->dev == ip->dev && t->inum == ip->inum && t->off == off && t->n == n){
+      t->used = 1;
+      kdup(t->pa);
+      text.nhit++;
+      release(&text.lock);
+      return t->pa;
+    }
+  }
+  text.nmiss++;
+  release(&text.lock);
+
+  if((mem = kalloc_zeroed()) == 0)
+    return 0;
+  if(readi(ip, 0, (uint64)mem, off, n) != n){
+    kfree(mem);
+    return 0;
+  }
+
+  // nobody else can have read it meanwhile: they need ip's lock.
+  acquire(&text.lock);
+  if((i = textslot()) >= 0){
+    t = &text.page[i];
+    t->dev = ip->dev;
+    t->inum = ip->inum;
+    t->off = off;
+    t->n = n;
+    t->pa = mem;
+    t->used = 1;
+    kdup(mem);
+    t->next = text.head[h];
+    text.head[h] = i;
+    text.count[h]++;
+    text.npages++;
+  }
+  release(&text.lock);
+  return mem;
+}
+
+// Drops the cached pages of ip, which is about to change. ip must
+// be locked. The processes mapping them keep their copies.
+void
+textinval(struct inode *ip)
+{
+  int h = THASH(ip->dev, ip->inum), i, next;
+  struct tpage *t;
+
+  // pages of ip only get here with ip locked, like the caller
+  if(__atomic_load_n(&text.count[h], __ATOMIC_RELAXED) == 0)
+    return;
+  acquire(&text.lock);
+  for(i = text.head[h]; i >= 0; i = next){
+    t = &text.page[i];
+    next = t->next;
+    if(t->dev == ip->dev && t->inum == ip->inum)
+      textfree(i);
+  }
+  release(&text.lock);
+}
+
+// Frees up to n cached pages that no process maps, for kswapd.
+// Returns how many it freed.
+int
+textreclaim(int n)
+{
+  int got = 0;
+
+  acquire(&text.lock);
+  for(int i = 0; i < NTEXTPAGES && got < n; i++){
+    if(text.page[i].pa && krefcount(text.page[i].pa) == 1){
+      textfree(i);
+      got++;
+    }
+  }
+  text.ndropped += got;
+  release(&text.lock);
+  return got;
+}
+
+// Print the cache's use to the console, with kallocdump().
+void
+textdump(void)
+{
+  printf("text: %d of %d pages cached, %d hits %d misses %d reclaimed\n",
+         text.npages, NTEXTPAGES, (int)text.nhit, (int)text.nmiss, (int)text.ndropped);
+}
@@ -0,0 +1,151 @@
+// Kernel trace buffer.
+//
+// Tracepoints, TRACEPOINT() in defs.h, record an event in a ring of
+// NTRACE records belonging to the CPU they run on. Only that CPU
+// writes its ring, with interrupts off, so tracing takes no lock
+// and may be done anywhere, under any lock. While tracing is off a
+// tracepoint costs a load and a branch.
+//
+// Reading /dev/trace returns the unread records of each CPU in
+// turn, oldest first, whole records only, and 0 when there are
+// none. A record overwritten while it waited (or while it was
+// being copied: each one's seq is written last, and checked before
+// and after) counts as lost; the next read starts with a TR_LOST
+// record saying how many were. Writing "1" to /dev/trace turns
+// tracing on, "0" turns it off.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "fs.h"
+#include "file.h"
+#include "pstat.h"
+#include "proc.h"
+#include "defs.h"
+#include "trace.h"
+
+int tracing;
+
+struct tracering {
+  uint64 head;                // records ever written
+  struct tracerec rec[NTRACE];
+} rings[NCPU];
+
+struct {
+  struct spinlock lock;       // serializes readers
+  uint64 tail[NCPU];          // next record to read from each ring
+  uint64 lost;
+} tracer;
+
+// records event ev for the running process. use TRACEPOINT().
+void
+tracerecord(int ev, uint64 a, uint64 b)
+{
+  struct tracering *t;
+  struct tracerec *r;
+  struct cpu *c;
+
+  push_off();
+  c = mycpu();
+  t = &rings[cpuid()];
+  r = &t->rec[t->head % NTRACE];
+  r->seq = 0;
+  __sync_synchronize();
+  r->time = r_time();
+  r->a = a;
+  r->b = b;
+  r->pid = c->proc ? c->proc->pid : 0;
+  r->cpu = cpuid();
+  r->ev = ev;
+  __sync_synchronize();
+  r->seq = t->head + 1;
+  t->head++;
+  pop_off();
+}
+
+// copies up to max of the unread records into buf.
+// tracer.lock must be held.
+static int
+tracetake(struct tracerec *buf, int max)
+{
+  struct tracering *t;
+  struct tracerec *r;
+  uint64 head, seq;
+  int i, n = 0;
+
+  if(tracer.lost > 0 && n < max){
+    memset(&buf[n], 0, sizeof(buf[n]));
+    buf[n].time = r_time();
+    buf[n].ev = TR_LOST;
+    buf[n++].a = tracer.lost;
+    tracer.lost = 0;
+  }
+  for(i = 0; i < NCPU && n < max; i++){
+    t = &rings[i];
+    head = t->head;
+    __sync_synchronize();
+    if(head - tracer.tail[i] > NTRACE){
+      tracer.lost += head - NTRACE - tracer.tail[i];
+      tracer.tail[i] = head - NTRACE;
+    }
+    for(; tracer.tail[i] < head && n < max; tracer.tail[i]++){
+      r = &t->rec[tracer.tail[i] % NTRACE];
+      seq = r->seq;
+      __sync_synchronize();
+      buf[n] = *r;
+      __sync_synchronize();
+      if(seq == tracer.tail[i] + 1 && r->seq == seq)
+        n++;
+      else
+        tracer.lost++;
+    }
+  }
+  return n;
+}
+
+int
+traceread(int user_dst, uint64 dst, int n)
+{
+  struct tracerec buf[8];
+  int max, got, done = 0;
+
+  while((max = (n - done) / sizeof(buf[0])) > 0){
+    if(max > NELEM(buf))
+      max = NELEM(buf);
+    // copied out after the lock is released:
+    // a user page may have to be faulted in.
+    acquire(&tracer.lock);
+    got = tracetake(buf, max);
+    release(&tracer.lock);
+    if(got == 0)
+      break;
+    if(either_copyout(user_dst, dst + done, buf, got * sizeof(buf[0])) < 0)
+      return done > 0 ? done : -1;
+    done += got * sizeof(buf[0]);
+  }
+  return done;
+}
+
+int
+tracewrite(int user_src, uint64 src, int n)
+{
+  char c;
+
+  if(n < 1 || either_copyin(&c, user_src, src, 1) < 0)
+    return -1;
+  if(c == '0' || c == '1')
+    tracing = c - '0';
+  else
+    return -1;
+  return n;
+}
+
+void
+traceinit(void)
+{
+  initlock(&tracer.lock, "trace");
+  devsw[TRACE].read = traceread;
+  devsw[TRACE].write = tracewrite;
+}
@@ -0,0 +1,18 @@
+// a kernel trace record, as read from /dev/trace, see trace.c.
+struct tracerec {
+  uint64 seq;     // number in its CPU's ring, from 1
+  uint64 time;    // time CSR
+  uint64 a, b;    // arguments, see below
+  int pid;        // process running, 0 if none
+  ushort cpu;
+  ushort ev;
+};
+
+#define TR_FAULT     1  // usertrap() page fault: a va, b scause
+#define TR_SWAPIN    2  // swap_in(): a va, b pages read (0: from the executable)
+#define TR_EVICT     3  // victim: a va (| 1 if dropped clean), b agingCounter
+#define TR_SWITCHIN  4  // scheduler() runs a process: a pid
+#define TR_SWITCHOUT 5  // ... which gives up the CPU: a pid, b its state
+#define TR_BHIT      6  // bget() found a block cached: a dev, b blockno
+#define TR_BMISS     7  // ... or not
+#define TR_LOST      8  // a records were overwritten before being read
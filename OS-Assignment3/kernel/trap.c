@@ -3,8 +3,10 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "pstat.h"
 #include "proc.h"
 #include "defs.h"
+#include "trace.h"
 
 struct spinlock tickslock;
 uint ticks;
@@ -46,6 +48,8 @@ usertrap(void)
   w_stvec((uint64)kernelvec);
 
   struct proc *p = myproc();
+  struct proc *mm = p->mm;
+  p->inuser = 0;
   
   // save user program counter.
   p->trapframe->epc = r_sepc();
@@ -68,11 +72,21 @@ usertrap(void)
   } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15) {
     // page fault
     uint64 va = r_stval();
-    pte_t* pte = walk(p->pagetable, va, 0); 
+    TRACEPOINT(TR_FAULT, va, r_scause());
+    vmlock(mm);
+    mm->stats.faults++;
+    pte_t* pte = va < MAXVA ? walk(p->pagetable, va, 0) : 0;
     if(pte != 0 && (*pte & PTE_PG))
-      swap_in(p, va, pte); 
-    else 
+      swap_in(mm, va, pte); 
+    else if(r_scause() == 15 && pte != 0 && (*pte & PTE_COW)){
+      if(uvmcow(p->pagetable, va) < 0)
+        p->killed = 1; // no memory for the copy
+    } else if(pte != 0 && (*pte & PTE_V) && (*pte & PTE_U) &&
+              (*pte & (r_scause() == 12 ? PTE_X : r_scause() == 13 ? PTE_R : PTE_W))){
+      // another thread has already brought the page in
+    } else if(uvmlazy(mm, va, r_scause() == 15) < 0)
       p->killed = 1; //SIGFAULT
+    vmunlock(mm);
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -85,8 +99,13 @@ usertrap(void)
     exit(-1);
 
   // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
+  if(which_dev == 2){
+    if(profiling)
+      profsample(p->trapframe->epc, 1);
+    pffupdate(mm);
+    threadAging(mm);
     yield();
+  }
 
   usertrapret();
 }
@@ -104,6 +123,10 @@ usertrapret(void)
   // we're back in user space, where usertrap() is correct.
   intr_off();
 
+  // not while the page table is changing under the process's
+  // other threads, see tlbstop().
+  tlbwait(p);
+
   // send syscalls, interrupts, and exceptions to trampoline.S
   w_stvec(TRAMPOLINE + (uservec - trampoline));
 
@@ -131,9 +154,10 @@ usertrapret(void)
 
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
-  // and switches to user mode with sret.
+  // and switches to user mode with sret. a thread's trapframe
+  // is in a slot of its own below TRAPFRAME.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64))fn)(THREADFRAME(p->tslot), satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -157,6 +181,9 @@ kerneltrap()
     panic("kerneltrap");
   }
 
+  if(which_dev == 2 && profiling)
+    profsample(sepc, 0);
+
   // give up the CPU if this is a timer interrupt.
   if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
     yield();
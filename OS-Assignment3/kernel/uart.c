@@ -7,6 +7,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "pstat.h"
 #include "proc.h"
 #include "defs.h"
 
@@ -40,12 +41,13 @@
 
 // the transmit output buffer.
 struct spinlock uart_tx_lock;
-#define UART_TX_BUF_SIZE 32
+#define UART_TX_BUF_SIZE UARTTXBUF
 char uart_tx_buf[UART_TX_BUF_SIZE];
 uint64 uart_tx_w; // write next to uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE]
 uint64 uart_tx_r; // read next from uart_tx_buf[uar_tx_r % UART_TX_BUF_SIZE]
 
 extern volatile int panicked; // from printf.c
+extern volatile int panicking;
 
 void uartstart();
 
@@ -77,14 +79,14 @@ uartinit(void)
   initlock(&uart_tx_lock, "uart");
 }
 
-// add a character to the output buffer and tell the
+// add n characters to the output buffer and tell the
 // UART to start sending if it isn't already.
-// blocks if the output buffer is full.
+// blocks while the output buffer is full.
 // because it may block, it can't be called
 // from interrupts; it's only suitable for use
 // by write().
 void
-uartputc(int c)
+uartwrite(char *buf, int n)
 {
   acquire(&uart_tx_lock);
 
@@ -93,25 +95,66 @@ uartputc(int c)
       ;
   }
 
-  while(1){
-    if(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
+  while(n > 0){
+    while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
       // buffer is full.
       // wait for uartstart() to open up space in the buffer.
+      uartstart();
       sleep(&uart_tx_r, &uart_tx_lock);
-    } else {
-      uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = c;
+    }
+    while(n > 0 && uart_tx_w < uart_tx_r + UART_TX_BUF_SIZE){
+      uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = *buf++;
       uart_tx_w += 1;
-      uartstart();
-      release(&uart_tx_lock);
-      return;
+      n--;
     }
   }
+  uartstart();
+  release(&uart_tx_lock);
 }
 
-// alternate version of uartputc() that doesn't 
-// use interrupts, for use by kernel printf() and
-// to echo characters. it spins waiting for the uart's
-// output register to be empty.
+// add a character to the output buffer without sleeping,
+// for use by kernel printf() and to echo characters.
+// spins waiting for the UART only if the buffer is full.
+// in a panic, empties the buffer and writes c directly,
+// taking no lock: this CPU may hold it.
+void
+uartputc_async(int c)
+{
+  if(panicking){
+    push_off();
+    while(uart_tx_r != uart_tx_w){
+      while((ReadReg(LSR) & LSR_TX_IDLE) == 0)
+        ;
+      WriteReg(THR, uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]);
+      uart_tx_r += 1;
+    }
+    pop_off();
+    uartputc_sync(c);
+    return;
+  }
+
+  acquire(&uart_tx_lock);
+
+  if(panicked){
+    for(;;)
+      ;
+  }
+
+  while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
+    // can't sleep; wait for the UART to take a byte.
+    while((ReadReg(LSR) & LSR_TX_IDLE) == 0)
+      ;
+    uartstart();
+  }
+  uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = c;
+  uart_tx_w += 1;
+  uartstart();
+  release(&uart_tx_lock);
+}
+
+// alternate version of uartputc_async() that doesn't
+// use the buffer, for panic(). it spins waiting for
+// the uart's output register to be empty.
 void
 uartputc_sync(int c)
 {
@@ -137,27 +180,30 @@ uartputc_sync(int c)
 void
 uartstart()
 {
+  uint64 r = uart_tx_r;
+
   while(1){
     if(uart_tx_w == uart_tx_r){
       // transmit buffer is empty.
-      return;
+      break;
     }
     
     if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
       // the UART transmit holding register is full,
       // so we cannot give it another byte.
       // it will interrupt when it's ready for a new byte.
-      return;
+      break;
     }
     
     int c = uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE];
     uart_tx_r += 1;
     
-    // maybe uartputc() is waiting for space in the buffer.
-    wakeup(&uart_tx_r);
-    
     WriteReg(THR, c);
   }
+
+  // maybe uartwrite() is waiting for space in the buffer.
+  if(uart_tx_r != r)
+    wakeup(&uart_tx_r);
 }
 
 // read one input character from the UART.
@@ -61,7 +61,8 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    char *done;  // set to 1 when the device has finished the chain
+    struct buf *ahead;  // or, read for bprefetch(): hand it to breaddone()
     char status;
   } info[NUM];
 
@@ -184,12 +185,11 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+alloc_ndesc(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -200,27 +200,34 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// a piece of a transfer: len bytes at data, to or from the
+// disk starting at sector. data must be physically contiguous
+// (it is in the kernel's direct map).
+struct vseg {
+  uint64 sector;
+  void *data;
+  uint len;
+};
+
+// start one request for the n segments at seg, which must follow
+// each other on disk. virtio_disk_intr() sets *done when the
+// device has finished. caller holds vdisk_lock. returns the
+// request's index in info[].
+static int
+virtio_disk_submit(struct vseg *seg, int n, int write, char *done)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
-
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
-
-  // allocate the three descriptors.
-  int idx[3];
+  // a descriptor for type/reserved/sector, then the data, then
+  // one for a 1-byte status result. the data may take several.
+  int idx[MAXSEG+2];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc_ndesc(idx, n + 2) == 0) {
       break;
     }
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -230,31 +237,35 @@ virtio_disk_rw(struct buf *b, int write)
   else
     buf0->type = VIRTIO_BLK_T_IN; // read the disk
   buf0->reserved = 0;
-  buf0->sector = sector;
+  buf0->sector = seg[0].sector;
 
   disk.desc[idx[0]].addr = (uint64) buf0;
   disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(int i = 0; i < n; i++){
+    disk.desc[idx[i+1]].addr = (uint64) seg[i].data;
+    disk.desc[idx[i+1]].len = seg[i].len;
+    if(write)
+      disk.desc[idx[i+1]].flags = 0; // device reads data
+    else
+      disk.desc[idx[i+1]].flags = VRING_DESC_F_WRITE; // device writes data
+    disk.desc[idx[i+1]].flags |= VRING_DESC_F_NEXT;
+    disk.desc[idx[i+1]].next = idx[i+2];
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  // for virtio_disk_intr() to report completion.
+  if(done)
+    *done = 0;
+  disk.info[idx[0]].done = done;
+  disk.info[idx[0]].ahead = 0;
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -267,21 +278,117 @@ virtio_disk_rw(struct buf *b, int write)
   __sync_synchronize();
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  return idx[0];
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+// transfer the n (at most MAXSEG) segments at seg. segments that
+// follow each other on disk go in one request, and all the requests
+// are in flight together; then wait for the device to finish them.
+static void
+virtio_disk_rwsegs(struct vseg *seg, int n, int write)
+{
+  char done[MAXSEG];
+  int i, j, nreq = 0;
+
+  acquire(&disk.vdisk_lock);
+
+  for(i = 0; i < n; i = j){
+    for(j = i + 1; j < n; j++)
+      if(seg[j].sector != seg[j-1].sector + seg[j-1].len / 512)
+        break;
+    virtio_disk_submit(&seg[i], j - i, write, &done[nreq++]);
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  // Wait for virtio_disk_intr() to say the requests have finished.
+  for(i = 0; i < nreq; i++){
+    while(done[i] == 0)
+      sleep(&done[i], &disk.vdisk_lock);
+  }
 
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  struct vseg seg = { b->blockno * (BSIZE / 512), b->data, BSIZE };
+
+  b->disk = 1;
+  virtio_disk_rwsegs(&seg, 1, write);
+  b->disk = 0;
+}
+
+// start reading b, which is locked, and return at once.
+// virtio_disk_intr() passes it to breaddone() when it is in.
+void
+virtio_disk_readahead(struct buf *b)
+{
+  struct vseg seg = { b->blockno * (BSIZE / 512), b->data, BSIZE };
+
+  acquire(&disk.vdisk_lock);
+  b->disk = 1;
+  disk.info[virtio_disk_submit(&seg, 1, 0, 0)].ahead = b;
+  release(&disk.vdisk_lock);
+}
+
+// read or write the n bufs at bs, keeping up to MAXSEG
+// blocks in flight at once. blocks that are consecutive
+// on disk are transferred by a single request.
+void
+virtio_disk_rwv(struct buf **bs, int n, int write)
+{
+  struct vseg seg[MAXSEG];
+  int i, m;
+
+  for(; n > 0; n -= m, bs += m){
+    m = n < MAXSEG ? n : MAXSEG;
+    for(i = 0; i < m; i++){
+      seg[i].sector = bs[i]->blockno * (BSIZE / 512);
+      seg[i].data = bs[i]->data;
+      seg[i].len = BSIZE;
+      bs[i]->disk = 1;
+    }
+    virtio_disk_rwsegs(seg, m, write);
+    for(i = 0; i < m; i++)
+      bs[i]->disk = 0;
+  }
+}
+
+// read or write n consecutive blocks starting at blockno straight
+// from/to data, bypassing the buffer cache. used for raw swap I/O.
+void
+virtio_disk_rwblocks(uint blockno, void *data, int n, int write)
+{
+  struct vseg seg = { (uint64)blockno * (BSIZE / 512), data, n * BSIZE };
+
+  virtio_disk_rwsegs(&seg, 1, write);
+}
+
+// like virtio_disk_rwblocks(), for n transfers of nblocks blocks,
+// the i'th between block blockno[i] and data[i], all in flight
+// together.
+void
+virtio_disk_rwblocksv(uint *blockno, char **data, int n, int nblocks, int write)
+{
+  struct vseg seg[MAXSEG];
+  int i, m;
+
+  for(; n > 0; n -= m, blockno += m, data += m){
+    m = n < MAXSEG ? n : MAXSEG;
+    for(i = 0; i < m; i++){
+      seg[i].sector = (uint64)blockno[i] * (BSIZE / 512);
+      seg[i].data = data[i];
+      seg[i].len = nblocks * BSIZE;
+    }
+    virtio_disk_rwsegs(seg, m, write);
+  }
+}
+
 void
 virtio_disk_intr()
 {
+  struct buf *b;
+
   acquire(&disk.vdisk_lock);
 
   // the device won't raise another interrupt until we tell it
@@ -304,9 +411,17 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    // the waiter's flag, not the descriptors, says the request is
+    // done, so the chain can be reused right away.
+    if((b = disk.info[id].ahead) != 0){
+      disk.info[id].ahead = 0;
+      b->disk = 0;
+      breaddone(b);
+    } else {
+      *disk.info[id].done = 1;   // disk is done with the request
+      wakeup(disk.info[id].done);
+    }
+    free_chain(id);
 
     disk.used_idx += 1;
   }
@@ -5,8 +5,11 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "fcntl.h"
 #include "spinlock.h"
+#include "pstat.h"
 #include "proc.h"
+#include "trace.h"
 
 /*
  * the kernel's page table.
@@ -17,6 +20,18 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+static void makeroom(struct proc*, int, int);
+static void aging(struct proc*);
+static void arcreset(struct proc*);
+static int mmappage_in(struct proc*, struct vma*, uint64);
+static pte_t *walklevel(pagetable_t, uint64, int, int);
+static int mapzero(pagetable_t, uint64);
+
+// the frame every page not yet written maps, read-only and
+// copy-on-write (see mapzero()). it keeps the reference kalloc()
+// gave it, so it is never freed.
+static char *zeropage;
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -24,7 +39,7 @@ kvmmake(void)
   pagetable_t kpgtbl;
 
   kpgtbl = (pagetable_t) kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  pagezero(kpgtbl);
 
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -38,7 +53,8 @@ kvmmake(void)
   // map kernel text executable and read-only.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
-  // map kernel data and the physical RAM we'll make use of.
+  // map kernel data and the physical RAM we'll make use of,
+  // in megapages from the first 2MB boundary on.
   kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
@@ -56,6 +72,8 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  if((zeropage = kalloc_zeroed()) == 0)
+    panic("kvminit: zero page");
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -79,47 +97,126 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// A megapage is mapped by a leaf at level 1 (see mappages()),
+// and walk() returns that leaf for any va in it.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walklevel(pagetable, va, alloc, 0);
+}
+
+// The same, but for the PTE at level (0 for a page, 1 for a
+// megapage).
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int target)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
+  for(int level = 2; level > target; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(*pte & (PTE_R | PTE_W | PTE_X))
+        return pte;   // a megapage
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(target, va)];
 }
 
-// Look up a virtual address, return the physical address,
-// or 0 if not mapped.
-// Can only be used to look up user pages.
+// Clear PTE_A of a user page. Another hart running one of the
+// process's threads may be setting PTE_D in it at the same time,
+// so this must not be a plain read and write.
+static void
+clearaccessed(pte_t *pte)
+{
+  __atomic_fetch_and(pte, ~(pte_t)PTE_A, __ATOMIC_RELAXED);
+}
+
+// The leaf PTE for page va of pagetable, from p's translation
+// cache when pagetable is p's. Leaf page-table pages are only
+// freed along with the whole page table, so a cached pointer
+// stays good until tcflush(), whatever happens to the PTE
+// itself (unmapping, swapping, copy-on-write): callers read
+// the PTE afresh.
+static pte_t*
+tcwalk(struct proc *p, pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  int i = (va / PGSIZE) % NTCACHE;
+
+  if(p == 0 || p->pagetable != pagetable)
+    return walk(pagetable, va, 0);
+  if(p->tcpte[i] && p->tcva[i] == va)
+    return p->tcpte[i];
+  if((pte = walk(pagetable, va, 0)) != 0){
+    p->tcva[i] = va;
+    p->tcpte[i] = pte;
+  }
+  return pte;
+}
+
+// Forget p's cached translations, before its page table goes.
+void
+tcflush(struct proc *p)
+{
+  memset(p->tcpte, 0, sizeof(p->tcpte));
+}
+
+// Return the physical address of the user page at va, ready for
+// the kernel to read or, if write, to write: a page sbrk() has
+// not allocated yet is allocated, a swapped-out page is swapped
+// in and a copy-on-write page is copied. Returns 0 if va is not
+// a user page.
 uint64
-walkaddr(pagetable_t pagetable, uint64 va)
+uvmtranslate(pagetable_t pagetable, uint64 va, int write)
 {
+  struct proc *me = myproc(), *p = myspace();
   pte_t *pte;
-  uint64 pa;
 
   if(va >= MAXVA)
     return 0;
-
-  pte = walk(pagetable, va, 0);
-  if(pte == 0)
-    return 0;
-  if((*pte & PTE_V) == 0)
-    return 0;
+  va = PGROUNDDOWN(va);
+  pte = tcwalk(me, pagetable, va);
+  if(pte == 0 || (*pte & PTE_V) == 0){
+    if(p == 0 || p->pagetable != pagetable)
+      return 0;
+    p->stats.faults++;
+    if(pte && (*pte & PTE_PG))
+      swap_in(p, va, pte);
+    else if(uvmlazy(p, va, write) < 0)   // maybe a page sbrk() has not allocated yet
+      return 0;
+    pte = tcwalk(me, pagetable, va);
+    if(pte == 0 || (*pte & PTE_V) == 0)
+      return 0;
+  }
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
-  return pa;
+  if(write && (*pte & (PTE_W | PTE_COW)) == 0)
+    return 0;
+  if(write && (*pte & PTE_COW)){
+    if(p != 0 && p->pagetable == pagetable)
+      p->stats.faults++;
+    if(uvmcow(pagetable, va) < 0)
+      return 0;
+  }
+  if(write)
+    *pte |= PTE_D;   // written behind the hardware's back
+  return PTE2PA(*pte);
+}
+
+// Look up a virtual address, return the physical address,
+// or 0 if not mapped.
+// Can only be used to look up user pages.
+uint64
+walkaddr(pagetable_t pagetable, uint64 va)
+{
+  return uvmtranslate(pagetable, va, 0);
 }
 
 // add a mapping to the kernel page table.
@@ -135,57 +232,645 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
 // be page-aligned. Returns 0 on success, -1 if walk() couldn't
-// allocate a needed page-table page.
+// allocate a needed page-table page. Kernel mappings take a
+// megapage wherever va and pa are 2MB-aligned and the whole 2MB
+// is to be mapped, saving TLB entries and page-table pages; user
+// pages are paged (and copied on write) one by one, so they are
+// always 4096 bytes.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
-  uint64 a, last;
+  uint64 a, last, step;
   pte_t *pte;
 
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+    if((perm & PTE_U) == 0 && a % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 &&
+       last - a >= MEGAPGSIZE - PGSIZE){
+      pte = walklevel(pagetable, a, 1, 1);
+      step = MEGAPGSIZE;
+    } else {
+      pte = walk(pagetable, a, 1);
+      step = PGSIZE;
+    }
+    if(pte == 0)
       return -1;
     if(*pte & PTE_V)
       panic("remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
-    if(a == last)
+    if(last - a < step)
       break;
-    a += PGSIZE;
-    pa += PGSIZE;
+    a += step;
+    pa += step;
+  }
+  return 0;
+}
+
+// Paging metadata. A paging process has a struct paging_meta_data
+// for every page it has touched, kept in a radix tree indexed by
+// page number: a root and a middle level of pointer pages above
+// leaf pages of META_PER_PAGE entries. The pages are allocated on
+// demand, so the metadata grows with the pages a process uses and
+// can still cover all of Sv39 user space.
+#define META_FANOUT   (PGSIZE / sizeof(uint64))
+#define META_PER_PAGE (PGSIZE / sizeof(struct paging_meta_data))
+#define META_PAGES    (META_FANOUT * META_FANOUT * META_PER_PAGE)
+
+// returns the metadata of page number page in p. if alloc != 0,
+// creates it (as a page neither resident nor swapped out) if needed.
+// returns 0 if there is none, or no memory for it.
+struct paging_meta_data*
+pagemeta(struct proc *p, int page, int alloc)
+{
+  uint64 *root, *mid;
+  struct paging_meta_data *leaf;
+
+  if(page < 0 || page >= META_PAGES)
+    return 0;
+  if((root = p->meta) == 0){
+    if(!alloc || (root = (uint64*)kalloc_zeroed()) == 0)
+      return 0;
+    p->meta = root;
+  }
+  mid = (uint64*)root[page / (META_FANOUT * META_PER_PAGE)];
+  if(mid == 0){
+    if(!alloc || (mid = (uint64*)kalloc_zeroed()) == 0)
+      return 0;
+    root[page / (META_FANOUT * META_PER_PAGE)] = (uint64)mid;
+  }
+  leaf = (struct paging_meta_data*)mid[page / META_PER_PAGE % META_FANOUT];
+  if(leaf == 0){
+    if(!alloc || (leaf = (struct paging_meta_data*)kalloc()) == 0)
+      return 0;
+    for(int i = 0; i < META_PER_PAGE; i++){
+      leaf[i].offset = -1;
+      leaf[i].agingCounter = 0;
+      leaf[i].next = -1;
+      leaf[i].prev = -1;
+      leaf[i].inUse = 0;
+    }
+    mid[page / META_PER_PAGE % META_FANOUT] = (uint64)leaf;
+  }
+  return &leaf[page % META_PER_PAGE];
+}
+
+// returns the first page number >= page that p holds a swap slot
+// for (swapped out or still clean), or -1 if there is none.
+int
+nextSwappedPage(struct proc *p, int page)
+{
+  uint64 *mid;
+  struct paging_meta_data *leaf;
+
+  if(p->meta == 0 || page < 0)
+    return -1;
+  while(page < META_PAGES){
+    mid = (uint64*)p->meta[page / (META_FANOUT * META_PER_PAGE)];
+    if(mid == 0){
+      page = (page / (META_FANOUT * META_PER_PAGE) + 1) * (META_FANOUT * META_PER_PAGE);
+      continue;
+    }
+    leaf = (struct paging_meta_data*)mid[page / META_PER_PAGE % META_FANOUT];
+    if(leaf == 0){
+      page = (page / META_PER_PAGE + 1) * META_PER_PAGE;
+      continue;
+    }
+    for(int i = page % META_PER_PAGE; i < META_PER_PAGE; i++, page++)
+      if(leaf[i].offset != -1)
+        return page;
+  }
+  return -1;
+}
+
+static void
+freeMeta(struct proc *p)
+{
+  uint64 *mid;
+
+  if(p->meta == 0)
+    return;
+  for(int r = 0; r < META_FANOUT; r++){
+    if((mid = (uint64*)p->meta[r]) == 0)
+      continue;
+    for(int m = 0; m < META_FANOUT; m++)
+      if(mid[m])
+        kfree((void*)mid[m]);
+    kfree(mid);
+  }
+  kfree(p->meta);
+  p->meta = 0;
+}
+
+// gives np a copy of p's paging metadata, for fork().
+// returns -1 if out of memory.
+int
+copyPaging(struct proc *np, struct proc *p)
+{
+  uint64 *mid, *nmid;
+  char *leaf;
+
+  if(p->meta != 0){
+    if((np->meta = (uint64*)kalloc_zeroed()) == 0)
+      return -1;
+    for(int r = 0; r < META_FANOUT; r++){
+      if((mid = (uint64*)p->meta[r]) == 0)
+        continue;
+      if((nmid = (uint64*)kalloc_zeroed()) == 0)
+        goto bad;
+      np->meta[r] = (uint64)nmid;
+      for(int m = 0; m < META_FANOUT; m++){
+        if(mid[m] == 0)
+          continue;
+        if((leaf = kalloc()) == 0)
+          goto bad;
+        pagecopy(leaf, (char*)mid[m]);
+        nmid[m] = (uint64)leaf;
+      }
+    }
   }
+  np->head = p->head;
+  np->tail = p->tail;
+  np->numOfPages = p->numOfPages;
+  np->pagesInMemory = p->pagesInMemory;
+  np->maxPsycPages = p->maxPsycPages;
+  np->npinned = p->npinned;
+  memmove(np->madv, p->madv, sizeof(p->madv));
+  memmove(np->freeSlots, p->freeSlots, sizeof(p->freeSlots));
+  np->numOfFreeSlots = p->numOfFreeSlots;
+  np->nextSlot = p->nextSlot;
+  memmove(&np->arc, &p->arc, sizeof(p->arc));
+  memmove(np->seg, p->seg, sizeof(p->seg));
+  np->nseg = p->nseg;
+  if(p->execip)
+    np->execip = idup(p->execip);
   return 0;
+
+ bad:
+  freeMeta(np);
+  return -1;
+}
+
+// empties p's paging state of an image, without freeing it
+static void
+resetPaging(struct proc *p)
+{
+  p->meta = 0;
+  p->head = -1;
+  p->tail = -1;
+  p->numOfPages = 0;
+  p->pagesInMemory = 0;
+  p->lastFault = -1;
+  p->readAhead = 0;
+  p->lastAging = 0;
+  p->npinned = 0;
+  memset(p->madv, 0, sizeof(p->madv));
+  p->nfaults = 0;
+  p->pffstamp = ticks;
+  arcreset(p);
+}
+
+// gives back p's swap slots and paging metadata, leaving it with
+// no pages as far as paging is concerned.
+void
+freePaging(struct proc *p)
+{
+  releaseSwapSlots(p);
+  freeMeta(p);
+  initSwapSlots(p);
+  resetPaging(p);
+}
+
+// exchanges p's paging state of an image with s. the swap slots
+// are not part of it: both images' pages share p's swap file.
+static void
+swapPaging(struct proc *p, struct pagingstate *s)
+{
+  struct pagingstate t;
+
+  t.meta = p->meta;
+  t.pagesInMemory = p->pagesInMemory;
+  t.head = p->head;
+  t.tail = p->tail;
+  t.numOfPages = p->numOfPages;
+  t.lastFault = p->lastFault;
+  t.readAhead = p->readAhead;
+  t.lastAging = p->lastAging;
+  t.npinned = p->npinned;
+  t.nfaults = p->nfaults;
+  t.pffstamp = p->pffstamp;
+  memmove(t.madv, p->madv, sizeof(t.madv));
+  t.arc = p->arc;
+
+  p->meta = s->meta;
+  p->pagesInMemory = s->pagesInMemory;
+  p->head = s->head;
+  p->tail = s->tail;
+  p->numOfPages = s->numOfPages;
+  p->lastFault = s->lastFault;
+  p->readAhead = s->readAhead;
+  p->lastAging = s->lastAging;
+  p->npinned = s->npinned;
+  p->nfaults = s->nfaults;
+  p->pffstamp = s->pffstamp;
+  memmove(p->madv, s->madv, sizeof(p->madv));
+  p->arc = s->arc;
+
+  *s = t;
+}
+
+// sets p's paging state aside in s and leaves p with none, for
+// exec() to build the new image's in. restorePaging() puts it back
+// if exec() fails, dropPaging() frees it once it commits.
+void
+stashPaging(struct proc *p, struct pagingstate *s)
+{
+  swapPaging(p, s);
+  resetPaging(p);
+}
+
+// frees the paging state exec() built in p, and gives p back the
+// one stashPaging() set aside in s.
+void
+restorePaging(struct proc *p, struct pagingstate *s)
+{
+  releaseSwapSlots(p);
+  freeMeta(p);
+  swapPaging(p, s);
+}
+
+// gives back the swap slots and metadata of the image whose paging
+// state stashPaging() set aside in s, which p no longer runs.
+void
+dropPaging(struct proc *p, struct pagingstate *s)
+{
+  swapPaging(p, s);
+  releaseSwapSlots(p);
+  freeMeta(p);
+  swapPaging(p, s);
+}
+
+// queue of resident pages, oldest first, doubly linked through their
+// metadata so every operation is O(1). SCFIFO takes its victims from
+// it; the other policies scan it instead of all of the metadata.
+// ARC keeps the pages of its T2 on a second queue, p->arc.thead,
+// so that the oldest page of either list is at a front.
+
+// the ends of the queue the page with metadata m goes on
+static void
+qends(struct proc *p, struct paging_meta_data *m, int **head, int **tail)
+{
+  if(m->agingCounter == ARC_T2 && p->policy && policyno(p->policy) == ARC){
+    *head = &p->arc.thead;
+    *tail = &p->arc.ttail;
+  } else {
+    *head = &p->head;
+    *tail = &p->tail;
+  }
 }
 
-void in(int page){
-  struct proc * p = myproc();
-  if(p->tail == MAX_TOTAL_PAGES - 1)
-    p->tail = -1;
-  p->tail += 1;
-  p->pages[p->tail] = page;
+// appends page to the end of its queue
+void in(struct proc *p, int page){
+  struct paging_meta_data *m = pagemeta(p, page, 0);
+  int *head, *tail;
+
+  qends(p, m, &head, &tail);
+  m->next = -1;
+  m->prev = *tail;
+  if(*tail == -1)
+    *head = page;
+  else
+    pagemeta(p, *tail, 0)->next = page;
+  *tail = page;
   p->numOfPages += 1;
 }
 
-void out(){
-  struct proc* p = myproc();
-  if(p->head == MAX_TOTAL_PAGES - 1)
-    p->head = 0;
+// unlinks page, which must be in its queue
+static void
+unlink(struct proc *p, int page){
+  struct paging_meta_data *m = pagemeta(p, page, 0);
+  int *head, *tail;
+
+  qends(p, m, &head, &tail);
+  if(m->prev == -1)
+    *head = m->next;
   else
-    p->head += 1;  
+    pagemeta(p, m->prev, 0)->next = m->next;
+  if(m->next == -1)
+    *tail = m->prev;
+  else
+    pagemeta(p, m->next, 0)->prev = m->prev;
+  m->next = -1;
+  m->prev = -1;
   p->numOfPages -= 1;
 }
 
-// removing all pages and then inserting them again but without the specified page
+// is page, with metadata m, in its queue?
+static int
+queued(struct proc *p, int page, struct paging_meta_data *m)
+{
+  int *head, *tail;
+
+  qends(p, m, &head, &tail);
+  return *head == page || m->prev != -1;
+}
+
+// removes and returns the page at the front of the queue
+int out(struct proc *p){
+  int page = p->head;
+  unlink(p, page);
+  return page;
+}
+
+// removes the specified page from the queue, if it is there
 void
-removePage(int pageNumber){
-  struct proc * p = myproc();
-  for(int i = 0; i < p->numOfPages; i++){
-    int page = p->pages[p->head];
-    out();
-    if(page != pageNumber)
-      in(page);
+removePage(struct proc *p, int pageNumber){
+  struct paging_meta_data *m = pagemeta(p, pageNumber, 0);
+  if(m != 0 && queued(p, pageNumber, m))
+    unlink(p, pageNumber);
+}
+
+// Bring in the user pages under [va, va+len) of the running
+// process (ready for writing, if write) and pin them resident
+// and off the replacement queue, so that a transfer using them
+// can't have them evicted part way, nor sleep on a fault under
+// a spinlock (a pipe's, the console's). The pages come in one
+// after the other, swap_in() reading ahead through swapped-out
+// runs, each pinned before the next can evict it. A process can
+// pin at most half of its resident limit (but always one page),
+// so this may cover less than len; returns how many bytes from
+// va it covers, 0 if va is not a user address (or len is 0).
+// Undo with uvmunpin().
+int
+uvmpin(uint64 va, int len, int write)
+{
+  struct proc *p = myspace();
+  uint64 a, end = va + len;
+
+  vmlock(p);
+  for(a = PGROUNDDOWN(va); a < end; a += PGSIZE){
+    #if SELECTION != NONE
+      if(p->pid > 1 && p->npinned >= p->maxPsycPages / 2 && a > PGROUNDDOWN(va))
+        break;
+    #endif
+    if(uvmtranslate(p->pagetable, a, write) == 0)
+      break;
+    #if SELECTION != NONE
+      struct paging_meta_data *m;
+      if(p->pid > 1 && (m = pagemeta(p, a/PGSIZE, 0)) != 0 && m->inUse && !m->pinned){
+        removePage(p, a/PGSIZE);
+        m->pinned = 1;
+        p->npinned++;
+      }
+    #endif
+  }
+  vmunlock(p);
+  if(a <= va)
+    return 0;
+  return (a < end ? a : end) - va;
+}
+
+// Give the pages uvmpin() pinned back to the replacement policy,
+// but for those mlock() keeps pinned.
+void
+uvmunpin(uint64 va, int len)
+{
+  #if SELECTION != NONE
+    struct proc *p = myspace();
+    struct paging_meta_data *m;
+
+    vmlock(p);
+    for(uint64 a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+      if(p->pid > 1 && (m = pagemeta(p, a/PGSIZE, 0)) != 0 && m->pinned && !m->locked){
+        m->pinned = 0;
+        p->npinned--;
+        if(m->inUse)
+          in(p, a/PGSIZE);
+      }
+    }
+    vmunlock(p);
+  #endif
+}
+
+// is va in p's heap, or in one of its mappings?
+static int
+useraddr(struct proc *p, uint64 va)
+{
+  return va < p->sz || vmafind(p, va) != 0;
+}
+
+// mlock() (if lock) and munlock() of the running process's pages
+// under [va, va+len). A locked page is brought in, with a frame of
+// its own if it was copy-on-write, and pinned like uvmpin() does
+// until it is unlocked, unmapped, or the process execs or exits;
+// a child of fork() inherits it locked. Locked and pinned pages
+// together are at most half of the resident limit. Returns 0, or
+// -1 if a page is not the process's or there is no room to lock
+// it, those before it staying locked.
+int
+uvmlock(uint64 va, uint64 len, int lock)
+{
+  struct proc *p = myspace();
+  uint64 a;
+  pte_t *pte;
+  int r = 0;
+
+  vmlock(p);
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    if(!useraddr(p, a)){
+      r = -1;
+      break;
+    }
+    if(lock && (uvmtranslate(p->pagetable, a, 0) == 0 ||
+                ((pte = walk(p->pagetable, a, 0)) != 0 && (*pte & PTE_COW) &&
+                 uvmtranslate(p->pagetable, a, 1) == 0))){
+      r = -1;
+      break;
+    }
+    #if SELECTION != NONE
+      struct paging_meta_data *m;
+      if(p->pid <= 1 || (m = pagemeta(p, a/PGSIZE, 0)) == 0)
+        continue;   // never paged, like a shared segment's
+      if(lock && m->inUse && !m->locked){
+        if(!m->pinned){
+          if(p->npinned >= p->maxPsycPages / 2){
+            r = -1;
+            break;
+          }
+          removePage(p, a/PGSIZE);
+          m->pinned = 1;
+          p->npinned++;
+        }
+        m->locked = 1;
+      } else if(!lock && m->locked){
+        m->locked = 0;
+        m->pinned = 0;
+        p->npinned--;
+        if(m->inUse)
+          in(p, a/PGSIZE);
+      }
+    #endif
+  }
+  vmunlock(p);
+  return r;
+}
+
+// the read-ahead advice for the page at va of p.
+static int
+advice(struct proc *p, uint64 va)
+{
+  struct madvice *a;
+
+  for(a = p->madv; a < &p->madv[NMADVISE]; a++)
+    if(va >= a->start && va < a->end)
+      return a->advice;
+  return MADV_NORMAL;
+}
+
+// records advice for [start, end) in p->madv, in place of what
+// the earlier ranges said of it. -1 if there is no room.
+static int
+setadvice(struct proc *p, uint64 start, uint64 end, int advice)
+{
+  struct madvice t[NMADVISE], *a, *b;
+  int n = 0;
+
+  // the earlier ranges, less [start, end)
+  for(a = p->madv; a < &p->madv[NMADVISE]; a++){
+    if(a->start == a->end)
+      continue;
+    if(a->end <= start || a->start >= end){
+      t[n++] = *a;
+      continue;
+    }
+    if(a->start < start){
+      if(n == NMADVISE)
+        return -1;
+      b = &t[n++];
+      *b = *a;
+      b->end = start;
+    }
+    if(a->end > end){
+      if(n == NMADVISE)
+        return -1;
+      b = &t[n++];
+      *b = *a;
+      b->start = end;
+    }
+  }
+  if(advice != MADV_NORMAL){
+    if(n == NMADVISE)
+      return -1;
+    t[n].start = start;
+    t[n].end = end;
+    t[n++].advice = advice;
+  }
+  memset(p->madv, 0, sizeof(p->madv));
+  memmove(p->madv, t, n * sizeof(t[0]));
+  return 0;
+}
+
+// drops the page at va of the running process p for MADV_DONTNEED,
+// without writing it anywhere: a page of a private mapping is
+// unmapped, to be read or zeroed again when next touched, and one
+// of the heap maps the zero page. pinned pages, those of shared
+// mappings and those of the executable's image are left alone.
+static void
+dontneed(struct proc *p, uint64 va)
+{
+  pte_t *pte = walk(p->pagetable, va, 0);
+  struct vma *v;
+  struct execseg *s;
+  #if SELECTION != NONE
+    struct paging_meta_data *m = (p->pid > 1) ? pagemeta(p, va/PGSIZE, 0) : 0;
+    if(m && m->pinned)
+      return;
+  #endif
+
+  if(pte == 0 || (*pte & (PTE_V | PTE_PG)) == 0)
+    return;
+  if(va >= p->sz){
+    v = vmafind(p, va);
+    if(v->shm == 0 && (v->flags & MAP_SHARED) == 0)
+      uvmunmap(p->pagetable, va, 1, 1);
+    return;
+  }
+  if((*pte & PTE_V) && PTE2PA(*pte) == (uint64)zeropage)
+    return;
+  for(s = p->seg; s < p->seg + p->nseg; s++)
+    if(va >= s->vaddr && va < s->vaddr + s->filesz)
+      return;
+
+  if(*pte & PTE_V)
+    kfree((void*)PTE2PA(*pte));
+  #if SELECTION != NONE
+    if(m){
+      if(m->inUse){
+        removePage(p, va/PGSIZE);
+        p->pagesInMemory--;
+      }
+      m->inUse = 0;
+      freeSwapSlot(p, m->offset);
+      m->offset = -1;
+      m->file = 0;
+      if(p->policy->remove)
+        p->policy->remove(p, va/PGSIZE, 0);
+    }
+  #endif
+  *pte = PA2PTE(zeropage) | (PTE_FLAGS(*pte) & ~(PTE_W | PTE_D | PTE_PG)) | PTE_V | PTE_COW;
+  kdup(zeropage);
+}
+
+// madvise(): advice on how the running process will use its
+// pages under [va, va+len), va page-aligned, all in its heap or
+// its mappings. MADV_SEQUENTIAL and MADV_RANDOM set how far
+// swap_in() reads ahead there, MADV_NORMAL puts it back to
+// following the faults, MADV_WILLNEED brings swapped-out pages in
+// at once, as many as fit beside the pinned ones, and
+// MADV_DONTNEED drops them, see dontneed(). Returns 0, or -1.
+int
+uvmadvise(uint64 va, uint64 len, int adv)
+{
+  struct proc *p = myspace();
+  uint64 a, end = PGROUNDUP(va + len);
+  pte_t *pte;
+  int n = 0;
+
+  if(va % PGSIZE != 0 || len == 0 || end < va)
+    return -1;
+  for(a = va; a < end; a += PGSIZE)
+    if(!useraddr(p, a))
+      return -1;
+
+  switch(adv){
+  case MADV_NORMAL:
+  case MADV_RANDOM:
+  case MADV_SEQUENTIAL:
+    return setadvice(p, va, end, adv);
+  case MADV_WILLNEED:
+    // swap_in() sleeps: kswapd and p's threads must keep off
+    vmsettle(p);
+    vmlock(p);
+    for(a = va; a < end && n < p->maxPsycPages - p->npinned; a += PGSIZE){
+      if((pte = walk(p->pagetable, a, 0)) != 0 && (*pte & PTE_PG)){
+        uvmtranslate(p->pagetable, a, 0);
+        n++;
+      }
+    }
+    tcflush(p);
+    vmunlock(p);
+    return 0;
+  case MADV_DONTNEED:
+    vmsettle(p);
+    vmlock(p);
+    for(a = va; a < end; a += PGSIZE)
+      dontneed(p, a);
+    tcflush(p);
+    sfence_vma();
+    vmunlock(p);
+    return 0;
   }
+  return -1;
 }
 
 // Remove npages of mappings starting from va. va must be
@@ -200,6 +885,18 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
+  // the paging metadata belongs to the running process, so leave it
+  // alone when tearing down another page table (e.g. wait() freeing a child).
+  struct proc *p = myspace();
+  int owner = (p != 0 && p->pagetable == pagetable);
+  #if SELECTION != NONE
+    struct paging_meta_data *m;
+  #endif
+
+  // the frames must not be in use by other threads when freed
+  if(owner && do_free)
+    tlbstop(p);
+
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){    
     if((pte = walk(pagetable, a, 0)) != 0){
       if((*pte & PTE_V) != 0){
@@ -209,27 +906,49 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
           uint64 pa = PTE2PA(*pte);
           kfree((void*)pa);
           #if SELECTION != NONE
-            if(a/PGSIZE < 32){
-              // no longer will be in memory
-              myproc()->data[a/PGSIZE].inUse = 0;
-              myproc()->pagesInMemory = (myproc()->pagesInMemory == 0) ? 0 : myproc()->pagesInMemory - 1;
-              myproc()->data[a/PGSIZE].offset = -1;
-              // removing the specified page (not in memory) from the queue
-              removePage(a/PGSIZE);
+            if(owner && (m = pagemeta(p, a/PGSIZE, 0)) != 0){
+              // no longer will be in memory (a shared segment's
+              // page never was, as far as p's paging goes)
+              // only a resident page is queued: a zero-page
+              // ghost's links are ARC's (see evictstart())
+              if(m->inUse){
+                removePage(p, a/PGSIZE);
+                if(p->pagesInMemory > 0)
+                  p->pagesInMemory--;
+              }
+              if(m->pinned)
+                p->npinned--;
+              m->pinned = 0;
+              m->locked = 0;
+              m->inUse = 0;
+              freeSwapSlot(p, m->offset);
+              m->offset = -1;
+              m->file = 0;
+              if(p->policy->remove)
+                p->policy->remove(p, a/PGSIZE, 0);
             }
           #endif
         }
       }
       else{
         #if SELECTION != NONE
-          if(a/PGSIZE < 32)
-            myproc()->data[a/PGSIZE].offset = -1;
+          if(owner && (m = pagemeta(p, a/PGSIZE, 0)) != 0){
+            // the page was swapped out, its slot in the file is free again
+            if((*pte & PTE_PG) && !m->file)
+              freeSwapSlot(p, m->offset);
+            m->offset = -1;
+            m->file = 0;
+            if(p->policy->remove)
+              p->policy->remove(p, a/PGSIZE, 0);
+          }
         #endif
       }
       // remove it to avoid page out
       *pte = 0; 
     }
   }
+  if(owner && do_free)
+    tlbstart(p);
 }
 
 // create an empty user page table.
@@ -238,10 +957,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -255,8 +973,7 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -274,12 +991,11 @@ NONE_uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -289,21 +1005,76 @@ NONE_uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
   return newsz;
 }
 
-// returning the first empty offset for a page that is not in use
+// resets the swap-file slot allocator of p to an empty file
+void
+initSwapSlots(struct proc* p)
+{
+  p->numOfFreeSlots = 0;
+  p->nextSlot = 0;
+}
+
+// returns a free offset in the swap file in O(1):
+// a released slot if there is one, otherwise the next unused page
+uint
+allocSwapSlot(struct proc* p)
+{
+  if(swapdevice()){
+    uint off = swapalloc();
+    if(off == -1)
+      panic("allocSwapSlot: swap area full");
+    return off;
+  }
+  if(p->numOfFreeSlots > 0)
+    return p->freeSlots[--p->numOfFreeSlots] * PGSIZE;
+  if(p->nextSlot >= SWAPFILE_PAGES)
+    panic("allocSwapSlot: swap file full");
+  return p->nextSlot++ * PGSIZE;
+}
+
+// hands out n consecutive slots from the end of the swap file.
+// returns the offset of the first one, or -1 if the file has no room.
 uint
-getOffset()
+allocSwapRun(struct proc* p, int n)
+{
+  if(swapdevice())
+    return swapallocrun(n);
+  if(p->nextSlot + n > SWAPFILE_PAGES)
+    return -1;
+  p->nextSlot += n;
+  return (p->nextSlot - n) * PGSIZE;
+}
+
+// gives a swap-file offset back to the allocator
+void
+freeSwapSlot(struct proc* p, uint offset)
+{
+  if(offset == -1)
+    return;
+  if(ZSWAPPED(offset)){
+    zswapfree(offset);
+    return;
+  }
+  if(swapdevice()){
+    swapfree(offset);
+    return;
+  }
+  if(p->numOfFreeSlots >= SWAPFILE_PAGES)
+    panic("freeSwapSlot");
+  p->freeSlots[p->numOfFreeSlots++] = offset / PGSIZE;
+}
+
+// gives back every slot p's swapped-out pages hold,
+// when its image is replaced or it exits
+void
+releaseSwapSlots(struct proc* p)
 {
-  struct proc* p = myproc();
-  uint found = 0;
-  for(int i = 0; i < p->sz && !found; i += PGSIZE){
-    int inUse = 0;
-    for(int j = 0; j < MAX_TOTAL_PAGES && !inUse; j++)
-      if(p->data[j].offset == i)
-        inUse = 1; 
-    if(inUse == 0)
-      return i;
+  struct paging_meta_data *m;
+
+  for(int i = nextSwappedPage(p, 0); i >= 0; i = nextSwappedPage(p, i + 1)){
+    m = pagemeta(p, i, 0);
+    freeSwapSlot(p, m->offset);
+    m->offset = -1;
   }
-  return found;
 }
 
 uint64
@@ -314,52 +1085,53 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
   #endif
   char *mem;
   uint64 a;
-  struct proc* p = myproc();
+  struct proc* p = myspace();
+  struct paging_meta_data *m;
   if(newsz < oldsz)
     return oldsz;
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
+    if(p != 0 && p->pagetable == pagetable){
+      // the running process growing: its new pages read as the
+      // zero page until they are written (exec() fills its own)
+      if(mapzero(pagetable, a) < 0){
+        uvmdealloc(pagetable, a, oldsz);
+        return 0;
+      }
+      continue;
+    }
     if(p->pid > 1){
-      uint64 numOfPages = a/PGSIZE;
-      if(numOfPages > MAX_TOTAL_PAGES)
-        return -1;
-      if(p->pagesInMemory >= MAX_PSYC_PAGES){
-        page_to_file(p, getOffset());
-        mem = kalloc();
-        if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U) < 0) {
-          uvmdealloc(pagetable, newsz, oldsz);
-          return 0;
-        }
-        p->data[numOfPages].inUse = 1;
-        p->pagesInMemory += 1;
-        p->data[numOfPages].offset = -1;
-        p->data[numOfPages].agingCounter = initAging(numOfPages);
+      if((m = pagemeta(p, a/PGSIZE, 1)) == 0){
+        uvmdealloc(pagetable, a, oldsz);
+        return 0;
       }
-      else {
-        mem = kalloc();
-        if(mem == 0){
-          uvmdealloc(pagetable, a, oldsz);
-          return 0;
-        }
-        memset(mem, 0, PGSIZE);
-        if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) < 0){
-          kfree(mem);
-          uvmdealloc(pagetable, a, oldsz);
-          return 0;
-        }
-        p->data[numOfPages].inUse = 1;
-        p->pagesInMemory += 1;
-        p->data[numOfPages].agingCounter = initAging(numOfPages);
+      // exec()'s new image: p->pagetable is still the old one,
+      // so none of p's pages can go now. exec() trims p once it
+      // commits, see uvmtrim(); kswapd can free others' meanwhile.
+      if(kfreepages() < LOWFRAMES + 1)
+        kswapdwake();
+      mem = kalloc_zeroed();
+      if(mem == 0){
+        uvmdealloc(pagetable, a, oldsz);
+        return 0;
+      }
+      if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) < 0){
+        kfree(mem);
+        uvmdealloc(pagetable, a, oldsz);
+        return 0;
       }
+      m->inUse = 1;
+      p->pagesInMemory += 1;
+      m->offset = -1;
+      m->agingCounter = initAging(a/PGSIZE);
     }
     else {
-      mem = kalloc();
+      mem = kalloc_zeroed();
         if(mem == 0){
           uvmdealloc(pagetable, a, oldsz);
           return 0;
         }
-        memset(mem, 0, PGSIZE);
         if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
           kfree(mem);
           uvmdealloc(pagetable, a, oldsz);
@@ -370,20 +1142,98 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
   return newsz;
 }
 
-// Deallocate user pages to bring the process size from oldsz to
-// newsz.  oldsz and newsz need not be page-aligned, nor does newsz
-// need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
-uint64
-uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
+// Map the zero page at va in pagetable, for a page that should
+// read as zeros and has not been written yet. It takes no frame
+// and is not resident as far as paging goes: the first write,
+// through uvmcow(), gives it a frame of its own. Returns 0, or -1
+// if out of memory for the page table.
+static int
+mapzero(pagetable_t pagetable, uint64 va)
 {
-  if(newsz >= oldsz)
-    return oldsz;
+  if(mappages(pagetable, va, PGSIZE, (uint64)zeropage, PTE_X|PTE_R|PTE_U|PTE_COW) != 0)
+    return -1;
+  kdup(zeropage);
+  return 0;
+}
 
-  if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
-    int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
-    uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
-  }
+// is the page at pa all zeros?
+static int
+allzero(char *pa)
+{
+  uint64 *w = (uint64*)pa;
+
+  for(int i = 0; i < PGSIZE / sizeof(uint64); i++)
+    if(w[i])
+      return 0;
+  return 1;
+}
+
+// Give p a zeroed page at va, an address below p->sz that a lazy
+// sbrk() has not allocated yet, or the page of an mmap() region
+// there. Unless write, a page below p->sz is just the zero page
+// (see mapzero()). Otherwise, for processes that page, the page is
+// accounted for like one from uvmalloc(). Returns 0 on success, -1
+// if va is not such an address or the page cannot be had.
+int
+uvmlazy(struct proc *p, uint64 va, int write)
+{
+  char *mem;
+  pte_t *pte;
+  struct vma *v;
+  uint64 a = PGROUNDDOWN(va);
+  #if SELECTION != NONE
+    struct paging_meta_data *m = 0;
+  #endif
+
+  if(va >= MAXVA)
+    return -1;
+  if((pte = walk(p->pagetable, a, 0)) != 0 && (*pte & (PTE_V | PTE_PG)) != 0)
+    return -1;
+  if(va >= p->sz){
+    if((v = vmafind(p, va)) == 0)
+      return -1;
+    return mmappage_in(p, v, a);
+  }
+  if(!write)
+    return mapzero(p->pagetable, a);
+  #if SELECTION != NONE
+    if(p->pid > 1){
+      if((m = pagemeta(p, a/PGSIZE, 1)) == 0)
+        return -1;
+      makeroom(p, 1, SWAP_BATCH);
+    }
+  #endif
+  if((mem = kalloc_zeroed()) == 0)
+    return -1;
+  if(mappages(p->pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  #if SELECTION != NONE
+    if(p->pid > 1){
+      m->inUse = 1;
+      p->pagesInMemory += 1;
+      m->offset = -1;
+      m->agingCounter = initAging(a/PGSIZE);
+    }
+  #endif
+  return 0;
+}
+
+// Deallocate user pages to bring the process size from oldsz to
+// newsz.  oldsz and newsz need not be page-aligned, nor does newsz
+// need to be less than oldsz.  oldsz can be larger than the actual
+// process size.  Returns the new process size.
+uint64
+uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
+{
+  if(newsz >= oldsz)
+    return oldsz;
+
+  if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
+    int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
+    uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
+  }
 
   return newsz;
 }
@@ -427,32 +1277,178 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
+  return uvmcopyrange(old, new, 0, sz, 0);
+}
+
+// the same for the pages from start to end. if share, they stay
+// writable and shared, else they become copy-on-write.
+int
+uvmcopyrange(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int share)
+{
+  pte_t *pte, *npte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){    
+  for(i = start; i < end; i += PGSIZE){
     if((pte = walk(old, i, 0)) !=0 && (*pte & PTE_V) != 0){
+      // share the page; whoever writes to it first gets a copy.
       pa = PTE2PA(*pte);
+      if((*pte & PTE_W) && !share)
+        *pte = (*pte & ~PTE_W) | PTE_COW;
       flags = PTE_FLAGS(*pte);
-      if((mem = kalloc()) == 0)
+      if(mappages(new, i, PGSIZE, pa, flags) != 0)
         goto err;
-      memmove(mem, (char*)pa, PGSIZE);
-      if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-        kfree(mem);
+      kdup((void*)pa);
+    } else if(pte != 0 && (*pte & PTE_PG) != 0){
+      // swapped out: the child finds it through its own
+      // copy of the paging data (see copySwapFile()).
+      if((npte = walk(new, i, 1)) == 0)
         goto err;
-      }
+      *npte = PTE_FLAGS(*pte);
     }
-    
   }
+  sfence_vma();
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, start, (i - start) / PGSIZE, 1);
   return -1;
 }
 
+// Is the page at va on p's resident queue? The zero page may
+// stand behind one (see evictstart()).
+static int
+pageresident(struct proc *p, uint64 va)
+{
+  #if SELECTION != NONE
+    struct paging_meta_data *m;
+
+    if(p->pid > 1 && va < p->sz && (m = pagemeta(p, va/PGSIZE, 0)) != 0)
+      return m->inUse;
+  #endif
+  return 0;
+}
+
+static int
+cowpage(struct proc *p, pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_COW) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+  if((char*)pa == zeropage && p != 0 && p->pagetable == pagetable && !pageresident(p, va)){
+    // the first write to a page that was all zeros: it gets a
+    // frame of its own, accounted for like any other
+    *pte = 0;
+    sfence_vma();
+    kfree(zeropage);
+    return uvmlazy(p, va, 1);
+  }
+  if((char*)pa == zeropage){
+    // already accounted for as resident: just a frame of its own
+    if((mem = kalloc_zeroed()) == 0)
+      return -1;
+    *pte = PA2PTE(mem) | flags;
+    kfree(zeropage);
+  } else if(krefcount((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+  } else {
+    if((mem = kalloc()) == 0)
+      return -1;
+    pagecopy(mem, (char*)pa);
+    *pte = PA2PTE(mem) | flags;
+    kfree((void*)pa);
+  }
+  sfence_vma();
+  return 0;
+}
+
+// Give the copy-on-write page at va a private, writable frame.
+// The last process sharing a frame just takes it over.
+// Returns 0 on success, -1 if va is not a copy-on-write
+// page or there is no memory for the copy.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myspace();
+  int owner = (p != 0 && p->pagetable == pagetable), r;
+
+  // the old frame may be in the TLBs of p's other threads
+  if(owner)
+    tlbstop(p);
+  r = cowpage(p, pagetable, va);
+  if(owner)
+    tlbstart(p);
+  return r;
+}
+
+// Lend out the frame behind the user page at va, e.g. to a
+// pipe: it becomes copy-on-write here and gains a reference
+// for the caller. Returns its address, or 0 if the page isn't
+// resident (not yet touched, or swapped out) or is the zero
+// page, in which case the caller should copy. The paging data doesn't change: the
+// page stays resident in this process. The pages of mmap()
+// regions are never lent: they may be shared writable. Nor are
+// those of a process with threads, which might still be writing
+// the page through their TLBs.
+uint64
+uvmlend(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myspace();
+  pte_t *pte;
+  uint64 pa;
+
+  if(va >= MAXVA || vmafind(p, va) || p->nthreads > 1)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_R) == 0)
+    return 0;
+  if((char*)PTE2PA(*pte) == zeropage)
+    return 0;
+  if(*pte & PTE_W){
+    *pte = (*pte & ~PTE_W) | PTE_COW;
+    sfence_vma();
+  }
+  pa = PTE2PA(*pte);
+  kdup((void*)pa);
+  return pa;
+}
+
+// Map the frame pa, copy-on-write, in place of the resident
+// writable user page at va, and drop the frame it had. Takes
+// over the caller's reference to pa. Returns 0, or -1 if the
+// page is not resident or not writable, or is in an mmap() region,
+// or either page is the zero page, which the first write gives a
+// frame, or the process has threads (see uvmlend()).
+int
+uvmtake(pagetable_t pagetable, uint64 va, uint64 pa)
+{
+  struct proc *p = myspace();
+  pte_t *pte;
+  uint64 old;
+
+  if(va >= MAXVA || vmafind(p, va) || p->nthreads > 1)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & (PTE_W|PTE_COW)) == 0)
+    return -1;
+  if((char*)PTE2PA(*pte) == zeropage || (char*)pa == zeropage)
+    return -1;
+  old = PTE2PA(*pte);
+  *pte = PA2PTE(pa) | ((PTE_FLAGS(*pte) & ~PTE_W) | PTE_COW | PTE_D);
+  sfence_vma();
+  kfree((void*)old);
+  return 0;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -466,6 +1462,34 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// A copy under a spinlock (a pipe's, the console's) by a process
+// with threads must not take vmlock(): another thread may hold it
+// asleep in swap I/O. It only uses resident pages, ones uvmpin()
+// brought in beforehand, see uvmresident().
+static int
+copypinned(void)
+{
+  struct proc *p = myspace();
+
+  return p != 0 && p->nthreads > 1 && !intr_get();
+}
+
+// The physical address of the user page at va, if it is resident
+// and, for write, writable; 0 if not. Never faults or sleeps.
+static uint64
+uvmresident(pagetable_t pagetable, uint64 va, int write)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA || (pte = walk(pagetable, va, 0)) == 0)
+    return 0;
+  if((*pte & (PTE_V | PTE_U)) != (PTE_V | PTE_U) || (write && (*pte & PTE_W) == 0))
+    return 0;
+  if(write)
+    *pte |= PTE_D;   // written behind the hardware's back
+  return PTE2PA(*pte);
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -473,12 +1497,17 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  int r = 0, pinned = copypinned();
 
+  if(!pinned)
+    vmlock(myspace());
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    pa0 = pinned ? uvmresident(pagetable, va0, 1) : uvmtranslate(pagetable, va0, 1);
+    if(pa0 == 0){
+      r = -1;
+      break;
+    }
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -488,7 +1517,9 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
     src += n;
     dstva = va0 + PGSIZE;
   }
-  return 0;
+  if(!pinned)
+    vmunlock(myspace());
+  return r;
 }
 
 // Copy from user to kernel.
@@ -498,12 +1529,17 @@ int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  int r = 0, pinned = copypinned();
 
+  if(!pinned)
+    vmlock(myspace());
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    pa0 = pinned ? uvmresident(pagetable, va0, 0) : uvmtranslate(pagetable, va0, 0);
+    if(pa0 == 0){
+      r = -1;
+      break;
+    }
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
@@ -513,7 +1549,9 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
     dst += n;
     srcva = va0 + PGSIZE;
   }
-  return 0;
+  if(!pinned)
+    vmunlock(myspace());
+  return r;
 }
 
 // Copy a null-terminated string from user to kernel.
@@ -524,13 +1562,15 @@ int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
   uint64 n, va0, pa0;
-  int got_null = 0;
+  int got_null = 0, pinned = copypinned();
 
+  if(!pinned)
+    vmlock(myspace());
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = pinned ? uvmresident(pagetable, va0, 0) : uvmtranslate(pagetable, va0, 0);
     if(pa0 == 0)
-      return -1;
+      break;
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
@@ -552,6 +1592,8 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
     srcva = va0 + PGSIZE;
   }
+  if(!pinned)
+    vmunlock(myspace());
   if(got_null){
     return 0;
   } else {
@@ -565,39 +1607,48 @@ nfua(struct proc* p)
 {
   uint min = (1L << 31);
   int index = -1;
-  for(int i = 3; i < MAX_TOTAL_PAGES; i++){ 
-    if(p->data[i].inUse && p->data[i].agingCounter < min){
-      min = p->data[i].agingCounter;
+  struct paging_meta_data *m;
+  for(int i = p->head; i != -1; i = m->next){
+    m = pagemeta(p, i, 0);
+    if(i >= 3 && m->inUse && m->agingCounter < min){
+      min = m->agingCounter;
       index = i;
     }
   }
   return index;
 }
 
-// counts the number of 1's in age (GEEKS FOR GEEKS)
+// counts the number of 1's in age, without a loop over the bits.
+// (no __builtin_popcount: without Zbb it would call into libgcc.)
 int 
 countOnes(uint age){
-  unsigned int count = 0;
-  while(age){
-    count += age & 1;
-    age >>= 1;
-  }
+#ifdef __riscv_zbb
+  uint64 count;
+  asm volatile("cpopw %0, %1" : "=r" (count) : "r" (age));
   return count;
+#else
+  age = age - ((age >> 1) & 0x55555555);
+  age = (age & 0x33333333) + ((age >> 2) & 0x33333333);
+  age = (age + (age >> 4)) & 0x0F0F0F0F;
+  return (age * 0x01010101) >> 24;
+#endif
 }
 
+// the page with the fewest 1's in its aging counter, the smallest
+// counter among those. (ones, age) is packed into one 64-bit key so
+// each page costs a single compare.
 int 
 lapa(struct proc* p){
-  int minOnes = -1;
-  int minAge = -1;
+  uint64 minKey = -1;
   int pageIndex = -1;
-  for(int i = 3; i < MAX_TOTAL_PAGES; i++){
-    if(p->data[i].inUse ){
-      uint age = p->data[i].agingCounter;
-      int numOfOnes = countOnes(age);
-      // if number of 1's is too small * or * it equals and then we take min age
-      if(minOnes == -1 || numOfOnes < minOnes || (numOfOnes == minOnes && age < minAge)){
-        minOnes = numOfOnes;
-        minAge = age;
+  struct paging_meta_data *m;
+  for(int i = p->head; i != -1; i = m->next){
+    m = pagemeta(p, i, 0);
+    if(i >= 3 && m->inUse){
+      uint age = m->agingCounter;
+      uint64 key = ((uint64)countOnes(age) << 32) | age;
+      if(key < minKey){
+        minKey = key;
         pageIndex = i;
       }
     }
@@ -610,117 +1661,798 @@ scfifo(struct proc* p)
 {
   int page;
   for(int i = 0; i < p->numOfPages; i++){
-    page = p->pages[p->head];
-    pte_t * pte = walk(p->pagetable, page*PGSIZE, 0);
+    page = out(p);
+    pte_t * pte = walk(p->pagetable, (uint64)page*PGSIZE, 0);
     uint pte_flags = PTE_FLAGS(*pte);
     if((pte_flags & PTE_A)){
-      *pte = *pte & (~PTE_A);
-      out();
-      in(page);
+      // second chance: move it to the back of the queue
+      clearaccessed(pte);
+      in(p, page);
     }
-    else{ 
-      out();
+    else
       return page;
-    }
   }
-  page = p->pages[p->head];
-  out();
-  return page;
+  if(p->head == -1)
+    return -1;
+  return out(p);
 }
 
-// By algorithm, returns which page index should we swap to file
+// By p's policy, returns which page index of p should we swap to file
 int
-getIndexToRemove(void)
+getIndexToRemove(struct proc *p)
 {
-  #if SELECTION == NFUA
-    struct proc* p = myproc();
-    return nfua(p);
-  #endif
-  #if SELECTION == LAPA
-    struct proc* p = myproc();
-    return lapa(p);
-  #endif
-  #if SELECTION == SCFIFO
-    struct proc* p = myproc();
-    return scfifo(p);
+  return p->policy->victim(p);
+}
+
+// p's policy's choice of a victim, for kbench(): p's pages stay
+// resident, and a page the policy took off the queue (scfifo)
+// goes back at its end. -1 if there is none.
+int
+peekvictim(struct proc *p)
+{
+  int index = getIndexToRemove(p);
+  struct paging_meta_data *m;
+
+  if(index >= 0 && (m = pagemeta(p, index, 0)) != 0 && !queued(p, index, m))
+    in(p, index);
+  return index;
+}
+
+// the first half of a swap-out: picks up to n (at most SWAP_BATCH)
+// victims of p by the SELECTION policy, unmaps them and gives each
+// dirty one a slot, consecutive at the end of the file when there
+// is room. victims not written since they were read in (PTE_D
+// clear) still have a copy in their slot or in a file and need no
+// slot, nor do dirty pages of shared file mappings, which go back
+// to their files, nor heap pages that are all zeros: they map the
+// zero page again. never sleeps. returns the number of victims.
+int
+evictstart(struct proc *p, int n, struct evict *e)
+{
+  int index, clean, i;
+  pte_t *pte;
+  struct paging_meta_data *m;
+  struct vma *v;
+
+  if(n > SWAP_BATCH)
+    n = SWAP_BATCH;
+  e->start = r_time();
+  e->ndirty = 0;
+  e->nwb = 0;
+  e->nz = 0;
+  for(e->count = 0; e->count < n && e->count < p->pagesInMemory; e->count++){
+    if((index = getIndexToRemove(p)) < 0)
+      break;
+    // taken out of the candidates so the next pick differs
+    m = pagemeta(p, index, 0);
+    m->inUse = 0;
+    removePage(p, index);
+    if(p->policy->remove)
+      p->policy->remove(p, index, 1);
+    pte = walk(p->pagetable, (uint64)index*PGSIZE, 0);
+    e->pages[e->count] = (char*)PTE2PA(*pte);
+    clean = (*pte & PTE_D) == 0 && (m->file || m->offset != -1);
+    TRACEPOINT(TR_EVICT, (uint64)index*PGSIZE | clean, m->agingCounter);
+    if(!clean && (uint64)index*PGSIZE < p->sz && allzero(e->pages[e->count])){
+      freeSwapSlot(p, m->offset);
+      m->offset = -1;
+      m->file = 0;
+      *pte = PA2PTE(zeropage) | (PTE_FLAGS(*pte) & ~(PTE_W | PTE_D)) | PTE_COW;
+      kdup(zeropage);
+      p->pagesInMemory -= 1;
+      continue;
+    }
+    if(!clean && m->file && (v = vmafind(p, (uint64)index*PGSIZE)) != 0 &&
+       v->f && (v->flags & MAP_SHARED)){
+      e->wb[e->nwb] = e->pages[e->count];
+      e->wbva[e->nwb++] = (uint64)index*PGSIZE;
+    } else if(!clean){
+      // whatever copy there was is stale
+      freeSwapSlot(p, m->offset);
+      m->file = 0;
+      e->dirty[e->ndirty] = e->pages[e->count];
+      e->meta[e->ndirty++] = m;
+    }
+    *pte = (*pte & ~(PTE_V | PTE_D)) | PTE_PG;
+    p->pagesInMemory -= 1;
+  }
+
+  #if ZSWAP
+    // those that compress stay in memory, see zswap.c
+    e->nz = 0;
+    for(i = 0; i < e->ndirty; i++){
+      uint z = zswapstore(e->dirty[i]);
+      if(z != -1){
+        e->meta[i]->offset = z;
+        e->nz++;
+      } else {
+        e->dirty[i - e->nz] = e->dirty[i];
+        e->meta[i - e->nz] = e->meta[i];
+      }
+    }
+    e->ndirty -= e->nz;
   #endif
-  return 0;
+  if(e->ndirty > 0){
+    uint run = allocSwapRun(p, e->ndirty);
+    for(i = 0; i < e->ndirty; i++){
+      e->offsets[i] = (run != -1) ? run + i*PGSIZE : allocSwapSlot(p);
+      e->meta[i]->offset = e->offsets[i];
+    }
+  }
+  sfence_vma();
+  return e->count;
 }
 
-// swaps a page in ram to the file
+// the second half: writes the dirty victims out, in one log
+// transaction, and frees their frames.
 void
-page_to_file(struct proc* p, uint pageOffset)
+evictend(struct proc *p, struct evict *e)
 {
-  int index = getIndexToRemove();
-  pte_t *pte =  walk(p->pagetable, index*PGSIZE, 0); 
-  uint64 pha = PTE2PA(*pte);
-  if(writeToSwapFile(p, (char*)pha, pageOffset, PGSIZE) < 0)
+  struct proc *me = myproc();
+
+  me->swapwait++;
+  if(e->ndirty > 0 && writePagesToSwapFile(p, e->dirty, e->offsets, e->ndirty) < 0)
     panic("write to file failed");
-  kfree((void*)pha);
-  *pte = (*pte & (~PTE_V)) | PTE_PG;
-  p->data[index].offset = pageOffset;
-  p->data[index].inUse = 0;
-  p->pagesInMemory -= 1;
+  for(int i = 0; i < e->nwb; i++)
+    mmapwrite(vmafind(p, e->wbva[i]), e->wbva[i], e->wb[i]);
+  me->swapwait--;
+  for(int i = 0; i < e->count; i++)
+    kfree((void*)e->pages[i]);
+  p->stats.swapouts += e->ndirty + e->nwb + e->nz;
+  p->stats.wbytes += (uint64)(e->ndirty + e->nwb) * PGSIZE;
+  p->stats.drops += e->count - e->ndirty - e->nwb - e->nz;
+  p->stats.outtime += r_time() - e->start;
+}
+
+// swaps up to n (at most SWAP_BATCH) of p's pages out.
+// returns the number of pages swapped out.
+int
+page_to_file(struct proc* p, int n)
+{
+  struct evict e;
+  int k;
+
+  // kswapd may still be writing some of p's pages out, to the
+  // swap file it is giving p (see createSwapFile())
+  vmsettle(p);
+  // p's other threads stay out while the victims are unmapped
+  tlbstop(p);
+  k = evictstart(p, n, &e);
+  tlbstart(p);
+  if(k == 0)
+    panic("page_to_file: no victim");
+  evictend(p, &e);
+  return e.count;
+}
+
+// makes room for n more resident pages of p, evicting at least
+// batch pages at a time. the other policies hold p to its own
+// limit; GLOBAL lets it grow until the machine runs short of
+// frames, and then takes them from whichever processes the
+// global clock comes to, see reclaim(). kswapd is woken to do
+// that in the background well before p has to do it itself.
+static void
+makeroom(struct proc *p, int n, int batch)
+{
+  int need, nfree = kfreepages();
+
+  if(nfree < LOWFRAMES + n)
+    kswapdwake();
+  #if SELECTION == GLOBAL
+    need = MINFRAMES + n - nfree;
+    if(need > 0)
+      reclaim(need > batch ? need : batch);
+  #else
+    need = p->pagesInMemory + n - p->maxPsycPages;
+    if(need > 0 && need < batch)
+      need = batch;
+    while(need > 0)
+      need -= page_to_file(p, need);
+  #endif
+}
+
+// evicts what p has resident past its limit (or, for GLOBAL, what
+// the machine is short of), for exec(), which loads a new image
+// without evicting any of it.
+void
+uvmtrim(struct proc *p)
+{
+  #if SELECTION != NONE
+    if(p->pid > 1)
+      makeroom(p, 0, SWAP_BATCH);
+  #endif
+}
+
+// reads the page at va, which exec() left behind, from the
+// executable. it stays backed by it until it is written.
+static void
+execpage_in(struct proc *p, uint64 va, pte_t *pte)
+{
+  struct paging_meta_data *m = pagemeta(p, va/PGSIZE, 0);
+  struct execseg *s;
+  char *mem;
+  uint n;
+
+  for(s = p->seg; s < p->seg + p->nseg; s++)
+    if(va >= s->vaddr && va < s->vaddr + s->filesz)
+      break;
+  if(s == p->seg + p->nseg || p->execip == 0)
+    panic("execpage_in");
+
+  makeroom(p, 1, 1);
+  n = s->vaddr + s->filesz - va;
+  if(n > PGSIZE)
+    n = PGSIZE;
+  myproc()->swapwait++;
+  ilock(p->execip);
+  if((*pte & PTE_W) == 0){
+    // text: the page every process running the program maps
+    if((mem = textget(p->execip, s->off + (va - s->vaddr), n)) == 0)
+      panic("execpage_in: text");
+  } else {
+    if((mem = kalloc_zeroed()) == 0)
+      panic("Fail in kalloc while handling page fault");
+    if(readi(p->execip, 0, (uint64)mem, s->off + (va - s->vaddr), n) != n)
+      panic("execpage_in: read");
+  }
+  iunlock(p->execip);
+  myproc()->swapwait--;
+
+  *pte = PA2PTE((uint64)mem) | ((PTE_FLAGS(*pte) & ~(PTE_PG | PTE_D)) | PTE_V);
+  m->agingCounter = initAging(va/PGSIZE);
+  m->inUse = 1;
+  p->pagesInMemory += 1;
+  sfence_vma();
+}
+
+// gives p the page at va of mapping v, read from its file (or
+// zeroed) for the first time or again after it was dropped. a
+// file page stays backed by the file until it is written. that
+// of a shared segment is the one the segment has.
+static int
+mmappage_in(struct proc *p, struct vma *v, uint64 va)
+{
+  char *mem;
+  pte_t *pte;
+  #if SELECTION != NONE
+    struct paging_meta_data *m = 0;
+  #endif
+
+  if(v->shm){
+    // the segment's page, not paged with p's own (see shm.c)
+    if((mem = shmpage(v->shm, (v->off + (va - v->start)) / PGSIZE)) == 0)
+      return -1;
+    if((pte = walk(p->pagetable, va, 1)) == 0){
+      kfree(mem);
+      return -1;
+    }
+    *pte = PA2PTE((uint64)mem) | PTE_U | PTE_R | ((v->prot & PROT_WRITE) ? PTE_W : 0) | PTE_V;
+    sfence_vma();
+    return 0;
+  }
+  #if SELECTION != NONE
+    if(p->pid > 1){
+      if((m = pagemeta(p, va/PGSIZE, 1)) == 0)
+        return -1;
+      makeroom(p, 1, 1);
+    }
+  #endif
+  if((mem = kalloc_zeroed()) == 0)
+    return -1;
+  if(v->f){
+    myproc()->swapwait++;
+    mmapread(v, va, mem);
+    myproc()->swapwait--;
+  }
+  if((pte = walk(p->pagetable, va, 1)) == 0){
+    kfree(mem);
+    return -1;
+  }
+  *pte = PA2PTE((uint64)mem) | PTE_U | PTE_R | ((v->prot & PROT_WRITE) ? PTE_W : 0) | PTE_V;
+  #if SELECTION != NONE
+    if(p->pid > 1){
+      m->inUse = 1;
+      m->offset = -1;
+      m->file = (v->f != 0);
+      m->agingCounter = initAging(va/PGSIZE);
+      p->pagesInMemory += 1;
+    }
+  #endif
+  sfence_vma();
+  return 0;
 }
 
+// brings the page at va back from the swap file. while faults keep
+// hitting the page right after the previous one, the window of
+// following swapped-out pages read in along with it doubles, up to
+// SWAP_READAHEAD. victims are evicted first to make room for them all.
 void
 swap_in(struct proc * p, uint64 va, pte_t* pte)
 {
+  int index[SWAP_READAHEAD+1];
+  pte_t *ptes[SWAP_READAHEAD+1];
+  char *pages[SWAP_READAHEAD+1];
+  uint offsets[SWAP_READAHEAD+1];
+  int n, i;
+  uint64 start = r_time();
+
+  // another process may still be writing p's pages out
+  vmsettle(p);
+  p->nfaults++;
+  p->stats.majfaults++;
+  if(p->policy->fault)
+    p->policy->fault(p, PGROUNDDOWN(va) / PGSIZE);
+
   int missingPageIndex = PGROUNDDOWN(va) / PGSIZE;
-  if(p->data[missingPageIndex].offset == -1)
+  struct paging_meta_data *m = pagemeta(p, missingPageIndex, 0);
+  if(m != 0 && m->file){
+    struct vma *v = vmafind(p, PGROUNDDOWN(va));
+    if(v && v->f){
+      if(mmappage_in(p, v, PGROUNDDOWN(va)) < 0)
+        panic("Fail in kalloc while handling page fault");
+    } else
+      execpage_in(p, PGROUNDDOWN(va), pte);
+    TRACEPOINT(TR_SWAPIN, PGROUNDDOWN(va), 0);
+    p->stats.intime += r_time() - start;
+    return;
+  }
+  if(m == 0 || m->offset == -1)
     panic("Fail in handling page fault");
-  uint pageOffset = p->data[missingPageIndex].offset;
-  char* buff;
-  if((buff = kalloc()) == 0)
-    panic("Fail in kalloc while handling page fault");
-  readFromSwapFile(p, buff, pageOffset, PGSIZE);
-  if(p->pagesInMemory < MAX_PSYC_PAGES) {
-    *pte = PA2PTE((uint64)buff) | PTE_V;
-  }
-  else {
-    page_to_file(p, pageOffset);
-    *pte = PA2PTE((uint64)buff) | ((PTE_FLAGS(*pte) & ~PTE_PG) | PTE_V);
-  }
-  p->data[missingPageIndex].agingCounter = initAging(missingPageIndex);
-  p->data[missingPageIndex].offset = -1;
-  p->data[missingPageIndex].inUse = 1;
-  p->pagesInMemory += 1;
+  if(ZSWAPPED(m->offset)){
+    // still in memory, compressed: no disk I/O, nor read-ahead
+    makeroom(p, 1, 1);
+    if((pages[0] = kalloc()) == 0)
+      panic("Fail in kalloc while handling page fault");
+    zswapload(m->offset, pages[0]);
+    freeSwapSlot(p, m->offset);
+    m->offset = -1;
+    *pte = PA2PTE((uint64)pages[0]) | ((PTE_FLAGS(*pte) & ~(PTE_PG | PTE_D)) | PTE_V);
+    m->agingCounter = initAging(missingPageIndex);
+    m->inUse = 1;
+    p->pagesInMemory += 1;
+    p->lastFault = missingPageIndex;
+    sfence_vma();
+    TRACEPOINT(TR_SWAPIN, PGROUNDDOWN(va), 1);
+    p->stats.swapins++;
+    p->stats.intime += r_time() - start;
+    return;
+  }
+
+  // sequential access detection, unless madvise() said otherwise
+  int adv = advice(p, PGROUNDDOWN(va));
+  if(adv == MADV_SEQUENTIAL)
+    p->readAhead = SWAP_READAHEAD;
+  else if(adv == MADV_RANDOM)
+    p->readAhead = 0;
+  else if(missingPageIndex == p->lastFault + 1)
+    p->readAhead = (p->readAhead == 0) ? 1 : p->readAhead * 2;
+  else
+    p->readAhead = 0;
+  if(p->readAhead > SWAP_READAHEAD)
+    p->readAhead = SWAP_READAHEAD;
+  if(p->readAhead > p->maxPsycPages - 1)
+    p->readAhead = p->maxPsycPages - 1;
+
+  index[0] = missingPageIndex;
+  ptes[0] = pte;
+  for(n = 1; n <= p->readAhead; n++){
+    int page = missingPageIndex + n;
+    if((uint64)page*PGSIZE >= p->sz)
+      break;
+    pte_t *next = walk(p->pagetable, (uint64)page*PGSIZE, 0);
+    if(next == 0 || (*next & PTE_PG) == 0 || (m = pagemeta(p, page, 0)) == 0 || m->offset == -1 ||
+       ZSWAPPED(m->offset))
+      break;
+    index[n] = page;
+    ptes[n] = next;
+  }
+
+  // the pages being brought in are not candidates yet,
+  // so the victims are always other pages.
+  makeroom(p, n, 1);
+
+  for(i = 0; i < n; i++){
+    if((pages[i] = kalloc()) == 0){
+      if(i == 0)
+        panic("Fail in kalloc while handling page fault");
+      // no memory for the rest of the window, just read what we have
+      n = i;
+      break;
+    }
+    offsets[i] = pagemeta(p, index[i], 0)->offset;
+  }
+  p->lastFault = index[n-1];
+
+  // the slots are kept: until a page is written again, the
+  // copy there spares page_to_file() writing it out.
+  myproc()->swapwait++;
+  if(readPagesFromSwapFile(p, pages, offsets, n) < 0)
+    panic("read from file failed");
+  myproc()->swapwait--;
+
+  for(i = 0; i < n; i++){
+    *ptes[i] = PA2PTE((uint64)pages[i]) | ((PTE_FLAGS(*ptes[i]) & ~(PTE_PG | PTE_D)) | PTE_V);
+    m = pagemeta(p, index[i], 0);
+    m->agingCounter = initAging(index[i]);
+    m->inUse = 1;
+    p->pagesInMemory += 1;
+  }
   sfence_vma();
+  TRACEPOINT(TR_SWAPIN, PGROUNDDOWN(va), n);
+  p->stats.swapins += n;
+  p->stats.rbytes += (uint64)n * PGSIZE;
+  p->stats.intime += r_time() - start;
 }
 
-// initiats aging foreach page inserted in memory
+// initiats aging foreach page inserted in memory, and queues it
+// with the other resident pages. the policy sees the page first,
+// while its metadata still says where it was.
 uint
 initAging(int page)
 {
-  #if SELECTION == NFUA
-    return 0;
-  #endif
-  #if SELECTION == LAPA
-    return 0xFFFFFFFF;
-  #endif
-  #if SELECTION == SCFIFO
-    in(page);
+  struct proc *p = myspace();
+  uint age = p->policy->init(p, page);
+
+  // which queue it goes on may depend on it (ARC)
+  pagemeta(p, page, 0)->agingCounter = age;
+  in(p, page);
+  return age;
+}
+
+// a new page looks as if it was never used (NFUA, SCFIFO) ...
+static uint
+agenew(struct proc *p, int page)
+{
+  return 0;
+}
+
+// ... or as if it was used all the time (LAPA), so it is not the
+// first to go.
+static uint
+ageused(struct proc *p, int page)
+{
+  return 0xFFFFFFFF;
+}
+
+// ARC, in its clock form (CAR): a resident page is on T1 when it
+// has been seen once lately, on T2 when it was seen again while
+// resident or soon after being evicted. evicted pages are still
+// remembered for a while, as ghosts on B1 or B2 after the list they
+// left. a page coming back from B1 says T1 is too small, one from
+// B2 that T2 is, and the target size of T1, arc.p, moves that way.
+// a scan through a big buffer only churns T1 and B1, so the pages
+// on T2 outlive it. T1 is the resident queue, oldest first, and T2
+// a second one (see in()), so the oldest page of each is found at
+// once; m->agingCounter tells which a page is on. the ghosts of a
+// list are linked, oldest first, through the next and prev of their
+// metadata, which the queues do not use while they are out.
+
+static void
+arcreset(struct proc *p)
+{
+  memset(&p->arc, 0, sizeof(p->arc));
+  for(int b = 0; b < 2; b++){
+    p->arc.bhead[b] = -1;
+    p->arc.btail[b] = -1;
+  }
+  p->arc.thead = -1;
+  p->arc.ttail = -1;
+}
+
+// makes the evicted page a ghost, the newest on B1 or B2 (b = 1).
+static void
+ghostpush(struct proc *p, int b, int page)
+{
+  struct paging_meta_data *m = pagemeta(p, page, 0);
+
+  m->agingCounter = b ? ARC_B2 : ARC_B1;
+  m->next = -1;
+  m->prev = p->arc.btail[b];
+  if(p->arc.btail[b] == -1)
+    p->arc.bhead[b] = page;
+  else
+    pagemeta(p, p->arc.btail[b], 0)->next = page;
+  p->arc.btail[b] = page;
+  p->arc.nb[b]++;
+}
+
+// forgets the ghost page.
+static void
+ghostunlink(struct proc *p, int page)
+{
+  struct paging_meta_data *m = pagemeta(p, page, 0);
+  int b = (m->agingCounter == ARC_B2);
+
+  if(m->prev == -1)
+    p->arc.bhead[b] = m->next;
+  else
+    pagemeta(p, m->prev, 0)->next = m->next;
+  if(m->next == -1)
+    p->arc.btail[b] = m->prev;
+  else
+    pagemeta(p, m->next, 0)->prev = m->prev;
+  m->next = -1;
+  m->prev = -1;
+  m->agingCounter = 0;
+  p->arc.nb[b]--;
+}
+
+// a page coming in. a ghost goes on T2, moving the target after
+// the list that had it, by more when the other ghost list is the
+// longer one. any other page goes on T1, and the history keeps to
+// twice the resident limit, which is all ARC ever needs.
+static uint
+arcinit(struct proc *p, int page)
+{
+  struct paging_meta_data *m = pagemeta(p, page, 0);
+  struct arcstate *a = &p->arc;
+  int c = p->maxPsycPages, d;
+
+  if(m->agingCounter == ARC_B1){
+    d = a->nb[1] / a->nb[0];
+    a->p += (d > 1) ? d : 1;
+    if(a->p > c)
+      a->p = c;
+  } else if(m->agingCounter == ARC_B2){
+    d = a->nb[0] / a->nb[1];
+    a->p -= (d > 1) ? d : 1;
+    if(a->p < 0)
+      a->p = 0;
+  } else {
+    if(a->nt[0] + a->nb[0] >= c && a->nb[0] > 0)
+      ghostunlink(p, a->bhead[0]);
+    else if(a->nt[0] + a->nt[1] + a->nb[0] + a->nb[1] >= 2*c && a->nb[1] > 0)
+      ghostunlink(p, a->bhead[1]);
+    a->nt[0]++;
+    return ARC_T1;
+  }
+  ghostunlink(p, page);
+  a->nt[1]++;
+  return ARC_T2;
+}
+
+// a page leaving memory: to swap it becomes a ghost, otherwise it
+// is forgotten, as is a ghost that is unmapped.
+static void
+arcremove(struct proc *p, int page, int evicted)
+{
+  struct paging_meta_data *m = pagemeta(p, page, 0);
+  int b;
+
+  switch(m->agingCounter){
+  case ARC_T1:
+  case ARC_T2:
+    b = (m->agingCounter == ARC_T2);
+    p->arc.nt[b]--;
+    if(evicted)
+      ghostpush(p, b, page);
+    else
+      m->agingCounter = 0;
+    break;
+  case ARC_B1:
+  case ARC_B2:
+    ghostunlink(p, page);
+    break;
+  }
+}
+
+// the oldest page of T1 while T1 is at or over its target, else
+// the oldest of T2. a page used since it was looked at last (PTE_A)
+// gets another chance at the back of T2 instead.
+int
+arc(struct proc *p)
+{
+  struct arcstate *a = &p->arc;
+  struct paging_meta_data *m;
+  int page, list;
+  pte_t *pte;
+
+  for(int n = 0; n < 2 * p->numOfPages + 1; n++){
+    list = (a->nt[0] >= (a->p > 1 ? a->p : 1)) ? ARC_T1 : ARC_T2;
+    page = (list == ARC_T1) ? p->head : a->thead;
+    if(page == -1){
+      // the other list has all the candidates (the rest are pinned)
+      list = ARC_T1 + ARC_T2 - list;
+      page = (list == ARC_T1) ? p->head : a->thead;
+      if(page == -1)
+        return -1;
+    }
+    m = pagemeta(p, page, 0);
+    pte = walk(p->pagetable, (uint64)page*PGSIZE, 0);
+    if((*pte & PTE_A) == 0)
+      return page;
+    clearaccessed(pte);
+    removePage(p, page);
+    if(list == ARC_T1){
+      m->agingCounter = ARC_T2;
+      a->nt[0]--;
+      a->nt[1]++;
+    }
+    in(p, page);
+  }
+  return p->head != -1 ? p->head : a->thead;
+}
+
+// a process switching to ARC from another policy, whose counters
+// mean nothing to it: all its resident pages go on T1, and it
+// starts with no history.
+static void
+arcattach(struct proc *p)
+{
+  struct paging_meta_data *m;
+
+  arcreset(p);
+  for(int i = 0; i < PGROUNDUP(p->sz) / PGSIZE; i++){
+    if((m = pagemeta(p, i, 0)) == 0)
+      continue;
+    m->agingCounter = 0;
+    if(m->inUse){
+      m->agingCounter = ARC_T1;
+      p->arc.nt[0]++;
+    }
+  }
+}
+
+// a process switching from ARC to another policy, which only
+// knows the one queue: T2's pages go at its end, oldest first.
+static void
+arcdetach(struct proc *p)
+{
+  struct arcstate *a = &p->arc;
+
+  if(a->thead == -1)
+    return;
+  pagemeta(p, a->thead, 0)->prev = p->tail;
+  if(p->tail == -1)
+    p->head = a->thead;
+  else
+    pagemeta(p, p->tail, 0)->next = a->thead;
+  p->tail = a->ttail;
+  a->thead = -1;
+  a->ttail = -1;
+}
+
+// the page-replacement policies, by number; setpolicy() picks one
+// per process. init, victim and the name are required, the rest
+// may be 0.
+struct policy policies[] = {
+  [NFUA]   = { "nfua",   agenew,  0, aging, nfua,   0,         0 },
+  [LAPA]   = { "lapa",   ageused, 0, aging, lapa,   0,         0 },
+  [SCFIFO] = { "scfifo", agenew,  0, 0,     scfifo, 0,         0 },
+  [ARC]    = { "arc",    arcinit, 0, 0,     arc,    arcremove, arcattach, arcdetach },
+};
+
+// the number of policy pol.
+int
+policyno(struct policy *pol)
+{
+  return pol - policies;
+}
+
+// the policy numbered n, or 0 if there is none.
+struct policy*
+pagepolicy(int n)
+{
+  if(n < 0 || n >= NELEM(policies) || policies[n].name == 0)
     return 0;
+  return &policies[n];
+}
+
+// page-fault-frequency control of p's resident limit: every
+// PFF_INTERVAL ticks, a process that faulted more than PFF_HIGH
+// times gets PFF_STEP more pages, and one that faulted fewer than
+// PFF_LOW times gives PFF_STEP back, swapping the excess out.
+// called from usertrap() on timer interrupts.
+void
+pffupdate(struct proc *p)
+{
+  #if PFF && SELECTION != NONE && SELECTION != GLOBAL
+    if(p->pid <= 1 || ticks - p->pffstamp < PFF_INTERVAL)
+      return;
+    if(p->pid <= 2 && !swapdevice())
+      return;   // nowhere to trim it to
+    p->pffstamp = ticks;
+    if(p->nfaults > PFF_HIGH)
+      p->maxPsycPages += PFF_STEP;
+    else if(p->nfaults < PFF_LOW)
+      p->maxPsycPages -= PFF_STEP;
+    if(p->maxPsycPages > PFF_MAXPAGES)
+      p->maxPsycPages = PFF_MAXPAGES;
+    if(p->maxPsycPages < PFF_MINPAGES)
+      p->maxPsycPages = PFF_MINPAGES;
+    // pinned pages can't go: leave as many others
+    if(p->maxPsycPages < 2 * p->npinned + 1)
+      p->maxPsycPages = 2 * p->npinned + 1;
+    p->nfaults = 0;
+
+    vmlock(p);
+    while(p->pagesInMemory > p->maxPsycPages)
+      page_to_file(p, p->pagesInMemory - p->maxPsycPages);
+    vmunlock(p);
   #endif
-  return 0;
 }
 
-// updates the aging counter foreach page when returning to the scheduler
+// the policy switch and aging pass of p, see updateAging(), with
+// depth the vmlock()s the caller holds on p.
+static void
+agepass(struct proc *p, int depth)
+{
+  if(p->nextpolicy != 0 && p->vmdepth == depth){
+    if(p->policy && p->policy->detach)
+      p->policy->detach(p);
+    p->policy = p->nextpolicy;
+    p->nextpolicy = 0;
+    if(p->policy->attach)
+      p->policy->attach(p);
+  }
+  if(p->state == SLEEPING && p->swapwait)
+    return;
+  if(p->policy != 0 && p->policy->age != 0)
+    p->policy->age(p);
+}
+
+// runs the aging pass of the running process's policy, if it has
+// one, when returning to the scheduler. a switch of policy waits
+// for such a moment, when p is not in the middle of paging. a
+// process gone to sleep on paging I/O is not aged: it has not had
+// the chance to use its pages since the last pass, which would
+// make them look colder than they are. a process with threads is
+// aged by them instead, see threadAging().
 void
 updateAging(void)
 {
-  #if SELECTION == NFUA || SELECTION == LAPA
-    struct proc* p = myproc();
-    for(int i = 0; i < MAX_TOTAL_PAGES; i++){
-      pte_t* pte = walk(p->pagetable, i*PGSIZE, 0);
-      if(*pte & PTE_V){
-        p->data[i].agingCounter = p->data[i].agingCounter >> 1;
-        // if the page accessed, then it will get high aging counter
-        if(*pte & PTE_A){
-          p->data[i].agingCounter |= (1L << 31);
-          *pte = *pte & (~PTE_A);
-        }
+  struct proc *p = myproc();
+
+  if(p->mm == p && p->nthreads == 1)
+    agepass(p, 0);
+}
+
+// the aging pass of p, which has several threads, from a timer
+// interrupt of one of them: the scheduler can't wait for
+// vmlock(p).
+void
+threadAging(struct proc *p)
+{
+  if(p->nthreads == 1)
+    return;
+  vmlock(p);
+  agepass(p, 1);
+  vmunlock(p);
+}
+
+// updates the aging counter foreach resident page of p, at most once
+// every AGING_INTERVAL ticks. a leaf page-table page is only looked
+// up again when the next page in the queue is not covered by the
+// previous one.
+static void
+aging(struct proc *p)
+{
+  struct paging_meta_data *m;
+  int perleaf = PGSIZE / sizeof(pte_t);
+  int leafno = -1;
+  pte_t *leaf = 0;
+
+  // a stale read of ticks only delays the pass by a tick
+  if(ticks - p->lastAging < AGING_INTERVAL)
+    return;
+  p->lastAging = ticks;
+
+  for(int i = p->head; i != -1; i = m->next){
+    m = pagemeta(p, i, 0);
+    if(i / perleaf != leafno){
+      leafno = i / perleaf;
+      leaf = walk(p->pagetable, (uint64)leafno * perleaf * PGSIZE, 0);
+    }
+    if(leaf == 0)
+      continue;
+    pte_t *pte = &leaf[i % perleaf];
+    if(*pte & PTE_V){
+      m->agingCounter = m->agingCounter >> 1;
+      // if the page accessed, then it will get high aging counter
+      if(*pte & PTE_A){
+        m->agingCounter |= (1L << 31);
+        clearaccessed(pte);
       }
     }
-  #endif
+  }
 }
\ No newline at end of file
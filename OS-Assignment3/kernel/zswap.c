@@ -0,0 +1,279 @@
+// Compressed swap cache.
+//
+// Before a dirty victim is written to the swap file (or area),
+// evictstart() offers it here. A page whose words are all the same
+// is kept as that one word (all-zero heap pages never get here: they
+// map the zero page again); any other is compressed, and kept if it
+// shrinks to the largest size class or less, in an
+// object from the slab cache of the smallest size class it fits.
+// The pool holds at most ZSWAPPAGES pages' worth of objects; a page
+// that does not fit any more goes to disk as before.
+//
+// A kept page stands in for a swap slot: its metadata's offset is
+// ZOFF() of its entry, with the low bit set, which no slot offset
+// has. freeSwapSlot() and copySwapFile() know about these, so a
+// child shares its parent's entries like it shares slots, each
+// holding a reference. swap_in() gets the page back without any
+// disk I/O and drops the entry at once, to keep the pool for pages
+// that are out.
+//
+// The compressor is a small LZ77: a control byte c < 128 is
+// followed by c+1 literal bytes; c >= 128 is a copy of c-128+4
+// bytes from 1..4095 bytes back, given by the next two bytes.
+// Repeats are found with a hash table of 4-byte sequences.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "slab.h"
+#include "defs.h"
+
+#define ZMIN   4                // shortest copy
+#define ZMAX   (127 + ZMIN)     // longest
+#define ZHASH  10               // bits of hash table index
+
+// size classes, each a slab cache
+static uint zsizes[] = { 256, 512, 1024, 2016 };
+#define NZCLASS NELEM(zsizes)
+
+struct zent {
+  int ref;                // offsets holding it, 0 if free
+  int cls;                // size class, -1 for a same-filled page
+  uint len;               // compressed bytes
+  uint64 fill;            // the word of a same-filled page
+  char *data;
+};
+
+struct {
+  struct spinlock lock;
+  struct zent ent[NZSWAP];
+  int free[NZSWAP];       // stack of free entries
+  int nfree;
+  int next;               // first entry never used
+  int bytes;              // in the pool's objects
+  ushort hash[1 << ZHASH];  // the compressor's, with lock held
+  uchar buf[PGSIZE / 2];  // its output
+  // statistics, see zswapdump()
+  uint64 nsame;
+  uint64 nstored;
+  uint64 nrejected;
+  uint64 nloaded;
+} zswap;
+
+struct kcache zcaches[NZCLASS];
+
+void
+zswapinit(void)
+{
+  static char *names[] = { "zswap256", "zswap512", "zswap1024", "zswap2016" };
+
+  initlock(&zswap.lock, "zswap");
+  for(int i = 0; i < NZCLASS; i++)
+    kcacheinit(&zcaches[i], names[i], zsizes[i]);
+}
+
+static uint
+hash4(uchar *s)
+{
+  uint x = s[0] | (s[1] << 8) | (s[2] << 16) | ((uint)s[3] << 24);
+  return (x * 2654435761U) >> (32 - ZHASH);
+}
+
+// literals src[from..to) to dst at *n. returns -1 if they don't fit in max.
+static int
+zliterals(uchar *src, int from, int to, uchar *dst, int *n, int max)
+{
+  int k;
+
+  while(from < to){
+    k = to - from > 128 ? 128 : to - from;
+    if(*n + 1 + k > max)
+      return -1;
+    dst[(*n)++] = k - 1;
+    memmove(dst + *n, src + from, k);
+    *n += k;
+    from += k;
+  }
+  return 0;
+}
+
+// compresses the page src into dst, at most max bytes. returns
+// the length, or -1 if it is longer. zswap.lock must be held.
+static int
+zcompress(uchar *src, uchar *dst, int max)
+{
+  int i = 0, lit = 0, n = 0, cand, len, off;
+  uint h;
+
+  memset(zswap.hash, 0, sizeof(zswap.hash));
+  while(i + ZMIN <= PGSIZE){
+    h = hash4(src + i);
+    cand = zswap.hash[h] - 1;
+    zswap.hash[h] = i + 1;
+    if(cand < 0 || src[cand] != src[i] || src[cand+1] != src[i+1] ||
+       src[cand+2] != src[i+2] || src[cand+3] != src[i+3]){
+      i++;
+      continue;
+    }
+    for(len = ZMIN; i + len < PGSIZE && len < ZMAX && src[cand+len] == src[i+len]; len++)
+      ;
+    if(zliterals(src, lit, i, dst, &n, max) < 0 || n + 3 > max)
+      return -1;
+    off = i - cand;
+    dst[n++] = 128 + len - ZMIN;
+    dst[n++] = off & 0xff;
+    dst[n++] = off >> 8;
+    i += len;
+    lit = i;
+  }
+  if(zliterals(src, lit, PGSIZE, dst, &n, max) < 0)
+    return -1;
+  return n;
+}
+
+static void
+zdecompress(uchar *src, int n, uchar *dst)
+{
+  int i = 0, o = 0, k, off;
+
+  while(i < n){
+    if(src[i] < 128){
+      k = src[i++] + 1;
+      if(o + k > PGSIZE)
+        panic("zdecompress");
+      memmove(dst + o, src + i, k);
+      i += k;
+    } else {
+      k = src[i] - 128 + ZMIN;
+      off = src[i+1] | (src[i+2] << 8);
+      i += 3;
+      if(off == 0 || off > o || o + k > PGSIZE)
+        panic("zdecompress");
+      for(int j = 0; j < k; j++)
+        dst[o+j] = dst[o+j-off];
+    }
+    o += k;
+  }
+  if(o != PGSIZE)
+    panic("zdecompress: short");
+}
+
+// Keeps a copy of page in the pool, if it compresses well enough
+// and there is room. Returns the offset that stands for it, or -1.
+// Never sleeps.
+uint
+zswapstore(char *page)
+{
+  uint64 *w = (uint64*)page;
+  struct zent *e;
+  char *data = 0;
+  int i, z, len = 0, cls = -1;
+
+  for(i = 1; i < PGSIZE / sizeof(uint64); i++)
+    if(w[i] != w[0])
+      break;
+
+  acquire(&zswap.lock);
+  if(zswap.nfree == 0 && zswap.next == NZSWAP)
+    goto reject;
+  if(i < PGSIZE / sizeof(uint64)){
+    if((len = zcompress((uchar*)page, zswap.buf, zsizes[NZCLASS-1])) < 0)
+      goto reject;
+    for(cls = 0; zsizes[cls] < len; cls++)
+      ;
+    if(zswap.bytes + zsizes[cls] > ZSWAPPAGES * PGSIZE ||
+       (data = kcachealloc(&zcaches[cls])) == 0)
+      goto reject;
+    memmove(data, zswap.buf, len);
+    zswap.bytes += zsizes[cls];
+    zswap.nstored++;
+  } else
+    zswap.nsame++;
+
+  z = zswap.nfree > 0 ? zswap.free[--zswap.nfree] : zswap.next++;
+  e = &zswap.ent[z];
+  e->ref = 1;
+  e->cls = cls;
+  e->len = len;
+  e->fill = w[0];
+  e->data = data;
+  release(&zswap.lock);
+  return ZOFF(z);
+
+reject:
+  zswap.nrejected++;
+  release(&zswap.lock);
+  return -1;
+}
+
+static struct zent*
+zent(uint off, char *what)
+{
+  struct zent *e;
+
+  if(!ZSWAPPED(off) || ZENT(off) >= zswap.next)
+    panic(what);
+  e = &zswap.ent[ZENT(off)];
+  if(e->ref < 1)
+    panic(what);
+  return e;
+}
+
+// Fills page from the entry behind off.
+void
+zswapload(uint off, char *page)
+{
+  struct zent *e;
+
+  acquire(&zswap.lock);
+  e = zent(off, "zswapload");
+  if(e->cls < 0){
+    for(int i = 0; i < PGSIZE / sizeof(uint64); i++)
+      ((uint64*)page)[i] = e->fill;
+  } else
+    zdecompress((uchar*)e->data, e->len, (uchar*)page);
+  zswap.nloaded++;
+  release(&zswap.lock);
+}
+
+// Another offset stands for the entry behind off.
+void
+zswapdup(uint off)
+{
+  acquire(&zswap.lock);
+  zent(off, "zswapdup")->ref++;
+  release(&zswap.lock);
+}
+
+// Drops a reference to the entry behind off; the last one frees it.
+void
+zswapfree(uint off)
+{
+  struct zent *e;
+  char *data = 0;
+  int cls = -1;
+
+  acquire(&zswap.lock);
+  e = zent(off, "zswapfree");
+  if(--e->ref == 0){
+    if((cls = e->cls) >= 0){
+      data = e->data;
+      zswap.bytes -= zsizes[cls];
+    }
+    e->data = 0;
+    zswap.free[zswap.nfree++] = ZENT(off);
+  }
+  release(&zswap.lock);
+  if(data)
+    kcachefree(&zcaches[cls], data);
+}
+
+// Print the pool's use to the console, with kallocdump().
+void
+zswapdump(void)
+{
+  printf("zswap: %d of %d pages used, %d same-filled %d stored %d rejected %d loaded\n",
+         zswap.bytes / PGSIZE, ZSWAPPAGES, (int)zswap.nsame, (int)zswap.nstored,
+         (int)zswap.nrejected, (int)zswap.nloaded);
+}
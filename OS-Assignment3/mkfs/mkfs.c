@@ -17,29 +17,43 @@
 
 #define NINODES 200
 
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+// followed by nswap blocks of raw swap area when run with -s nswap.
+// The log takes nlog blocks, its header among them.
+//
+// The image is built in memory and its used blocks written out at
+// the end, a megabyte at a time; the rest of it, swap area included,
+// is left a hole in the file that reads as zeros. Each file's data
+// blocks are given it in one run, followed by its indirect blocks.
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = MAXOPBLOCKS*3 + 1;  // log blocks, header included; -l nlog
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
+int nswap;    // Number of raw swap blocks after the file system
 
 int fsfd;
 struct superblock sb;
-char zeroes[BSIZE];
+uchar *img;   // the file system's FSSIZE blocks
 uint freeinode = 1;
 uint freeblock;
 
 
 void balloc(int);
 void wsect(uint, void*);
-void winode(uint, struct dinode*);
+uchar *sect(uint);
+struct dinode *dinode(uint);
 void rinode(uint inum, struct dinode *ip);
-void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
+uint baddr(uint*);
+uint *bslot(struct dinode*, uint);
+void ireserve(uint inum, uint nb);
 void iappend(uint inum, void *p, int n);
+void wimage(void);
 
 // convert to intel byte order
 ushort
@@ -70,14 +84,30 @@ main(int argc, char *argv[])
   int i, cc, fd;
   uint rootino, inum, off;
   struct dirent de;
-  char buf[BSIZE];
+  char buf[BSIZE], *data;
   struct dinode din;
+  off_t size;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  while(argc >= 3 && argv[1][0] == '-'){
+    if(strcmp(argv[1], "-s") == 0)
+      nswap = atoi(argv[2]);
+    else if(strcmp(argv[1], "-l") == 0)
+      nlog = atoi(argv[2]);
+    else
+      break;
+    argc -= 2;
+    argv += 2;
+  }
+
+  if(argc < 2 || nswap < 0){
+    fprintf(stderr, "Usage: mkfs [-s swapblocks] [-l logblocks] fs.img files...\n");
+    exit(1);
+  }
+  if(nlog < MAXOPBLOCKS*3 + 1 || nlog > LOGSIZE + 1){
+    fprintf(stderr, "mkfs: log must have %d to %d blocks\n", MAXOPBLOCKS*3 + 1, LOGSIZE + 1);
     exit(1);
   }
 
@@ -102,14 +132,19 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.swapstart = xint(FSSIZE);
+  sb.nswap = xint(nswap);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d swap %d\n",
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE, nswap);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
+  // zeroed pages are only allocated as they are touched
+  if((img = calloc(FSSIZE, BSIZE)) == 0){
+    perror("calloc");
+    exit(1);
+  }
 
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
@@ -157,8 +192,20 @@ main(int argc, char *argv[])
     strncpy(de.name, shortname, DIRSIZ);
     iappend(rootino, &de, sizeof(de));
 
-    while((cc = read(fd, buf, sizeof(buf))) > 0)
-      iappend(inum, buf, cc);
+    if((size = lseek(fd, 0, SEEK_END)) < 0 || lseek(fd, 0, SEEK_SET) != 0 ||
+       (data = malloc(size + 1)) == 0){
+      perror(argv[i]);
+      exit(1);
+    }
+    for(off = 0; (cc = read(fd, data + off, size + 1 - off)) > 0; off += cc)
+      ;
+    if(cc < 0 || off != size){
+      fprintf(stderr, "mkfs: %s changed while being read\n", argv[i]);
+      exit(1);
+    }
+    ireserve(inum, (off + BSIZE - 1) / BSIZE);
+    iappend(inum, data, off);
+    free(data);
 
     close(fd);
   }
@@ -167,139 +214,148 @@ main(int argc, char *argv[])
   rinode(rootino, &din);
   off = xint(din.size);
   off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  dinode(rootino)->size = xint(off);
 
   balloc(freeblock);
+  wimage();
 
   exit(0);
 }
 
-void
-wsect(uint sec, void *buf)
+// the block sec of the image.
+uchar*
+sect(uint sec)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
-  }
-  if(write(fsfd, buf, BSIZE) != BSIZE){
-    perror("write");
+  if(sec >= FSSIZE){
+    fprintf(stderr, "mkfs: out of blocks\n");
     exit(1);
   }
+  return img + (size_t)sec * BSIZE;
 }
 
 void
-winode(uint inum, struct dinode *ip)
+wsect(uint sec, void *buf)
 {
-  char buf[BSIZE];
-  uint bn;
-  struct dinode *dip;
-
-  bn = IBLOCK(inum, sb);
-  rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
-  *dip = *ip;
-  wsect(bn, buf);
+  memmove(sect(sec), buf, BSIZE);
 }
 
-void
-rinode(uint inum, struct dinode *ip)
+// inode inum, in the image.
+struct dinode*
+dinode(uint inum)
 {
-  char buf[BSIZE];
-  uint bn;
-  struct dinode *dip;
-
-  bn = IBLOCK(inum, sb);
-  rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
-  *ip = *dip;
+  return (struct dinode*)sect(IBLOCK(inum, sb)) + (inum % IPB);
 }
 
 void
-rsect(uint sec, void *buf)
+rinode(uint inum, struct dinode *ip)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
-  }
-  if(read(fsfd, buf, BSIZE) != BSIZE){
-    perror("read");
-    exit(1);
-  }
+  *ip = *dinode(inum);
 }
 
 uint
 ialloc(ushort type)
 {
   uint inum = freeinode++;
-  struct dinode din;
+  struct dinode *dip = dinode(inum);
 
-  bzero(&din, sizeof(din));
-  din.type = xshort(type);
-  din.nlink = xshort(1);
-  din.size = xint(0);
-  winode(inum, &din);
+  bzero(dip, sizeof(*dip));
+  dip->type = xshort(type);
+  dip->nlink = xshort(1);
+  dip->size = xint(0);
   return inum;
 }
 
+// writes the blocks in use to fsfd, in big pieces, and gives the
+// file its full size: the free blocks and the swap area are zeros.
+void
+wimage(void)
+{
+  size_t n = (size_t)freeblock * BSIZE, off, m;
+  ssize_t cc;
+
+  for(off = 0; off < n; off += cc){
+    m = min(n - off, (size_t)1 << 20);
+    if((cc = write(fsfd, img + off, m)) <= 0){
+      perror("write");
+      exit(1);
+    }
+  }
+  if(ftruncate(fsfd, (off_t)(FSSIZE + nswap) * BSIZE) < 0){
+    perror("ftruncate");
+    exit(1);
+  }
+}
+
 void
 balloc(int used)
 {
-  uchar buf[BSIZE];
   int i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
-  for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
-  }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
+  assert(used <= nbitmap*BSIZE*8);
+  for(i = 0; i < used; i++)
+    sect(sb.bmapstart + i/(BSIZE*8))[(i%(BSIZE*8))/8] |= 0x1 << (i%8);
 }
 
-#define min(a, b) ((a) < (b) ? (a) : (b))
+// the block the entry at a names, allocated if it names none.
+uint
+baddr(uint *a)
+{
+  if(xint(*a) == 0)
+    *a = xint(freeblock++);
+  return xint(*a);
+}
+
+// the entry for block fbn of din, in it or in an indirect block,
+// allocating the indirect blocks on the way.
+uint*
+bslot(struct dinode *din, uint fbn)
+{
+  uint *a;
+
+  assert(fbn < MAXFILE);
+  if(fbn < NDIRECT)
+    return &din->addrs[fbn];
+  fbn -= NDIRECT;
+  if(fbn < NINDIRECT)
+    return (uint*)sect(baddr(&din->addrs[NDIRECT])) + fbn;
+  fbn -= NINDIRECT;
+  a = (uint*)sect(baddr(&din->addrs[NDIRECT+1])) + fbn / NINDIRECT;
+  return (uint*)sect(baddr(a)) + fbn % NINDIRECT;
+}
+
+// gives the first nb blocks of inode inum, which has none yet,
+// consecutive addresses, and its indirect blocks those after them.
+void
+ireserve(uint inum, uint nb)
+{
+  struct dinode *din = dinode(inum);
+  uint start = freeblock, fbn, *a;
+
+  freeblock += nb;
+  for(fbn = 0; fbn < nb; fbn++){
+    a = bslot(din, fbn);
+    assert(*a == 0);
+    *a = xint(start + fbn);
+  }
+}
 
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
+  struct dinode *din = dinode(inum);
   uint fbn, off, n1;
-  struct dinode din;
-  char buf[BSIZE];
-  uint indirect[NINDIRECT];
-  uint x;
 
-  rinode(inum, &din);
-  off = xint(din.size);
+  off = xint(din->size);
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
   while(n > 0){
     fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
     n1 = min(n, (fbn + 1) * BSIZE - off);
-    rsect(x, buf);
-    bcopy(p, buf + off - (fbn * BSIZE), n1);
-    wsect(x, buf);
+    bcopy(p, sect(baddr(bslot(din, fbn))) + off - (fbn * BSIZE), n1);
     n -= n1;
     off += n1;
     p += n1;
   }
-  din.size = xint(off);
-  winode(inum, &din);
+  din->size = xint(off);
 }
@@ -0,0 +1,130 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "kernel/kbench.h"
+#include "user/user.h"
+
+// kbench [-n samples] [-p pages] [primitive ...]
+// times the kernel's hot paths with kbench(): walk(), kalloc(),
+// a cached bread() (bget()), copyout() and copyin() of a page,
+// page_to_file() and swap_in() of one, and each replacement
+// policy choosing a victim, on a region of pages it has touched.
+// it prints ops/sec and the median and 99th percentile time of an
+// op for each, and one "kbench:" line of key=value pairs, for
+// scripts that track them across commits and SELECTION builds.
+// primitives the kernel doesn't run here (the paging ones with
+// SELECTION=NONE) are skipped.
+
+char *names[] = {
+  [KB_WALK]    "walk",
+  [KB_KALLOC]  "kalloc",
+  [KB_BGET]    "bget",
+  [KB_COPYOUT] "copyout",
+  [KB_COPYIN]  "copyin",
+  [KB_EVICT]   "page_to_file",
+  [KB_SWAPIN]  "swap_in",
+  [KB_VICTIM]  "victim",
+};
+
+int policies[] = { NFUA, LAPA, SCFIFO, ARC };
+
+int nsamples = 1000;
+int npages = 16;
+char *region;
+
+void
+touch(void)
+{
+  for(int i = 0; i < npages; i++)
+    region[i * PGSIZE] = i + 1;   // not all zero: evictstart() would map the zero page
+}
+
+void
+run(int kind)
+{
+  struct kbench r;
+  uint64 persec;
+
+  touch();
+  if(kbench(kind, nsamples, region, (uint64)npages * PGSIZE, &r) < 0){
+    printf("%s: skipped\n", names[kind]);
+    return;
+  }
+  persec = r.ns ? r.ops * 1000000000L / r.ns : 0;
+  printf("%s (%s): %l ops/sec, p50 %l ns p99 %l ns max %l ns\n",
+         r.name, r.policy, persec, r.p50, r.p99, r.max);
+  printf("kbench: name=%s selection=%d policy=%s samples=%d batch=%d ops=%l ns=%l ops_per_sec=%l p50_ns=%l p99_ns=%l max_ns=%l\n",
+         r.name, r.selection, r.policy, r.samples, r.batch, r.ops, r.ns,
+         persec, r.p50, r.p99, r.max);
+}
+
+void
+runall(int kind)
+{
+  int old;
+
+  if(kind != KB_VICTIM){
+    run(kind);
+    return;
+  }
+  // the victim of each policy; a process switches when it next
+  // gives up the CPU
+  if((old = setpolicy(getpid(), policies[0])) < 0){
+    run(kind);
+    return;
+  }
+  for(int i = 0; i < sizeof(policies)/sizeof(policies[0]); i++){
+    setpolicy(getpid(), policies[i]);
+    sleep(1);
+    run(kind);
+  }
+  setpolicy(getpid(), old);
+}
+
+void
+usage(void)
+{
+  fprintf(2, "usage: kbench [-n samples] [-p pages] [primitive ...]\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, k, named = 0;
+
+  for(i = 1; i < argc && argv[i][0] == '-'; i += 2){
+    if(i + 1 >= argc)
+      usage();
+    if(strcmp(argv[i], "-n") == 0)
+      nsamples = atoi(argv[i+1]);
+    else if(strcmp(argv[i], "-p") == 0)
+      npages = atoi(argv[i+1]);
+    else
+      usage();
+  }
+  if(nsamples < 1 || npages < 1)
+    usage();
+  if((region = sbrk(npages * PGSIZE)) == (char*)-1){
+    fprintf(2, "kbench: out of memory\n");
+    exit(1);
+  }
+
+  printf("%d samples of each over %d pages\n", nsamples, npages);
+  for(; i < argc; i++){
+    for(k = 0; k < NKBENCH; k++)
+      if(strcmp(argv[i], names[k]) == 0)
+        break;
+    if(k == NKBENCH){
+      fprintf(2, "kbench: unknown primitive %s\n", argv[i]);
+      exit(1);
+    }
+    runall(k);
+    named = 1;
+  }
+  if(!named)
+    for(k = 0; k < NKBENCH; k++)
+      runall(k);
+  exit(0);
+}
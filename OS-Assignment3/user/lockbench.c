@@ -0,0 +1,128 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// lockbench [-p procs] [-n calls]
+// has procs processes call uptime(), which takes tickslock and
+// little else, calls times each, all at once, and reports how long
+// each call took (median, 99th percentile, worst) and when each
+// process was done. with a fair lock the processes finish close
+// together and the tail stays near the median; compare builds with
+// SPINLOCK=TAS, TTAS and TICKET, with LOCKSTAT=1 and ^P for the
+// atomics each one cost.
+
+int nprocs = 4;
+int ncalls = 20000;
+
+struct result {
+  uint64 done;      // ns from the start until the last call returned
+  uint p50, p99, max;
+};
+
+void
+sort(uint *a, int n)
+{
+  int gap, i, j;
+  uint x;
+
+  for(gap = n / 2; gap > 0; gap /= 2)
+    for(i = gap; i < n; i++){
+      x = a[i];
+      for(j = i; j >= gap && a[j-gap] > x; j -= gap)
+        a[j] = a[j-gap];
+      a[j] = x;
+    }
+}
+
+void
+child(int fd, uint64 start)
+{
+  struct result r;
+  uint *lat;
+  uint64 t;
+
+  if((lat = malloc(ncalls * sizeof(uint))) == 0){
+    fprintf(2, "lockbench: out of memory\n");
+    exit(1);
+  }
+  // start all together, spinning rather than sleeping
+  while(nanotime() < start)
+    ;
+  for(int i = 0; i < ncalls; i++){
+    t = nanotime();
+    uptime();
+    lat[i] = nanotime() - t;
+  }
+  r.done = nanotime() - start;
+  sort(lat, ncalls);
+  r.p50 = lat[ncalls / 2];
+  r.p99 = lat[ncalls - 1 - ncalls / 100];
+  r.max = lat[ncalls - 1];
+  write(fd, &r, sizeof(r));
+  exit(0);
+}
+
+void
+usage(void)
+{
+  fprintf(2, "usage: lockbench [-p procs] [-n calls]\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct result r;
+  uint64 start, first = 0, last = 0;
+  uint p99 = 0, max = 0;
+  int i, fds[2];
+
+  for(i = 1; i < argc; i += 2){
+    if(argv[i][0] != '-' || i + 1 >= argc)
+      usage();
+    if(strcmp(argv[i], "-p") == 0)
+      nprocs = atoi(argv[i+1]);
+    else if(strcmp(argv[i], "-n") == 0)
+      ncalls = atoi(argv[i+1]);
+    else
+      usage();
+  }
+  if(nprocs < 1 || ncalls < 100)
+    usage();
+
+  if(pipe(fds) < 0){
+    fprintf(2, "lockbench: pipe failed\n");
+    exit(1);
+  }
+  printf("lockbench: %d procs, %d calls each\n", nprocs, ncalls);
+  start = nanotime() + 50 * 1000 * 1000;
+  for(i = 0; i < nprocs; i++){
+    int pid = fork();
+    if(pid < 0){
+      fprintf(2, "lockbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      child(fds[1], start);
+    }
+  }
+  close(fds[1]);
+  for(i = 0; i < nprocs && read(fds[0], &r, sizeof(r)) == sizeof(r); i++){
+    printf("proc %d: done at %d us, call p50 %d ns p99 %d ns max %d ns\n",
+           i, (int)(r.done / 1000), r.p50, r.p99, r.max);
+    if(first == 0 || r.done < first)
+      first = r.done;
+    if(r.done > last)
+      last = r.done;
+    if(r.p99 > p99)
+      p99 = r.p99;
+    if(r.max > max)
+      max = r.max;
+  }
+  while(wait(0) > 0)
+    ;
+  printf("lockbench: first done at %d us, last at %d us; worst p99 %d ns, max %d ns\n",
+         (int)(first / 1000), (int)(last / 1000), p99, max);
+  exit(0);
+}
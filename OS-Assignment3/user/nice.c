@@ -0,0 +1,26 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// nice n command [arg ...]
+// runs command with nice value n, from -20 (the biggest share
+// of the CPU) to 19 (the smallest).
+
+int
+main(int argc, char *argv[])
+{
+  int n;
+
+  if(argc < 3){
+    fprintf(2, "usage: nice n command [arg ...]\n");
+    exit(1);
+  }
+  n = (argv[1][0] == '-') ? -atoi(argv[1] + 1) : atoi(argv[1]);
+  if(setnice(0, n) < 0){
+    fprintf(2, "nice: bad nice value %s\n", argv[1]);
+    exit(1);
+  }
+  exec(argv[2], argv + 2);
+  fprintf(2, "nice: exec %s failed\n", argv[2]);
+  exit(1);
+}
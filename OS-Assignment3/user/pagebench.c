@@ -0,0 +1,224 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/pstat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+// pagebench [-n pages] [-r rounds] [pattern ...]
+// runs access patterns over a fresh region of pages, rounds * pages
+// touches each (every one a write), and reports the time taken and
+// the paging counters they cost. the random patterns use a fixed
+// seed, so a run is repeatable and builds with different SELECTION
+// policies can be compared on equal terms.
+
+int npages = 4 * MAX_PSYC_PAGES;
+int rounds = 8;
+char *region;
+uint seed;
+
+uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+void
+touch(int page)
+{
+  region[(uint64)page * PGSIZE + page % 64]++;
+}
+
+void
+seq(void)
+{
+  for(int r = 0; r < rounds; r++)
+    for(int i = 0; i < npages; i++)
+      touch(i);
+}
+
+// every 7th page, wrapping around: no two touches in a row are
+// neighbours, which defeats read-ahead.
+void
+stride(void)
+{
+  for(int i = 0; i < rounds * npages; i++)
+    touch((i * 7) % npages);
+}
+
+void
+random(void)
+{
+  for(int i = 0; i < rounds * npages; i++)
+    touch(rand() % npages);
+}
+
+// page k is picked with probability proportional to 1/(k+1),
+// by a binary search of the cumulative weights.
+void
+zipf(void)
+{
+  uint *cdf = malloc(npages * sizeof(uint));
+  uint total = 0;
+  int lo, hi, mid;
+
+  for(int k = 0; k < npages; k++){
+    total += 65536 / (k + 1);
+    cdf[k] = total;
+  }
+  for(int i = 0; i < rounds * npages; i++){
+    uint x = rand() % total;
+    for(lo = 0, hi = npages - 1; lo < hi; ){
+      mid = (lo + hi) / 2;
+      if(cdf[mid] > x)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+    touch(lo);
+  }
+  free(cdf);
+}
+
+// the same pages over and over, half as many again as fit: the
+// worst case for LRU and its approximations.
+void
+loop(void)
+{
+  int n = MAX_PSYC_PAGES + MAX_PSYC_PAGES / 2;
+
+  if(n > npages)
+    n = npages;
+  for(int i = 0; i < rounds * npages; i++)
+    touch(i % n);
+}
+
+// a child per round writes every page it shares with the parent
+// and reports its own counters back through a pipe.
+struct pagestats kids;
+
+void
+forks(void)
+{
+  struct pagestats st;
+  int fds[2];
+
+  seq();
+  memset(&kids, 0, sizeof(kids));
+  for(int r = 0; r < rounds; r++){
+    if(pipe(fds) < 0){
+      printf("pagebench: pipe failed\n");
+      exit(1);
+    }
+    int pid = fork();
+    if(pid < 0){
+      printf("pagebench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      for(int i = 0; i < npages; i++)
+        touch(i);
+      getpagestats(0, &st);
+      write(fds[1], &st, sizeof(st));
+      exit(0);
+    }
+    close(fds[1]);
+    if(read(fds[0], &st, sizeof(st)) == sizeof(st)){
+      kids.faults += st.faults;
+      kids.majfaults += st.majfaults;
+      kids.swapins += st.swapins;
+      kids.swapouts += st.swapouts;
+      kids.drops += st.drops;
+    }
+    close(fds[0]);
+    wait(0);
+  }
+}
+
+struct bench {
+  char *name;
+  void (*fn)(void);
+} benches[] = {
+  { "seq",    seq },
+  { "stride", stride },
+  { "random", random },
+  { "zipf",   zipf },
+  { "loop",   loop },
+  { "fork",   forks },
+};
+
+#define NBENCH (sizeof(benches) / sizeof(benches[0]))
+
+void
+run(struct bench *b)
+{
+  struct pagestats st0, st1;
+  int t0, t1;
+  uint64 ns0, ns1;
+
+  seed = 1;
+  memset(&kids, 0, sizeof(kids));
+  if((region = sbrk(npages * PGSIZE)) == (char*)-1){
+    printf("pagebench: sbrk failed\n");
+    exit(1);
+  }
+  getpagestats(0, &st0);
+  t0 = uptime();
+  ns0 = nanotime();
+  b->fn();
+  ns1 = nanotime();
+  t1 = uptime();
+  getpagestats(0, &st1);
+  sbrk(-npages * PGSIZE);
+
+  printf("%s: %d ticks (%d us), %d faults (%d major), %d in, %d out, %d dropped\n",
+         b->name, t1 - t0, (int)((ns1 - ns0) / 1000),
+         (int)(st1.faults - st0.faults + kids.faults),
+         (int)(st1.majfaults - st0.majfaults + kids.majfaults),
+         (int)(st1.swapins - st0.swapins + kids.swapins),
+         (int)(st1.swapouts - st0.swapouts + kids.swapouts),
+         (int)(st1.drops - st0.drops + kids.drops));
+}
+
+void
+usage(void)
+{
+  fprintf(2, "usage: pagebench [-n pages] [-r rounds] [seq|stride|random|zipf|loop|fork ...]\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, any = 0;
+
+  for(i = 1; i < argc && argv[i][0] == '-'; i += 2){
+    if(i + 1 >= argc)
+      usage();
+    if(strcmp(argv[i], "-n") == 0)
+      npages = atoi(argv[i+1]);
+    else if(strcmp(argv[i], "-r") == 0)
+      rounds = atoi(argv[i+1]);
+    else
+      usage();
+  }
+  if(npages < 1 || rounds < 1)
+    usage();
+
+  printf("pagebench: %d pages, %d rounds\n", npages, rounds);
+  for(; i < argc; i++){
+    for(j = 0; j < NBENCH; j++)
+      if(strcmp(argv[i], benches[j].name) == 0)
+        break;
+    if(j == NBENCH)
+      usage();
+    run(&benches[j]);
+    any = 1;
+  }
+  if(!any)
+    for(j = 0; j < NBENCH; j++)
+      run(&benches[j]);
+  exit(0);
+}
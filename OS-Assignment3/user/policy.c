@@ -0,0 +1,39 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// policy nfua|lapa|scfifo|arc [pid]
+// switches the page-replacement policy of process pid,
+// or of every process when no pid is given.
+
+char *names[] = {
+  [NFUA]   "nfua",
+  [LAPA]   "lapa",
+  [SCFIFO] "scfifo",
+  [ARC]    "arc",
+};
+
+int
+main(int argc, char **argv)
+{
+  int n, old;
+
+  if(argc < 2 || argc > 3){
+    fprintf(2, "usage: policy nfua|lapa|scfifo|arc [pid]\n");
+    exit(1);
+  }
+  for(n = 0; n < sizeof(names)/sizeof(names[0]); n++)
+    if(names[n] && strcmp(argv[1], names[n]) == 0)
+      break;
+  if(n == sizeof(names)/sizeof(names[0])){
+    fprintf(2, "policy: unknown policy %s\n", argv[1]);
+    exit(1);
+  }
+  if((old = setpolicy(argc == 3 ? atoi(argv[2]) : 0, n)) < 0){
+    fprintf(2, "policy: cannot set %s\n", argv[1]);
+    exit(1);
+  }
+  printf("%s -> %s\n", names[old] ? names[old] : "?", names[n]);
+  exit(0);
+}
@@ -1,23 +1,83 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
+#include "kernel/param.h"
 
 #include <stdarg.h>
 
 static char digits[] = "0123456789ABCDEF";
 
+// Output is buffered per file descriptor and written with one
+// write() when the buffer fills, or by fflush(). A terminal (a
+// device) is flushed at each newline, standard error at the end of
+// each printf. fork(), exec(), close() and exit() flush first, so a
+// child never prints its parent's output again and none is lost;
+// their system calls are _fork() &c, see usys.pl.
+//
+// The buffers are not safe to share between threads (see clone()):
+// only one thread of a process prints, and the others end with
+// _exit(), which leaves the buffers alone.
+
+#define OUTBUF  512
+#define FULLBUF 1
+#define LINEBUF 2
+#define UNBUF   3
+
+static struct {
+  int mode;         // 0 until the fd is first printed to
+  int n;
+  char buf[OUTBUF];
+} out[NOFILE];
+
+int _fork(void);
+int _close(int);
+int _exec(char*, char**);
+
+void
+fflush(int fd)
+{
+  if(fd < 0 || fd >= NOFILE || out[fd].n == 0)
+    return;
+  write(fd, out[fd].buf, out[fd].n);
+  out[fd].n = 0;
+}
+
+static void
+flushall(void)
+{
+  for(int fd = 0; fd < NOFILE; fd++)
+    fflush(fd);
+}
+
 static void
 putc(int fd, char c)
 {
-  write(fd, &c, 1);
+  struct stat st;
+
+  if(fd < 0 || fd >= NOFILE){
+    write(fd, &c, 1);
+    return;
+  }
+  if(out[fd].mode == 0){
+    if(fd == 2)
+      out[fd].mode = UNBUF;
+    else if(fstat(fd, &st) == 0 && st.type == T_DEVICE)
+      out[fd].mode = LINEBUF;
+    else
+      out[fd].mode = FULLBUF;
+  }
+  out[fd].buf[out[fd].n++] = c;
+  if(out[fd].n == OUTBUF || (c == '\n' && out[fd].mode == LINEBUF))
+    fflush(fd);
 }
 
+// 64 bits wide, for %l; %d and %x pass ints.
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(int fd, long xx, int base, int sgn)
 {
-  char buf[16];
+  char buf[24];
   int i, neg;
-  uint x;
+  uint64 x;
 
   neg = 0;
   if(sgn && xx < 0){
@@ -47,7 +107,7 @@ printptr(int fd, uint64 x) {
     putc(fd, digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
-// Print to the given fd. Only understands %d, %x, %p, %s.
+// Print to the given fd. Only understands %d, %l (uint64), %x, %p, %s.
 void
 vprintf(int fd, const char *fmt, va_list ap)
 {
@@ -69,7 +129,7 @@ vprintf(int fd, const char *fmt, va_list ap)
       } else if(c == 'l') {
         printint(fd, va_arg(ap, uint64), 10, 0);
       } else if(c == 'x') {
-        printint(fd, va_arg(ap, int), 16, 0);
+        printint(fd, va_arg(ap, uint), 16, 0);
       } else if(c == 'p') {
         printptr(fd, va_arg(ap, uint64));
       } else if(c == 's'){
@@ -92,6 +152,8 @@ vprintf(int fd, const char *fmt, va_list ap)
       state = 0;
     }
   }
+  if(fd >= 0 && fd < NOFILE && out[fd].mode == UNBUF)
+    fflush(fd);
 }
 
 void
@@ -111,3 +173,33 @@ printf(const char *fmt, ...)
   va_start(ap, fmt);
   vprintf(1, fmt, ap);
 }
+
+int
+fork(void)
+{
+  flushall();
+  return _fork();
+}
+
+int
+exec(char *path, char **argv)
+{
+  flushall();
+  return _exec(path, argv);
+}
+
+int
+close(int fd)
+{
+  fflush(fd);
+  if(fd >= 0 && fd < NOFILE)
+    out[fd].mode = 0;
+  return _close(fd);
+}
+
+int
+exit(int status)
+{
+  flushall();
+  _exit(status);
+}
@@ -0,0 +1,108 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/spinlock.h"
+#include "kernel/sleeplock.h"
+#include "kernel/fs.h"
+#include "kernel/file.h"
+#include "kernel/prof.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// prof command [arg ...]
+// runs command with the kernel's sampling profiler on and prints
+// the pcs most often sampled: the command's own user pcs, and
+// kernel pcs of any process (not the idle scheduler loops).
+// look them up in kernel/kernel.asm or user/_command's .asm.
+
+#define NPC  512   // distinct pcs kept
+#define NTOP 20    // ... and printed
+
+struct hot {
+  uint64 pc;
+  int user;
+  int count;
+} hot[NPC];
+int nhot;
+
+struct profsample buf[64];
+
+void
+count(uint64 pc, int user)
+{
+  int i;
+
+  for(i = 0; i < nhot; i++)
+    if(hot[i].pc == pc && hot[i].user == user){
+      hot[i].count++;
+      return;
+    }
+  if(nhot < NPC){
+    hot[nhot].pc = pc;
+    hot[nhot].user = user;
+    hot[nhot++].count = 1;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, pid, n, i, j, total = 0, idle = 0;
+  struct hot h;
+
+  if(argc < 2){
+    fprintf(2, "usage: prof command [arg ...]\n");
+    exit(1);
+  }
+  if((fd = open("/dev/prof", O_RDWR)) < 0){
+    mkdir("/dev");
+    mknod("/dev/prof", PROF, 0);
+    fd = open("/dev/prof", O_RDWR);
+  }
+  if(fd < 0){
+    fprintf(2, "prof: cannot open /dev/prof\n");
+    exit(1);
+  }
+  while(read(fd, buf, sizeof(buf)) > 0)
+    ;   // left over from an earlier run
+
+  write(fd, "1", 1);
+  if((pid = fork()) < 0){
+    fprintf(2, "prof: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fd);
+    exec(argv[1], argv + 1);
+    fprintf(2, "prof: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(0);
+  write(fd, "0", 1);
+
+  while((n = read(fd, buf, sizeof(buf))) > 0){
+    for(i = 0; i < n / sizeof(buf[0]); i++){
+      if(buf[i].pid == 0){
+        idle++;
+        continue;
+      }
+      if(buf[i].user && buf[i].pid != pid)
+        continue;
+      count(buf[i].pc, buf[i].user);
+      total++;
+    }
+  }
+  close(fd);
+
+  // most samples first
+  for(i = 1; i < nhot; i++){
+    h = hot[i];
+    for(j = i; j > 0 && hot[j-1].count < h.count; j--)
+      hot[j] = hot[j-1];
+    hot[j] = h;
+  }
+  printf("%d samples, %d more idle\n", total, idle);
+  for(i = 0; i < nhot && i < NTOP; i++)
+    printf("%d\t%d%%\t%s\t%p\n", hot[i].count, hot[i].count * 100 / total,
+           hot[i].user ? "user" : "kernel", hot[i].pc);
+  exit(0);
+}
@@ -7,6 +7,8 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/pstat.h"
+#include "kernel/ioring.h"
 #define PAGESIZE 4096
 
 void 
@@ -58,6 +60,368 @@ forkCheck()
     }
 }
 
+// parent and child must not see each other's writes
+// to the pages they share copy-on-write after fork
+void 
+cowCheck()
+{
+    char *pages = malloc(PAGESIZE * 17);
+    for (int i = 0; i < 17; i++){
+        pages[i * PAGESIZE] = i;
+    }
+    int pid = fork();
+    if(pid == 0){
+        for (int i = 0; i < 17; i++)
+            pages[i * PAGESIZE] = 100 + i;
+        for (int i = 0; i < 17; i++)
+            if(pages[i * PAGESIZE] != 100 + i)
+                printf("cowCheck: child reads %d from page %d\n", pages[i * PAGESIZE], i);
+        exit(0);
+    }
+    int status;
+    wait(&status);
+    for (int i = 0; i < 17; i++)
+        if(pages[i * PAGESIZE] != i)
+            printf("cowCheck: parent reads %d from page %d\n", pages[i * PAGESIZE], i);
+    free(pages);
+}
+
+// page-aligned pipe transfers hand the frames over; both
+// sides must still see their own data after writing to them.
+void
+spliceCheck()
+{
+    char *buf = malloc(PAGESIZE * 5);
+    char *src = (char*)(((uint64)buf + PAGESIZE - 1) & ~(PAGESIZE - 1));
+    char *dst = src + 2 * PAGESIZE;
+    int fds[2];
+    for (int i = 0; i < 2 * PAGESIZE; i++){
+        src[i] = i % 251;
+        dst[i] = 0;
+    }
+    pipe(fds);
+    if(fork() == 0){
+        close(fds[0]);
+        write(fds[1], src, 2 * PAGESIZE);
+        src[0] = 77;
+        exit(0);
+    }
+    close(fds[1]);
+    int n = 0, r;
+    while((r = read(fds[0], dst + n, 2 * PAGESIZE - n)) > 0)
+        n += r;
+    close(fds[0]);
+    int status;
+    wait(&status);
+    if(n != 2 * PAGESIZE)
+        printf("spliceCheck: read %d bytes\n", n);
+    for (int i = 0; i < n; i++)
+        if(dst[i] != (char)(i % 251)){
+            printf("spliceCheck: byte %d is %d\n", i, dst[i]);
+            break;
+        }
+    dst[1] = 5;
+    if(src[1] != 1 || dst[1] != 5)
+        printf("spliceCheck: pages still shared\n");
+    free(buf);
+}
+
+// a shared file mapping writes through to the file, even for
+// pages evicted while mapped; a private one does not. anonymous
+// mappings are zero-filled and survive being swapped out.
+void
+mmapCheck()
+{
+    int n = 2 * MAX_PSYC_PAGES, fd, i;
+    char *p, *buf = malloc(PAGESIZE);
+    unlink("mmapfile");
+    fd = open("mmapfile", O_CREATE | O_RDWR);
+    memset(buf, 0, PAGESIZE);
+    for (i = 0; i < n; i++){
+        buf[0] = i;
+        write(fd, buf, PAGESIZE);
+    }
+    p = mmap(0, n * PAGESIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(p == (char*)-1){
+        printf("mmapCheck: mmap failed\n");
+        close(fd);
+        free(buf);
+        return;
+    }
+    for (i = 0; i < n; i++){
+        if(p[i * PAGESIZE] != (char)i)
+            printf("mmapCheck: page %d reads %d\n", i, p[i * PAGESIZE]);
+        p[i * PAGESIZE + 1] = 100 + i;
+    }
+    munmap(p, n * PAGESIZE);
+    p = mmap(0, n * PAGESIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    for (i = 0; i < n; i++){
+        if(p[i * PAGESIZE + 1] != (char)(100 + i))
+            printf("mmapCheck: page %d not written back\n", i);
+        p[i * PAGESIZE + 2] = 1;
+    }
+    munmap(p, n * PAGESIZE);
+    close(fd);
+    fd = open("mmapfile", O_RDONLY);
+    for (i = 0; i < n; i++)
+        if(read(fd, buf, PAGESIZE) != PAGESIZE || buf[2] != 0)
+            printf("mmapCheck: private page %d written back\n", i);
+    close(fd);
+    unlink("mmapfile");
+    free(buf);
+
+    p = mmap(0, n * PAGESIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    for (i = 0; i < n; i++){
+        if(p[i * PAGESIZE] != 0)
+            printf("mmapCheck: anonymous page %d not zero\n", i);
+        p[i * PAGESIZE] = i;
+    }
+    for (i = 0; i < n; i++)
+        if(p[i * PAGESIZE] != (char)i)
+            printf("mmapCheck: anonymous page %d reads %d\n", i, p[i * PAGESIZE]);
+    munmap(p, n * PAGESIZE);
+}
+
+// a shared anonymous mapping stays shared across fork, pages
+// first touched after it included, and is not copied on write.
+void
+shmCheck()
+{
+    int n = 2 * MAX_PSYC_PAGES;
+    char *p = mmap(0, n * PAGESIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+    if(p == (char*)-1){
+        printf("shmCheck: mmap failed\n");
+        return;
+    }
+    for (int i = 0; i < n / 2; i++)
+        p[i * PAGESIZE] = i;
+    int pid = fork();
+    if(pid == 0){
+        for (int i = 0; i < n; i++)
+            p[i * PAGESIZE] = 100 + i;
+        exit(0);
+    }
+    int status;
+    wait(&status);
+    for (int i = 0; i < n; i++)
+        if(p[i * PAGESIZE] != (char)(100 + i))
+            printf("shmCheck: parent reads %d from page %d\n", p[i * PAGESIZE], i);
+    munmap(p, n * PAGESIZE);
+}
+
+// heap pages that are only read, or only written with zeros, use
+// no frames: they map the zero page and are never swapped out.
+void
+zeroCheck()
+{
+    int n = 4 * MAX_PSYC_PAGES;
+    struct pagestats st0, st1;
+    char *p = sbrk(n * PAGESIZE);
+    getpagestats(0, &st0);
+    for (int i = 0; i < n; i++)
+        if(p[i * PAGESIZE] != 0)
+            printf("zeroCheck: page %d not zero\n", i);
+    for (int i = 0; i < n; i++)
+        p[i * PAGESIZE] = 0;
+    getpagestats(0, &st1);
+    // the stack and data may still go out to make room
+    if(st1.swapouts - st0.swapouts >= n / 2)
+        printf("zeroCheck: %d pages swapped out\n", (int)(st1.swapouts - st0.swapouts));
+    for (int i = 0; i < n; i++)
+        p[i * PAGESIZE + 1] = i;
+    for (int i = 0; i < n; i++)
+        if(p[i * PAGESIZE] != 0 || p[i * PAGESIZE + 1] != (char)i)
+            printf("zeroCheck: page %d reads %d\n", i, p[i * PAGESIZE + 1]);
+    sbrk(-n * PAGESIZE);
+}
+
+// an untouched heap page written into a pipe is copied, not
+// lent: the reader's page must stay a frame of its own, and the
+// pages around it must still page in and out.
+void
+zeroPipeCheck()
+{
+    int n = 2 * MAX_PSYC_PAGES, fds[2];
+    char *p = sbrk(3 * PAGESIZE);
+    char *src = (char*)(((uint64)p + PAGESIZE - 1) & ~(PAGESIZE - 1));
+    char *dst = src + PAGESIZE;
+    for (int i = 0; i < PAGESIZE; i++)
+        dst[i] = 1;
+    if(src[0] != 0)
+        printf("zeroPipeCheck: source not zero\n");
+    pipe(fds);
+    write(fds[1], src, PAGESIZE);
+    if(read(fds[0], dst, PAGESIZE) != PAGESIZE)
+        printf("zeroPipeCheck: short read\n");
+    close(fds[0]);
+    close(fds[1]);
+    for (int i = 0; i < PAGESIZE; i++)
+        if(dst[i] != 0){
+            printf("zeroPipeCheck: byte %d is %d\n", i, dst[i]);
+            break;
+        }
+    dst[0] = 9;
+    if(src[0] != 0)
+        printf("zeroPipeCheck: zero page written\n");
+    char *q = sbrk(n * PAGESIZE);
+    for (int r = 0; r < 2; r++)
+        for (int i = 0; i < n; i++)
+            q[i * PAGESIZE] = i + r;
+    for (int i = 0; i < n; i++)
+        if(q[i * PAGESIZE] != (char)(i + 1))
+            printf("zeroPipeCheck: page %d reads %d\n", i, q[i * PAGESIZE]);
+    if(dst[0] != 9)
+        printf("zeroPipeCheck: reads %d\n", dst[0]);
+    sbrk(-(n + 3) * PAGESIZE);
+}
+
+// locked pages stay in while the others are paged around them;
+// a dropped page reads as zeros again.
+void
+adviseCheck()
+{
+    int n = 4 * MAX_PSYC_PAGES;
+    struct pagestats st0, st1;
+    char *p = sbrk(n * PAGESIZE);
+    for (int i = 0; i < n; i++)
+        p[i * PAGESIZE] = i + 1;
+    if(mlock(p, 2 * PAGESIZE) < 0)
+        printf("adviseCheck: mlock failed\n");
+    for (int r = 0; r < 2; r++)
+        for (int i = 2; i < n; i++)
+            p[i * PAGESIZE]++;
+    getpagestats(0, &st0);
+    if(p[0] != 1 || p[PAGESIZE] != 2)
+        printf("adviseCheck: locked pages read %d %d\n", p[0], p[PAGESIZE]);
+    getpagestats(0, &st1);
+    if(st1.majfaults != st0.majfaults)
+        printf("adviseCheck: locked pages were swapped out\n");
+    if(munlock(p, 2 * PAGESIZE) < 0)
+        printf("adviseCheck: munlock failed\n");
+    if(madvise(p + 2 * PAGESIZE, PAGESIZE, MADV_DONTNEED) < 0 || p[2 * PAGESIZE] != 0)
+        printf("adviseCheck: dropped page reads %d\n", p[2 * PAGESIZE]);
+    if(madvise(p, n * PAGESIZE, MADV_SEQUENTIAL) < 0 || madvise(p, n * PAGESIZE, MADV_WILLNEED) < 0)
+        printf("adviseCheck: madvise failed\n");
+    for (int i = 3; i < n; i++)
+        if(p[i * PAGESIZE] != (char)(i + 3))
+            printf("adviseCheck: page %d reads %d\n", i, p[i * PAGESIZE]);
+    if(madvise(p + n * PAGESIZE, PAGESIZE, MADV_WILLNEED) == 0)
+        printf("adviseCheck: madvise past the heap\n");
+    sbrk(-n * PAGESIZE);
+}
+
+// queues sqe for ioringCheck().
+void
+ioq(struct ioring *r, int op, int flags, uint64 a0, uint64 a1, uint64 a2)
+{
+    struct sqe *e = &r->sq[r->sqtail % IORING_SIZE];
+    e->op = op;
+    e->flags = flags;
+    e->arg[0] = a0;
+    e->arg[1] = a1;
+    e->arg[2] = a2;
+    e->user = r->sqtail++;
+}
+
+// files created, written and read back, one ioring_enter() for each
+// pass; the results come back in order.
+void
+ioringCheck()
+{
+    static struct ioring r;
+    char name[] = "ioring0", buf[8];
+    int n;
+
+    for (int i = 0; i < 4; i++) {
+        name[6] = '0' + i;
+        ioq(&r, SYS_open, 0, (uint64)name, O_CREATE | O_WRONLY, 0);
+        ioq(&r, SYS_write, IOSQE_LASTFD, 0, (uint64)name, 8);
+        ioq(&r, SYS_close, IOSQE_LASTFD, 0, 0, 0);
+    }
+    for (int i = 0; i < 4; i++) {
+        ioq(&r, SYS_getpid, 0, 0, 0, 0);    // not allowed: fails alone
+        ioq(&r, SYS_unlink, 0, (uint64)"ioring-none", 0, 0);
+    }
+    if((n = ioring_enter(&r, 100)) != 20)
+        printf("ioringCheck: ran %d of 20\n", n);
+    for (; r.cqhead != r.cqtail; r.cqhead++) {
+        struct cqe *c = &r.cq[r.cqhead % IORING_SIZE];
+        int want = c->user < 12 ? (c->user % 3 == 1 ? 8 : 0) : -1;
+        if(c->user != r.cqhead || (c->user % 3 == 0 && c->user < 12 ? c->res < 0 : c->res != want))
+            printf("ioringCheck: entry %d returned %d\n", (int)c->user, c->res);
+    }
+    for (int i = 0; i < 4; i++) {
+        name[6] = '0' + i;
+        int fd = open(name, O_RDONLY);
+        if(fd < 0 || read(fd, buf, 8) != 8 || memcmp(buf, name, 8) != 0)
+            printf("ioringCheck: %s not written\n", name);
+        close(fd);
+        unlink(name);
+    }
+}
+
+#define NTHREADS 4
+char *tbuf;
+int tpages;
+
+void
+threadBody(void *arg)
+{
+    int t = (int)(uint64)arg;
+    for (int r = 0; r < 3; r++)
+        for (int i = t; i < tpages; i += NTHREADS)
+            tbuf[i * PAGESIZE] += i + 1;
+    _exit(0);
+}
+
+// threads writing their own pages of one heap, enough of it to
+// swap, while the others fault too
+void
+threadCheck()
+{
+    char *stacks[NTHREADS];
+    int st;
+    tpages = 4 * MAX_PSYC_PAGES;
+    for (int t = 0; t < NTHREADS; t++)
+        stacks[t] = malloc(PAGESIZE);
+    tbuf = sbrk(tpages * PAGESIZE);
+    for (int t = 0; t < NTHREADS; t++)
+        if(clone(threadBody, (void*)(uint64)t, stacks[t] + PAGESIZE) < 0)
+            printf("threadCheck: clone failed\n");
+    for (int t = 0; t < NTHREADS; t++)
+        if(wait(&st) < 0 || st != 0)
+            printf("threadCheck: thread %d status %d\n", t, st);
+    for (int i = 0; i < tpages; i++)
+        if(tbuf[i * PAGESIZE] != (char)(3 * (i + 1)))
+            printf("threadCheck: page %d reads %d\n", i, tbuf[i * PAGESIZE]);
+    sbrk(-tpages * PAGESIZE);
+    for (int t = 0; t < NTHREADS; t++)
+        free(stacks[t]);
+}
+
+// text is shared read-only by every process running the program:
+// writing it, or reading a file into it, must fail
+void
+textCheck()
+{
+    volatile char *text = (char*)textCheck;
+    char c = *text;
+    int fd, st;
+    if(fork() == 0){
+        *text = c + 1;
+        exit(0);
+    }
+    if(wait(&st) < 0 || st != -1)
+        printf("textCheck: writing text exited %d\n", st);
+    if((fd = open("tests", O_RDONLY)) >= 0){
+        if(read(fd, (char*)text, 1) >= 0)
+            printf("textCheck: read into text\n");
+        close(fd);
+    }
+    if(*text != c)
+        printf("textCheck: text changed\n");
+}
+
 int 
 main()
 {
@@ -65,6 +429,16 @@ main()
     sanity();
     nfua_or_lapa();
     forkCheck();
+    cowCheck();
+    spliceCheck();
+    mmapCheck();
+    shmCheck();
+    zeroCheck();
+    zeroPipeCheck();
+    ioringCheck();
+    adviseCheck();
+    threadCheck();
+    textCheck();
     exit(0);
     printf("Everything is Done.\n");
 }
@@ -0,0 +1,87 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/spinlock.h"
+#include "kernel/sleeplock.h"
+#include "kernel/fs.h"
+#include "kernel/file.h"
+#include "kernel/trace.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// trace on|off|dump
+// turns the kernel's tracepoints on or off, or prints and empties
+// what they have recorded. times are microseconds after the first
+// record printed.
+
+char *events[] = {
+  [TR_FAULT]     "fault",
+  [TR_SWAPIN]    "swapin",
+  [TR_EVICT]     "evict",
+  [TR_SWITCHIN]  "switchin",
+  [TR_SWITCHOUT] "switchout",
+  [TR_BHIT]      "bhit",
+  [TR_BMISS]     "bmiss",
+  [TR_LOST]      "lost",
+};
+
+#define NEVENTS (sizeof(events) / sizeof(events[0]))
+
+struct tracerec buf[32];
+
+int
+opentrace(int mode)
+{
+  int fd;
+
+  if((fd = open("/dev/trace", mode)) < 0){
+    mkdir("/dev");
+    mknod("/dev/trace", TRACE, 0);
+    fd = open("/dev/trace", mode);
+  }
+  return fd;
+}
+
+void
+dump(int fd)
+{
+  struct tracerec *r;
+  uint64 t0 = 0;
+  int n, i;
+
+  while((n = read(fd, buf, sizeof(buf))) > 0){
+    for(i = 0; i < n / sizeof(buf[0]); i++){
+      r = &buf[i];
+      if(t0 == 0)
+        t0 = r->time;
+      printf("%d cpu %d pid %d %s %p %p\n", (int)((long)(r->time - t0) / 10), r->cpu, r->pid,
+             r->ev < NEVENTS && events[r->ev] ? events[r->ev] : "?", r->a, r->b);
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd;
+
+  if(argc != 2){
+    fprintf(2, "usage: trace on|off|dump\n");
+    exit(1);
+  }
+  if((fd = opentrace(O_RDWR)) < 0){
+    fprintf(2, "trace: cannot open /dev/trace\n");
+    exit(1);
+  }
+  if(strcmp(argv[1], "on") == 0)
+    write(fd, "1", 1);
+  else if(strcmp(argv[1], "off") == 0)
+    write(fd, "0", 1);
+  else if(strcmp(argv[1], "dump") == 0)
+    dump(fd);
+  else {
+    fprintf(2, "usage: trace on|off|dump\n");
+    exit(1);
+  }
+  close(fd);
+  exit(0);
+}
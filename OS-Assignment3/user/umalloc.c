@@ -2,31 +2,55 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/param.h"
+#include "kernel/fcntl.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator.
+//
+// Small blocks, up to 2048 bytes with their header, come from one
+// free list per power-of-two size class, so malloc() and free() of
+// them are O(1). A class is refilled a page at a time from the
+// large heap below, and its blocks stay in it when freed.
+//
+// Larger ones are the allocator by Kernighan and Ritchie,
+// The C programming Language, 2nd ed.  Section 8.7: a first-fit
+// list, sorted by address, of what sbrk() gave. When the free block
+// at the top of the heap gets big, free() gives most of it back
+// with sbrk(-n), for the kernel to reuse the frames. Blocks of
+// MMAPMIN bytes or more get an mmap() of their own, if there is
+// one left, and are unmapped when freed.
 
 typedef long Align;
 
 union header {
   struct {
     union header *ptr;
-    uint size;
+    uint size;    // in headers, this one included
+    uint cls;     // size class, or LARGE or MAPPED
   } s;
   Align x;
 };
 
 typedef union header Header;
 
+#define MINCLASS  32                // bytes in class 0
+#define NCLASS    7                 // up to 2048
+#define LARGE     NCLASS
+#define MAPPED    (NCLASS + 1)
+#define MMAPMIN   (128 * 1024)
+#define TRIM      (128 * 1024)      // free bytes at the top that are given back
+#define PAGE      4096
+
 static Header base;
 static Header *freep;
+static Header *classes[NCLASS];
 
-void
-free(void *ap)
+// the K&R free, for LARGE blocks. returns the free block bp
+// ended up in.
+static Header*
+lfree(Header *bp)
 {
-  Header *bp, *p;
+  Header *p;
 
-  bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -38,9 +62,30 @@ free(void *ap)
   if(p + p->s.size == bp){
     p->s.size += bp->s.size;
     p->s.ptr = bp->s.ptr;
+    bp = p;
   } else
     p->s.ptr = bp;
   freep = p;
+  return bp;
+}
+
+// if the free block q ends the heap and is more than TRIM bytes,
+// shrink it to end at the first page boundary past its header,
+// and the heap with it.
+static void
+trim(Header *q)
+{
+  char *top, *end;
+
+  if(q->s.size * sizeof(Header) <= TRIM)
+    return;
+  top = sbrk(0);
+  if((char*)(q + q->s.size) != top)
+    return;
+  end = (char*)(((uint64)(q + 1) + PAGE - 1) & ~(uint64)(PAGE - 1));
+  if(sbrk(-(int)(top - end)) == (char*)-1)
+    return;
+  q->s.size = (Header*)end - q;
 }
 
 static Header*
@@ -56,17 +101,17 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  hp->s.cls = LARGE;
+  lfree(hp);
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+// a LARGE block of nunits headers from the first-fit list.
+static Header*
+lmalloc(uint nunits)
 {
   Header *p, *prevp;
-  uint nunits;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
     base.s.size = 0;
@@ -80,11 +125,89 @@ malloc(uint nbytes)
         p += p->s.size;
         p->s.size = nunits;
       }
+      p->s.cls = LARGE;
       freep = prevp;
-      return (void*)(p + 1);
+      return p;
     }
     if(p == freep)
       if((p = morecore(nunits)) == 0)
         return 0;
   }
 }
+
+// carves a page from the large heap into blocks of class c.
+static int
+refill(int c)
+{
+  uint sz = MINCLASS << c;
+  Header *h, *b;
+  char *page;
+
+  if((h = lmalloc(PAGE / sizeof(Header) + 1)) == 0)
+    return -1;
+  page = (char*)(h + 1);
+  for(char *a = page; a + sz <= page + PAGE; a += sz){
+    b = (Header*)a;
+    b->s.size = sz / sizeof(Header);
+    b->s.cls = c;
+    b->s.ptr = classes[c];
+    classes[c] = b;
+  }
+  return 0;
+}
+
+// a block of its own for nbytes, or 0 if mmap() fails.
+static Header*
+mapped(uint nbytes)
+{
+  uint64 len = ((uint64)nbytes + sizeof(Header) + PAGE - 1) & ~(uint64)(PAGE - 1);
+  Header *h;
+
+  h = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+  if(h == (Header*)-1)
+    return 0;
+  h->s.size = len / sizeof(Header);
+  h->s.cls = MAPPED;
+  return h;
+}
+
+void
+free(void *ap)
+{
+  Header *bp;
+
+  if(ap == 0)
+    return;
+  bp = (Header*)ap - 1;
+  if(bp->s.cls < NCLASS){
+    bp->s.ptr = classes[bp->s.cls];
+    classes[bp->s.cls] = bp;
+  } else if(bp->s.cls == MAPPED)
+    munmap(bp, (uint64)bp->s.size * sizeof(Header));
+  else
+    trim(lfree(bp));   // not from morecore(): the new block is wanted
+}
+
+void*
+malloc(uint nbytes)
+{
+  Header *p;
+  uint n;
+  int c;
+
+  if(nbytes <= (MINCLASS << (NCLASS - 1)) - sizeof(Header)){
+    n = nbytes + sizeof(Header);
+    for(c = 0; (MINCLASS << c) < n; c++)
+      ;
+    if(classes[c] == 0 && refill(c) < 0)
+      return 0;
+    p = classes[c];
+    classes[c] = p->s.ptr;
+    return (void*)(p + 1);
+  }
+  if(nbytes >= MMAPMIN && (p = mapped(nbytes)) != 0)
+    return (void*)(p + 1);
+  if((p = lmalloc((nbytes + sizeof(Header) - 1)/sizeof(Header) + 1)) == 0)
+    return 0;
+  return (void*)(p + 1);
+}
@@ -1,5 +1,8 @@
 struct stat;
 struct rtcdate;
+struct pagestats;
+struct ioring;
+struct kbench;
 
 // system calls
 int fork(void);
@@ -23,6 +26,21 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int fsync(int);
+int setpolicy(int, int);
+int getpagestats(int, struct pagestats*);
+uint64 nanotime(void);
+int setnice(int, int);
+void* mmap(void*, uint64, int, int, int, uint);
+int munmap(void*, uint64);
+int ioring_enter(struct ioring*, int);
+int madvise(void*, uint64, int);
+int mlock(void*, uint64);
+int munlock(void*, uint64);
+// a thread must not print, and ends with _exit(), see printf.c.
+int clone(void (*)(void*), void*, void*);
+int _exit(int) __attribute__((noreturn));
+int kbench(int, int, void*, uint64, struct kbench*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -32,6 +50,7 @@ char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
 void fprintf(int, const char*, ...);
 void printf(const char*, ...);
+void fflush(int);
 char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);